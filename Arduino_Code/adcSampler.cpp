@@ -0,0 +1,141 @@
+#include <Arduino.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#include "adcSampler.h"
+#include "config.h"
+#include "ringBuffer.h"
+
+static SpscRing<AdcScan, ADC_RING_SIZE> scanRing;
+static uint8_t adcChannels[ADC_CHANNEL_COUNT];
+static volatile uint8_t channelIndex = 0;
+static volatile uint16_t overruns = 0;
+static AdcScan currentScan;
+static volatile uint8_t conversionCount = 0;  // Wraps, only differences are used
+
+#if ADC_QUIET_SAMPLING
+static uint32_t quietConversions = 0;
+static uint32_t idleConversions = 0;
+#endif
+
+// AVcc reference, right-adjusted result, channels 0-7 (MUX5 stays clear)
+static inline void selectChannel(uint8_t channel) {
+  ADMUX = _BV(REFS0) | (channel & 0x07);
+}
+
+void adcSamplerBegin(const uint8_t pins[ADC_CHANNEL_COUNT], uint16_t scanRateHz) {
+  for (uint8_t i = 0; i < ADC_CHANNEL_COUNT; i++) {
+    adcChannels[i] = pins[i] - A0;
+    DIDR0 |= _BV(adcChannels[i]);  // Digital input buffer off on analog pins
+  }
+
+#if ADC_QUIET_SAMPLING
+  // Single conversions started by adcSamplerBurst(), Timer1 is not needed
+  power_timer1_disable();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    channelIndex = 0;
+    selectChannel(adcChannels[0]);
+    ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  }
+  return;
+#endif
+
+  // Timer1 in CTC mode, one tick per conversion
+  uint32_t conversionRate = (uint32_t)scanRateHz * ADC_CHANNEL_COUNT;
+  uint32_t ticks = F_CPU / 8 / conversionRate;
+  uint8_t prescaler = _BV(CS11);  // clk/8
+  if (ticks > 65536UL) {
+    ticks = F_CPU / 64 / conversionRate;
+    prescaler = _BV(CS11) | _BV(CS10);  // clk/64
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    channelIndex = 0;
+    selectChannel(adcChannels[0]);
+
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12);
+    TCNT1 = 0;
+    OCR1A = ticks - 1;
+    OCR1B = ticks - 1;
+    TIMSK1 = 0;
+    TIFR1 = _BV(OCF1B);
+
+    // Auto-trigger source: Timer1 compare match B, ADC clock = F_CPU/128
+    ADCSRB = _BV(ADTS2) | _BV(ADTS0);
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+
+    TCCR1B |= prescaler;
+  }
+}
+
+bool adcSamplerRead(AdcScan& scan) {
+  return scanRing.pop(scan);
+}
+
+bool adcSamplerPending() {
+  return !scanRing.empty();
+}
+
+#if ADC_QUIET_SAMPLING
+void adcSamplerBurst(uint8_t scans) {
+  if (scans > ADC_RING_SIZE) scans = ADC_RING_SIZE;
+
+  for (uint8_t left = scans * ADC_CHANNEL_COUNT; left > 0; left--) {
+    uint8_t before = conversionCount;
+    uint8_t wakeups = 0;
+    ADCSRA |= _BV(ADSC);
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    for (;;) {
+      cli();
+      if (conversionCount != before) break;
+      sleep_enable();
+      sei();  // The sleep runs before any pending interrupt
+      sleep_cpu();
+      sleep_disable();
+      wakeups++;
+    }
+    sei();
+    // Only the ADC interrupt woke the CPU: it was halted for the whole conversion
+    if (wakeups == 1) {
+      quietConversions++;
+    } else {
+      idleConversions++;
+    }
+  }
+}
+
+uint32_t adcSamplerQuietConversions() {
+  return quietConversions;
+}
+
+uint32_t adcSamplerIdleConversions() {
+  return idleConversions;
+}
+#endif
+
+uint16_t adcSamplerOverruns() {
+  uint16_t count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    count = overruns;
+  }
+  return count;
+}
+
+ISR(ADC_vect) {
+  // The trigger fires on the rising edge of OCF1B, so clear it for the next tick
+  TIFR1 = _BV(OCF1B);
+
+  uint8_t index = channelIndex;
+  currentScan.raw[index] = ADC;
+  if (++index >= ADC_CHANNEL_COUNT) {
+    index = 0;
+    if (!scanRing.push(currentScan)) overruns++;
+  }
+  channelIndex = index;
+  conversionCount++;
+
+  // Takes effect for the conversion started by the next timer tick or burst step
+  selectChannel(adcChannels[index]);
+}
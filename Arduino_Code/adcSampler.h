@@ -0,0 +1,54 @@
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+// Timer-driven ADC scan engine.
+//
+// Timer1 compare match B auto-triggers one conversion per tick. The
+// ADC-complete ISR stores the result, switches the multiplexer to the next
+// channel and, after the last channel, pushes a full scan into a lock-free
+// ring buffer that loop() drains with adcSamplerRead(). Sample timing is set
+// by the timer alone, not by how long the rest of the loop takes.
+//
+// With ADC_QUIET_SAMPLING the timer is not used. adcSamplerBurst() instead
+// takes a burst of scans with the CPU in idle sleep during each conversion,
+// so the core is halted while the ADC samples. The scans go into the same
+// ring. A burst is called from the scheduler, so it never overlaps a display
+// flush. SLEEP_MODE_ADC would also stop clkIO, and with it the UARTs and
+// Timer0: a command byte from the host, an RS-485 byte or a PMS5003 frame
+// arriving during a conversion would be lost. Another interrupt (Timer0,
+// a UART) can still wake the CPU mid-conversion; such conversions are
+// counted apart.
+#define ADC_CHANNEL_COUNT 3
+
+struct AdcScan {
+  uint16_t raw[ADC_CHANNEL_COUNT];  // In the order the pins were given
+};
+
+// Start scanning the given analog pins (A0-A7) scanRateHz times per second,
+// with ADC_QUIET_SAMPLING only set up the ADC for adcSamplerBurst()
+void adcSamplerBegin(const uint8_t pins[ADC_CHANNEL_COUNT], uint16_t scanRateHz);
+
+#if ADC_QUIET_SAMPLING
+// Take the given number of scans (at most ADC_RING_SIZE), blocks about
+// 0.3 ms per scan
+void adcSamplerBurst(uint8_t scans);
+
+// Conversions with the CPU halted throughout, and ones another interrupt woke it during
+uint32_t adcSamplerQuietConversions();
+uint32_t adcSamplerIdleConversions();
+#endif
+
+// Take the oldest buffered scan, returns false if none is ready
+bool adcSamplerRead(AdcScan& scan);
+
+// True if a scan is waiting, safe to call with interrupts disabled
+bool adcSamplerPending();
+
+// Scans dropped because the ring buffer was full
+uint16_t adcSamplerOverruns();
+
+#endif
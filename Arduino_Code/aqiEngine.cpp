@@ -0,0 +1,92 @@
+#include "aqiEngine.h"
+
+struct AqiBreakpoint {
+  uint16_t concentrationHigh;  // Upper end of the band, tenths
+  uint16_t indexHigh;
+};
+
+// EPA breakpoints; each band starts one tenth above the previous one
+static const AqiBreakpoint coBreakpoints[] PROGMEM = {
+  { 44, 50 }, { 94, 100 }, { 124, 150 }, { 154, 200 }, { 304, 300 }, { 404, 400 }, { 504, 500 },
+};
+
+// 2024 revision of the PM2.5 table
+static const AqiBreakpoint pm25Breakpoints[] PROGMEM = {
+  { 90, 50 }, { 354, 100 }, { 554, 150 }, { 1254, 200 }, { 2254, 300 }, { 3254, 500 },
+};
+
+static const char CATEGORY_GOOD[] PROGMEM = "Good";
+static const char CATEGORY_MODERATE[] PROGMEM = "Moderate";
+static const char CATEGORY_SENSITIVE[] PROGMEM = "Unhealthy for Sensitive Groups";
+static const char CATEGORY_UNHEALTHY[] PROGMEM = "Unhealthy";
+static const char CATEGORY_VERY_UNHEALTHY[] PROGMEM = "Very Unhealthy";
+static const char CATEGORY_HAZARDOUS[] PROGMEM = "Hazardous";
+
+uint16_t aqiFor(AqiPollutant pollutant, uint16_t concentration) {
+  const AqiBreakpoint* table = pollutant == AQI_CO ? coBreakpoints : pm25Breakpoints;
+  uint8_t bands = pollutant == AQI_CO ? sizeof(coBreakpoints) / sizeof(coBreakpoints[0])
+                                      : sizeof(pm25Breakpoints) / sizeof(pm25Breakpoints[0]);
+
+  uint16_t concentrationLow = 0;
+  uint16_t indexLow = 0;
+  for (uint8_t i = 0; i < bands; i++) {
+    uint16_t concentrationHigh = pgm_read_word(&table[i].concentrationHigh);
+    uint16_t indexHigh = pgm_read_word(&table[i].indexHigh);
+    if (concentration <= concentrationHigh) {
+      // I = (Ihi - Ilo) / (Chi - Clo) * (C - Clo) + Ilo, rounded
+      uint16_t span = concentrationHigh - concentrationLow;
+      uint32_t scaled = (uint32_t)(indexHigh - indexLow) * (concentration - concentrationLow);
+      return indexLow + (scaled + span / 2) / span;
+    }
+    concentrationLow = concentrationHigh + 1;
+    indexLow = indexHigh + 1;
+  }
+  return AQI_MAX;
+}
+
+uint8_t aqiAveragingHours(AqiPollutant pollutant) {
+  return pollutant == AQI_CO ? 8 : 24;
+}
+
+PGM_P aqiCategoryName(uint16_t aqi) {
+  if (aqi <= 50) return CATEGORY_GOOD;
+  if (aqi <= 100) return CATEGORY_MODERATE;
+  if (aqi <= 150) return CATEGORY_SENSITIVE;
+  if (aqi <= 200) return CATEGORY_UNHEALTHY;
+  if (aqi <= 300) return CATEGORY_VERY_UNHEALTHY;
+  return CATEGORY_HAZARDOUS;
+}
+
+HourlyAverage::HourlyAverage() : newest(0), filled(0), sum(0), count(0), hourStart(0) {}
+
+void HourlyAverage::add(uint16_t value, uint32_t now) {
+  if (count == 0 && filled == 0) hourStart = now;
+
+  if (now - hourStart >= AQI_HOUR_MS && count > 0) {
+    newest = (newest + 1) % AQI_HISTORY_HOURS;
+    history[newest] = sum / count;
+    if (filled < AQI_HISTORY_HOURS) filled++;
+    sum = 0;
+    count = 0;
+    hourStart += AQI_HOUR_MS;
+    // After a long gap start the new hour now rather than filling it in
+    if (now - hourStart >= AQI_HOUR_MS) hourStart = now;
+  }
+
+  sum += value;
+  count++;
+}
+
+uint16_t HourlyAverage::average(uint8_t hours) const {
+  uint32_t total = 0;
+  uint8_t used = 0;
+  if (count > 0) {
+    total = sum / count;
+    used = 1;
+  }
+  for (uint8_t i = 0; used < hours && i < filled; i++) {
+    total += history[(newest + AQI_HISTORY_HOURS - i) % AQI_HISTORY_HOURS];
+    used++;
+  }
+  return used > 0 ? total / used : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef AQI_ENGINE_H
+#define AQI_ENGINE_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// On-device US EPA Air Quality Index.
+//
+// Concentrations are averaged the way the EPA defines each pollutant's index
+// (CO over 8 hours, PM2.5 over 24) and mapped through the breakpoint tables
+// in PROGMEM by linear interpolation, all in integer tenths. The history is
+// one average per hour in a small ring, so a day of data costs 60 bytes of
+// SRAM per pollutant: 48 for the 24 hourly averages and 12 for the ring
+// position and the running hour, which counts as the newest entry.
+#define AQI_HISTORY_HOURS 24
+#define AQI_HOUR_MS 3600000UL
+#define AQI_MAX 500
+
+enum AqiPollutant : uint8_t {
+  AQI_CO,    // 8-hour average, tenths of ppm
+  AQI_PM25,  // 24-hour average, tenths of ug/m3
+  AQI_POLLUTANT_COUNT,
+};
+
+// Index for an averaged concentration in the pollutant's units, capped at AQI_MAX
+uint16_t aqiFor(AqiPollutant pollutant, uint16_t concentration);
+
+// Hours the pollutant's index is averaged over
+uint8_t aqiAveragingHours(AqiPollutant pollutant);
+
+// Category text ("Good" .. "Hazardous") for an index, in PROGMEM
+PGM_P aqiCategoryName(uint16_t aqi);
+
+// Hourly averages of one pollutant
+class HourlyAverage {
+public:
+  HourlyAverage();
+
+  void add(uint16_t value, uint32_t now);
+
+  // Average of the hourly averages over the last `hours` hours, the running
+  // hour included; fewer hours while the history fills
+  uint16_t average(uint8_t hours) const;
+
+  bool empty() const { return filled == 0 && count == 0; }
+
+private:
+  uint16_t history[AQI_HISTORY_HOURS];  // Completed hours, newest at newest
+  uint8_t newest;
+  uint8_t filled;
+
+  uint32_t sum;  // Running hour
+  uint16_t count;
+  uint32_t hourStart;
+};
+
+#endif
@@ -2,224 +2,1770 @@
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
 
+#include "config.h"
+#include "adcSampler.h"
+#include "aqiEngine.h"
+#include "batchBuffer.h"
+#include "busLink.h"
+#include "calibrationStore.h"
+#include "changeReporter.h"
+#include "commandParser.h"
+#include "heaterCycle.h"
+#include "jsonTemplate.h"
+#include "lowPower.h"
+#include "memoryGuard.h"
+#include "oledRenderer.h"
+#include "pmsSensor.h"
+#include "ppmConversion.h"
+#include "profiler.h"
+#include "recovery.h"
+#include "rollingStats.h"
+#include "sdLog.h"
+#include "sensorChannel.h"
+#include "sensorFilter.h"
+#include "serialProtocol.h"
+#include "settingsStore.h"
+#include "taskScheduler.h"
+#include "txQueue.h"
+#include "wallClock.h"
+#include "warmupMonitor.h"
+
 // OLED Display Configuration
 #define SCREEN_WIDTH 128
 #define SCREEN_HEIGHT 64
 #define OLED_RESET -1
 #define SCREEN_ADDRESS 0x3C  // Change to 0x3D if needed
+#define I2C_CLOCK 400000UL   // Fast mode I2C for display updates
+#define I2C_TIMEOUT_US 25000UL  // Give up on a transfer the bus never completes
+
+Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET, I2C_CLOCK, I2C_CLOCK);
+#if STATIC_ALLOCATION
+static_assert(MEMORY_HEAP_SIZE >= SCREEN_WIDTH * ((SCREEN_HEIGHT + 7) / 8) + 2, "the heap arena must hold the display buffer");
+#endif
+OledRenderer oled(display, SCREEN_ADDRESS);
+bool displayPresent = false;  // False: no OLED answered at boot, the board runs headless
 
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
+// Screen layout, only fields whose text changed are redrawn
+enum DisplayField { FIELD_AQI, FIELD_STATUS, FIELD_CO, FIELD_CH4, FIELD_AQ, FIELD_COUNT };
+const OledField displayLayout[FIELD_COUNT] = {
+  { 0, 10, 2 },  // FIELD_AQI
+  { 0, 28, 1 },  // FIELD_STATUS
+  { 0, 38, 1 },  // FIELD_CO
+  { 0, 48, 1 },  // FIELD_CH4
+  { 0, 58, 1 },  // FIELD_AQ
+};
 
 // Sensor Pins
 const int MQ7_PIN = A0;    // CO Sensor
 const int MQ135_PIN = A1;  // Air Quality Sensor
 const int MQ4_PIN = A2;    // Methane Sensor
 
-// Variables to store sensor readings
-int mq7Value = 0;     
-int mq135Value = 0;   
-int mq4Value = 0;     
-float co_ppm = 0;
-float ch4_ppm = 0;
-float air_quality_ppm = 0;
+// Place of each gas reading in the wire order of JSON samples, batch records
+// and the SD log: co, ch4, airQuality
+enum GasSlot { SLOT_CO, SLOT_CH4, SLOT_AQ, GAS_SLOT_COUNT };
+
+// Sensor channels, in GasSensor order, which is also the ADC scan order:
+//   X(channel, pin, curve, limits, slot, field, rawField, displayField, label, counts)
+// field and rawField name the reading in SampleRecord and BatchRecord, counts
+// is what the reading is converted from. The per-channel code iterates over
+// this table, so a sensor is added here and nowhere else in the sketch.
+#define GAS_CHANNELS(X) \
+  X(coChannel, MQ7_PIN, Mq7Curve, CoLimits, SLOT_CO, co, mq7Raw, FIELD_CO, "CO: ", coFilterValue()) \
+  X(airQualityChannel, MQ135_PIN, Mq135Curve, AirQualityLimits, SLOT_AQ, airQuality, mq135Raw, FIELD_AQ, "AQ: ", airQualityChannel.filtered()) \
+  X(ch4Channel, MQ4_PIN, Mq4Curve, Ch4Limits, SLOT_CH4, ch4, mq4Raw, FIELD_CH4, "CH4: ", ch4Channel.filtered())
+
+// Each channel holds its oversampling filter, last raw sample and ppm
+// reading; conversion and limits are resolved at compile time (sensorChannel.h)
+#define CHANNEL_DECLARE(channel, pin, curve, limits, ...) SensorChannel<pin, curve, limits> channel;
+GAS_CHANNELS(CHANNEL_DECLARE)
+
+#define CHANNEL_PIN(channel, ...) channel.pin,
+const uint8_t SENSOR_PINS[ADC_CHANNEL_COUNT] = { GAS_CHANNELS(CHANNEL_PIN) };
 
-// Variables for displaying AQI (will be calculated on server)
+#if PM_SENSOR
+// Particulate readings from the PMS5003, fed at the sensor's own rate
+ValueChannel<PmLimits> pm25Channel;
+ValueChannel<PmLimits> pm10Channel;
+uint32_t pmTime = 0;   // millis() of the last valid frame
+bool pmValid = false;  // False until the first one
+#endif
+
+// Sensor warm-up state, readings are flagged until the sensors settle
+WarmupMonitor warmup;
+
+// Variables for displaying AQI, computed on the device unless the server sent one
 int aqi = 0;
-String airQualityMessage = "Calculating...";
+char airQualityMessage[32];  // Set from flash in setup(), an initialiser would hold a RAM copy
+#if AQI_ON_DEVICE
+HourlyAverage coHistory;        // Hourly CO averages in tenths of ppm
+#if PM_SENSOR
+HourlyAverage pm25History;      // Hourly PM2.5 averages in tenths of ug/m3
+#endif
+#endif
+uint32_t hostAqiTime = 0;       // millis() of the last AQI from the server
+bool hostAqi = false;           // The server's AQI is on the display
+
+#if ROLLING_STATS
+// 1-minute, 15-minute and hourly statistics of the live readings. Kept in
+// .noinit so a warm restart resumes them, see recovery.h.
+RollingStats rolling __attribute__((section(".noinit")));
+#endif
 
-// Sensor calibration values (adjust based on datasheet or calibration)
-const float MQ7_RATIO_CLEAN_AIR = 9.83;
-const float MQ135_RATIO_CLEAN_AIR = 3.6;
-const float MQ4_RATIO_CLEAN_AIR = 4.4;
+#if SD_LOG
+// Logged per reading: co, ch4 and airQuality, then pm25 and pm10 (0 while stale)
+#define LOG_CHANNELS (GAS_SLOT_COUNT + 2 * PM_SENSOR)
+#endif
 
-// Timing variables
-unsigned long previousMillis = 0;
+// Timing variables, defaults for the periods set with "config"
 const long sensorReadInterval = 2000;      // Read sensors every 2 seconds
 const long serialTransmitInterval = 5000;  // Send to PC every 5 seconds
+const long displayUpdateInterval = 2000;   // Refresh the OLED every 2 seconds
+#define CONFIG_MIN_PERIOD 100UL            // Limits for periods set at runtime, ms
+#define CONFIG_MAX_PERIOD 3600000UL
+
+// Serial protocol state
+uint8_t protocolMode = DEFAULT_PROTOCOL;  // PROTOCOL_BINARY or PROTOCOL_JSON
+uint16_t sampleSeq = 0;                   // Sequence number of the next sample
+uint16_t snapshotSeq = 0;                 // sampleSeq in the last recovery snapshot
+CommandParser commandParser;              // Line assembly for commands from the server
+uint8_t txFrame[FRAME_MAX_PAYLOAD + FRAME_OVERHEAD];  // Shared buffer for large frames
+
+// Batch transmission, records wait here until the server acknowledges them
+BatchBuffer batch;
+uint8_t batchSize = DEFAULT_BATCH_SIZE;  // Records per burst, 0 = no batching
+uint8_t pendingRecords = 0;             // Records added since the last burst
+uint8_t batchEncoding = DEFAULT_BATCH_ENCODING;  // Binary bursts plain or delta coded
+
+// MQ-7 heater cycling, CO is only valid when latched at the end of a low phase
+HeaterCycle heater;
+uint16_t coCountsQ4 = 0;           // Filtered MQ-7 value at the last end of a low phase
+bool coValid = !MQ7_HEATER_CYCLE;  // False until the first latch
+
+// Clean-air R0 measurement started by "cal start"
+#define CALIBRATION_READINGS 15  // Sensor ticks averaged, 30 s at the default interval
+#define CALIBRATION_CYCLES 3     // MQ-7 latches averaged with heater cycling, 7.5 min
+uint8_t calibrationRemaining = 0;          // Ticks still to collect, 0 = idle
+uint8_t calibrationCycles = 0;             // MQ-7 latches still to collect
+float calibrationSum[GAS_SENSOR_COUNT];    // Summed Rs per sensor, kOhm
+
+// Report-on-change mode, replaces the fixed transmit interval when enabled
+uint16_t reportDeadbands[] = { REPORT_DEADBAND_CO, REPORT_DEADBAND_CH4, REPORT_DEADBAND_AQ };
+ChangeReporter reporter(reportDeadbands, 3, REPORT_HEARTBEAT_MS);
+bool reportOnChange = DEFAULT_REPORT_ON_CHANGE;
+
+// OLED power: lit, blanked, or following the DISPLAY_CYCLE_MS schedule
+enum DisplayPower { DISPLAY_AUTO, DISPLAY_ON, DISPLAY_OFF };
+uint8_t displayPower = DISPLAY_AUTO;
+
+// Output to the server goes through the TX queue so it never blocks a task
+TxQueue txQueue(Serial, TX_CTS_PIN);
+
+// Host link rate; after "baud <rate>" it falls back unless the host confirms
+const uint32_t supportedBauds[] PROGMEM = { 9600, 19200, 38400, 57600, 115200, 250000, 500000, 1000000 };
+uint32_t serialBaud = SERIAL_BAUD;
+uint32_t fallbackBaud = SERIAL_BAUD;
+uint32_t baudSwitchTime = 0;
+bool baudUnconfirmed = false;
+
+// JSON records are rendered from these templates into jsonLine, see jsonTemplate.h
+const char JSON_SAMPLE[] PROGMEM = "{\"co\":" JSON_DECI ",\"methane\":" JSON_DECI ",\"airQuality\":" JSON_DECI;  // Field names match SensorData.js
+const char JSON_PM[] PROGMEM = ",\"pm25\":" JSON_DECI ",\"pm10\":" JSON_DECI;
+const char JSON_WARMING[] PROGMEM = ",\"warming\":1,\"stability\":" JSON_UINT;
+const char JSON_HEATER_LOW[] PROGMEM = ",\"heater\":\"low\"";
+const char JSON_HEATER_HIGH[] PROGMEM = ",\"heater\":\"high\"";
+const char JSON_SAMPLE_ID[] PROGMEM = ",\"seq\":" JSON_UINT ",\"time\":" JSON_UINT;  // time = 0 until the clock is set
+const char JSON_LINE_END[] PROGMEM = "}\r\n";
+const char JSON_BATCH_START[] PROGMEM = "{\"batch\":{\"now\":" JSON_UINT ",\"records\":[";
+const char JSON_BATCH_RECORD[] PROGMEM = "[" JSON_UINT "," JSON_UINT "," JSON_DECI "," JSON_DECI "," JSON_DECI "," JSON_UINT "]";
+const char JSON_BATCH_NEXT[] PROGMEM = ",[" JSON_UINT "," JSON_UINT "," JSON_DECI "," JSON_DECI "," JSON_DECI "," JSON_UINT "]";
+const char JSON_BATCH_END[] PROGMEM = "]}}\r\n";
+const char JSON_SUMMARY_START[] PROGMEM = "{\"summary\":{\"now\":" JSON_UINT ",\"windows\":[";
+const char JSON_SUMMARY_WINDOW[] PROGMEM = "{\"seconds\":" JSON_UINT ",\"readings\":" JSON_UINT;
+const char JSON_SUMMARY_CO[] PROGMEM = ",\"co\":[" JSON_DECI "," JSON_DECI "," JSON_DECI "," JSON_DECI "]";
+const char JSON_SUMMARY_CH4[] PROGMEM = ",\"methane\":[" JSON_DECI "," JSON_DECI "," JSON_DECI "," JSON_DECI "]";
+const char JSON_SUMMARY_AQ[] PROGMEM = ",\"airQuality\":[" JSON_DECI "," JSON_DECI "," JSON_DECI "," JSON_DECI "]";
+const char* const JSON_SUMMARY_CHANNELS[] PROGMEM = { JSON_SUMMARY_CO, JSON_SUMMARY_CH4, JSON_SUMMARY_AQ };
+char jsonLine[176];  // Longest sample record is about 160 bytes
+
+// Passes that found the serial RX buffer full, bytes may have been lost
+uint16_t rxFullCount = 0;
+
+// Task names for the "tasks" report
+const char TASK_SAMPLE[] PROGMEM = "sample";
+const char TASK_SENSORS[] PROGMEM = "sensors";
+const char TASK_DISPLAY[] PROGMEM = "display";
+const char TASK_TRANSMIT[] PROGMEM = "transmit";
+const char TASK_RECEIVE[] PROGMEM = "receive";
+const char TASK_STATS[] PROGMEM = "stats";
+const char TASK_REPORT[] PROGMEM = "report";
+const char TASK_SUMMARY[] PROGMEM = "summary";
+const char TASK_LOG[] PROGMEM = "log";
+const char TASK_PM[] PROGMEM = "pm";
+const char TASK_BUS[] PROGMEM = "bus";
+const char TASK_HEATER[] PROGMEM = "heater";
+const char TASK_LOG_WRITE[] PROGMEM = "logWrite";
+const char TASK_CLOCK[] PROGMEM = "clock";
+const char TASK_TX[] PROGMEM = "tx";
+
+// Scheduled work, in the order it runs within a pass. New periodic work is
+// added here rather than to loop().
+Task tasks[] = {
+#if ADC_QUIET_SAMPLING
+  TASK(TASK_SAMPLE, sampleQuiet, ADC_QUIET_INTERVAL, 50),      // Burst with the CPU asleep
+#else
+  TASK(TASK_SAMPLE, pollSampler, 0, 0),                        // Drain the ADC ring every pass
+#endif
+  TASK(TASK_SENSORS, readSensors, sensorReadInterval, 100),
+  TASK(TASK_DISPLAY, updateDisplay, displayUpdateInterval, 500),
+  TASK(TASK_TRANSMIT, sendDataToPC, serialTransmitInterval, 100),
+  TASK(TASK_RECEIVE, receiveFromServer, 0, 0),
+  TASK(TASK_STATS, sendStats, STATS_INTERVAL, 1000),           // Enabled by STATS_INTERVAL or "stats every"
+  TASK(TASK_REPORT, checkReport, REPORT_CHECK_INTERVAL, 100),  // Replaces "transmit" in report-on-change mode
+#if ROLLING_STATS
+  TASK(TASK_SUMMARY, sendSummary, SUMMARY_INTERVAL, 1000),     // Enabled by SUMMARY_INTERVAL
+#endif
+#if SD_LOG
+  TASK(TASK_LOG, streamLog, 0, 0),                             // Enabled by "log read"
+#endif
+#if PM_SENSOR
+  TASK(TASK_PM, pollPm, 0, 0),                                 // Decode frames from the PM sensor
+#endif
+#if BUS_MODE
+  TASK(TASK_BUS, pollBus, 0, 0),                               // Answer gateway polls
+#endif
+#if MQ7_HEATER_CYCLE
+  TASK(TASK_HEATER, updateHeater, HEATER_CHECK_INTERVAL, 50),
+#endif
+#if SD_LOG
+  TASK(TASK_LOG_WRITE, sdLogTask, 0, 0),                       // One card operation per pass
+#endif
+#if RTC_DS3231
+  TASK(TASK_CLOCK, wallClockSync, RTC_SYNC_INTERVAL, 1000),   // Correct the millis() clock from the RTC
+#endif
+  TASK(TASK_TX, pumpTx, 0, 0),                                 // Feed the UART from the TX queue
+};
+
+// Indices into tasks[] of the tasks changed at runtime
+#define SENSORS_TASK 1
+#define DISPLAY_TASK 2
+#define TRANSMIT_TASK 3
+#define STATS_TASK 5
+#define REPORT_TASK 6
+#define SUMMARY_TASK 7
+#define LOG_TASK (SUMMARY_TASK + ROLLING_STATS)  // Follows the summary task when that is built in
 
 void setup() {
-  Serial.begin(9600);
-  
-  if (!display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS)) {
-    Serial.println(F("SSD1306 allocation failed"));
-    for (;;);  // Loop forever if display fails
+  // Before anything else touches the state kept over a reset
+  recoveryBegin();
+  RecoverySnapshot snapshot;
+  bool warm = recoveryResume(snapshot);
+  memoryBegin();
+  strcpy_P(airQualityMessage, PSTR("Calculating..."));
+
+  Serial.begin(SERIAL_BAUD);
+  txQueue.begin();
+
+  // Without the OLED (or its buffer) the board runs headless rather than halting
+  displayPresent = display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS) && oledAnswers();
+  // The display buffer is the last big allocation, paint the free SRAM now
+  profilerBegin();
+  Wire.setClock(I2C_CLOCK);
+#if defined(WIRE_HAS_TIMEOUT)
+  Wire.setWireTimeout(I2C_TIMEOUT_US, true);  // A stuck bus must not hang the loop
+#endif
+  wallClockBegin();
+  if (warm && wallClockSource() == CLOCK_NONE && snapshot.wallTime != 0) {
+    wallClockResume(snapshot.wallTime + (millis() - snapshot.wallMs) / 1000, (ClockSource)snapshot.clockSource);
   }
 
   // Display startup message
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  display.setCursor(0, 0);
-  display.println(F("Air Quality Monitor"));
-  display.println(F("Starting sensors..."));
-  display.println(F("Please wait..."));
-  display.display();
+  if (displayPresent) {
+    display.clearDisplay();
+    display.setTextSize(1);
+    display.setTextColor(SSD1306_WHITE);
+    display.setCursor(0, 0);
+    display.println(F("Air Quality Monitor"));
+    display.println(F("Starting sensors..."));
+    display.display();
+  }
 
-  // Sensor warm-up period
-  delay(30000);
+  // Stored calibration replaces the compile-time R0 and curve A; after a
+  // warm restart the one in use before it, saved or not
+  if (warm) {
+    calibrationApply(snapshot.calibration);
+  } else {
+    CalibrationRecord calibration;
+    if (calibrationLoad(calibration)) calibrationApply(calibration);
+  }
+
+  // Start timer-driven sampling, readings are buffered from here on.
+  // Warm-up runs in the background: readings are sent right away, flagged
+  // as warming until readSensors() sees them settle.
+  adcSamplerBegin(SENSOR_PINS, ADC_SCAN_RATE_HZ);
+#if MQ7_HEATER_CYCLE
+  heater.begin(MQ7_HEATER_PIN, millis());
+#endif
+#if BUS_MODE
+  busBegin(Serial1, BUS_BAUD, BUS_DE_PIN, BUS_NODE_ID);
+#endif
+#if PM_SENSOR
+  pmsBegin();
+#endif
+#if SD_LOG
+  sdLogBegin(SD_CS_PIN, LOG_CHANNELS);
+#endif
+  warmup.begin(millis());
+  if (warm) {
+    // The heaters only lost power for the length of the reset
+    sampleSeq = snapshot.sampleSeq;
+    snapshotSeq = sampleSeq;
+    if (snapshot.flags & RECOVERY_LIVE) warmup.finish();
+  }
+  powerBegin();
 
-  // Initial readings to stabilize
-  for (int i = 0; i < 10; i++) {
-    readSensors();
-    delay(1000);
+  // Static part of the screen, the fields are drawn by updateDisplay()
+  if (displayPresent) {
+    display.clearDisplay();
+    display.setTextSize(1);
+    display.setCursor(0, 0);
+    display.print(F("AQI: "));
+    oled.begin(displayLayout, FIELD_COUNT);
   }
+
+  schedulerBegin(tasks, sizeof(tasks) / sizeof(tasks[0]), millis());
+  schedulerSetEnabled(tasks[STATS_TASK], STATS_INTERVAL > 0, millis());
+#if ROLLING_STATS
+  schedulerSetEnabled(tasks[SUMMARY_TASK], SUMMARY_INTERVAL > 0, millis());
+  if (!warm || snapshot.stateSum != recoveryChecksum(&rolling, sizeof(rolling))) rolling.reset(millis());
+#endif
+  schedulerSetEnabled(tasks[DISPLAY_TASK], displayPresent, millis());
+#if SD_LOG
+  schedulerSetEnabled(tasks[LOG_TASK], false, millis());
+#endif
+
+  // Settings pushed by the server and saved with "config save"
+  DeviceSettings settings;
+  if (settingsLoad(settings)) applySettings(settings);
+  setReportOnChange(reportOnChange);
+
+  printBoot(warm);
+  memoryLock();
+  recoveryStart();
 }
 
 void loop() {
-  unsigned long currentMillis = millis();
-
-  // Read sensor values at specified interval
-  if (currentMillis - previousMillis >= sensorReadInterval) {
-    previousMillis = currentMillis;
-    
-    readSensors();
-    updateDisplay();
-
-    // Send data to PC at specified interval
-    if (currentMillis % serialTransmitInterval < sensorReadInterval) {
-      sendDataToPC();
-    }
-  }
+  // All periodic work is in the task table above
+  schedulerRun(millis());
+  recoveryKick();
+  // The stack has come down to the heap, RAM can no longer be trusted
+  if (!memoryGuardIntact()) recoveryRestart();
+  // A warm restart must never send a sequence number twice
+  if (sampleSeq != snapshotSeq) saveSnapshot();
+  PROFILE_LOOP_MARK();
 
-  // Check if there's data from the server (for AQI feedback)
-  receiveFromServer();
+#if LOW_POWER_IDLE
+  // Sleep until the next interrupt unless bytes or scans arrived during the pass
+  noInterrupts();
+  if (workPending()) {
+    interrupts();
+  } else {
+    powerIdle();
+  }
+#endif
 }
 
-// Function to calculate CO (MQ7)
-float calculateCOppm(int sensorValue) {
-  float voltage = sensorValue * (5.0 / 1023.0);
-  float rs = ((5.0 * 10.0) / voltage) - 10.0;  // 10K load resistor
-  
-  // MQ7 has a different curve than other sensors
-  // Rs/R0 = 1 at 100ppm CO in clean air
-  // Typical curve equation: ppm = a * (Rs/R0)^b
-  // For MQ7, a≈100, b≈-1.5
-  float r0 = 10.0 * MQ7_RATIO_CLEAN_AIR;  // Calculate R0 from ratio in clean air
-  return 100.0 * pow(rs / r0, -1.5);
+// Function to check for input the every-pass tasks have not handled yet
+bool workPending() {
+  if (Serial.available() > 0 || adcSamplerPending() || txQueue.ready()) return true;
+#if BUS_MODE
+  if (busPending()) return true;
+#endif
+#if PM_SENSOR
+  if (pmsPending()) return true;
+#endif
+  return false;
 }
 
-// Function to calculate Methane/CH4 (MQ4)
-float calculateCH4ppm(int sensorValue) {
-  float voltage = sensorValue * (5.0 / 1023.0);
-  float rs = ((5.0 * 10.0) / voltage) - 10.0;  // 10K load resistor
-  
-  // MQ4 is calibrated for methane
-  // Rs/R0 = 1 at around 1000ppm CH4 in clean air
-  // For MQ4, a≈1000, b≈-2.95 (steeper curve)
-  float r0 = 10.0 * MQ4_RATIO_CLEAN_AIR;
-  return 1000.0 * pow(rs / r0, -2.95);
+// Function to take scans from the ADC sampling engine and run them through the filters
+void pollSampler() {
+  AdcScan scan;
+  while (adcSamplerRead(scan)) {
+#define CHANNEL_PUSH(channel, ...) channel.push(scan.raw[channel.sensor]);
+    GAS_CHANNELS(CHANNEL_PUSH)
+  }
 }
 
-// Function to calculate air quality (MQ135)
-float calculateAirQualityppm(int sensorValue) {
-  float voltage = sensorValue * (5.0 / 1023.0);
-  float rs = ((5.0 * 10.0) / voltage) - 10.0;  // 10K load resistor
-  
-  // MQ135 is primarily for CO2 and other gases
-  // Rs/R0 = 1 at 400ppm CO2 in clean air
-  // For MQ135, a≈400, b≈-2.2
-  float r0 = 10.0 * MQ135_RATIO_CLEAN_AIR;
-  return 400.0 * pow(rs / r0, -2.2);
+#if ADC_QUIET_SAMPLING
+// Function to take one quiet burst of scans. Running as its own task keeps
+// it apart from the display flush and the serial writes of other tasks.
+void sampleQuiet() {
+  adcSamplerBurst(ADC_QUIET_SCANS);
+  pollSampler();
 }
+#endif
 
 // Function to read sensors
 void readSensors() {
-  // Read raw analog values
-  mq7Value = analogRead(MQ7_PIN);
-  mq135Value = analogRead(MQ135_PIN);
-  mq4Value = analogRead(MQ4_PIN);
-  
-  // Convert to PPM using sensor-specific calculations
-  co_ppm = calculateCOppm(mq7Value);
-  ch4_ppm = calculateCH4ppm(mq4Value);
-  air_quality_ppm = calculateAirQualityppm(mq135Value);
-  
-  // Apply reasonable limits to prevent extreme values
-  co_ppm = constrain(co_ppm, 0.1, 1000.0);
-  ch4_ppm = constrain(ch4_ppm, 500.0, 10000.0);
-  air_quality_ppm = constrain(air_quality_ppm, 400.0, 5000.0);
+  PROFILE_SCOPE(PROFILE_READ_SENSORS);
+
+  // Latest values from the sampling engine
+  pollSampler();
+  updateReadings();
+
+  // Track warm-up on the filtered counts
+  uint16_t filtered[GAS_SENSOR_COUNT];
+  filteredCounts(filtered);
+  filtered[GAS_MQ7] = coFilterValue();  // A cycling heater swings the live value by design
+  warmup.update(filtered, GAS_SENSOR_COUNT, millis());
+
+  if (calibrationRemaining > 0) collectCalibration();
+#if AQI_ON_DEVICE
+  updateAqi();
+#endif
+#if ROLLING_STATS
+  // Warm-up readings would skew the windows for the next hour
+  if (!(sampleFlags() & SAMPLE_FLAG_WARMING)) {
+    uint16_t values[ROLLING_CHANNELS];
+    wireReadings(values);
+    rolling.add(values, millis());
+  }
+#endif
+#if SD_LOG
+  if (!(sampleFlags() & SAMPLE_FLAG_WARMING)) logReadings();
+#endif
+  saveSnapshot();
+}
+
+// Function to keep the running state for a warm restart after a watchdog reset
+void saveSnapshot() {
+  RecoverySnapshot snapshot;
+  snapshot.wallTime = wallClockNow();
+  snapshot.wallMs = millis();
+  snapshot.clockSource = wallClockSource();
+  snapshot.sampleSeq = sampleSeq;
+  snapshot.flags = warmup.warming() ? 0 : RECOVERY_LIVE;
+  calibrationCapture(snapshot.calibration);
+#if ROLLING_STATS
+  snapshot.stateSum = recoveryChecksum(&rolling, sizeof(rolling));
+#else
+  snapshot.stateSum = 0;
+#endif
+  recoverySave(snapshot);
+  snapshotSeq = sampleSeq;
+}
+
+// Function to check that an OLED acknowledges its address
+bool oledAnswers() {
+  Wire.beginTransmission(SCREEN_ADDRESS);
+  return Wire.endTransmission() == 0;
+}
+
+// Boot report, the reset cause and whether the previous state was resumed:
+// {"boot":{"reset":"watchdog","flags":8,"warm":1,"restarts":1,"task":"receive","display":1}}
+void printBoot(bool warm) {
+  uint8_t flags = recoveryResetFlags();
+  txQueue.print(F("{\"boot\":{\"reset\":\""));
+  switch (recoveryResetCause()) {
+    case RECOVERY_RESET_WATCHDOG:
+      txQueue.print(F("watchdog"));
+      break;
+    case RECOVERY_RESET_GUARD:
+      txQueue.print(F("stack"));
+      break;
+    case RECOVERY_RESET_BROWNOUT:
+      txQueue.print(F("brownout"));
+      break;
+    case RECOVERY_RESET_POWER:
+      txQueue.print(F("power"));
+      break;
+    case RECOVERY_RESET_EXTERNAL:
+      txQueue.print(F("external"));
+      break;
+    default:
+      txQueue.print(F("unknown"));  // The bootloader cleared MCUSR
+      break;
+  }
+  txQueue.print(F("\",\"flags\":"));
+  txQueue.print(flags);
+  txQueue.print(F(",\"warm\":"));
+  txQueue.print(warm ? 1 : 0);
+  txQueue.print(F(",\"restarts\":"));
+  txQueue.print(recoveryRestarts());
+  uint8_t task = recoveryHungTask();
+  if (task < schedulerTaskCount()) {
+    txQueue.print(F(",\"task\":\""));
+    txQueue.print((const __FlashStringHelper*)tasks[task].name);
+    txQueue.print('"');
+  }
+  txQueue.print(F(",\"display\":"));
+  txQueue.print(displayPresent ? 1 : 0);
+  txQueue.println(F("}}"));
+}
+
+#if SD_LOG
+// Function to append the current readings to the SD card log; the "logWrite"
+// task writes full blocks out
+void logReadings() {
+  sdLogSetTime(wallClockNow());
+
+  uint16_t values[LOG_CHANNELS];
+  wireReadings(values);
+#if PM_SENSOR
+  bool fresh = pmFresh();
+  values[GAS_SLOT_COUNT] = fresh ? pm25Channel.wire() : 0;
+  values[GAS_SLOT_COUNT + 1] = fresh ? pm10Channel.wire() : 0;
+#endif
+  sdLogAppend(values);
+}
+#endif
+
+#if AQI_ON_DEVICE
+// Function to update the AQI from the rolling CO and PM2.5 averages. A changed value is
+// drawn in the same pass, the display task comes later in the table.
+void updateAqi() {
+  uint32_t now = millis();
+  if (!(sampleFlags() & SAMPLE_FLAG_WARMING)) {
+    int32_t deci = coChannel.deci();
+    coHistory.add(deci > 0xFFFF ? 0xFFFF : deci, now);
+  }
+  if (hostAqi && now - hostAqiTime < AQI_HOST_HOLD_MS) return;
+  hostAqi = false;
+
+  // The overall index is the highest of the pollutants' indices
+  int value = -1;
+  if (!coHistory.empty()) value = aqiFor(AQI_CO, coHistory.average(aqiAveragingHours(AQI_CO)));
+#if PM_SENSOR
+  if (!pm25History.empty()) {
+    int pm25 = aqiFor(AQI_PM25, pm25History.average(aqiAveragingHours(AQI_PM25)));
+    if (pm25 > value) value = pm25;
+  }
+#endif
+  if (value < 0) return;
+
+  PGM_P category = aqiCategoryName(value);
+  if (value == aqi && strcmp_P(airQualityMessage, category) == 0) return;
+  aqi = value;
+  strcpy_P(airQualityMessage, category);
+  schedulerRunNow(tasks[DISPLAY_TASK], now);
+}
+#endif
+
+// Function to add one tick to a running R0 measurement. With heater cycling
+// the MQ-7 only counts at its latches, see collectCoCalibration().
+void collectCalibration() {
+  uint16_t filtered[GAS_SENSOR_COUNT];
+  filteredCounts(filtered);
+  filtered[GAS_MQ7] = coFilterValue();
+  for (uint8_t i = 0; i < GAS_SENSOR_COUNT; i++) {
+    if (MQ7_HEATER_CYCLE && i == GAS_MQ7) continue;
+    calibrationSum[i] += sensorResistance(filtered[i]);
+  }
+  calibrationRemaining--;
+  finishCalibration();
+}
+
+#if MQ7_HEATER_CYCLE
+// Function to add one MQ-7 latch, one per heater cycle, to a running R0 measurement
+void collectCoCalibration() {
+  calibrationSum[GAS_MQ7] += sensorResistance(coCountsQ4);
+  calibrationCycles--;
+  finishCalibration();
+}
+#endif
+
+// Function to end an R0 measurement once every sensor has its readings:
+// R0 = Rs / (Rs/R0 in clean air) is applied and saved
+void finishCalibration() {
+  if (calibrationRemaining > 0 || calibrationCycles > 0) return;
+
+  for (uint8_t i = 0; i < GAS_SENSOR_COUNT; i++) {
+    GasSensor sensor = (GasSensor)i;
+    uint8_t readings = MQ7_HEATER_CYCLE && i == GAS_MQ7 ? CALIBRATION_CYCLES : CALIBRATION_READINGS;
+    float r0 = calibrationSum[i] / readings / ratioCleanAir(sensor);
+    setCalibration(sensor, r0, calibratedCurveA(sensor));
+  }
+  saveCalibration();
+  printCalibration();
+}
+
+void saveCalibration() {
+  CalibrationRecord record;
+  calibrationCapture(record);
+  calibrationSave(record);
+}
+
+// Function to get the live filtered counts of every sensor, in GasSensor order
+void filteredCounts(uint16_t* out) {
+#define CHANNEL_FILTERED(channel, ...) out[channel.sensor] = channel.filtered();
+  GAS_CHANNELS(CHANNEL_FILTERED)
+}
+
+// Function to get the MQ-7 value the CO reading is based on
+uint16_t coFilterValue() {
+#if MQ7_HEATER_CYCLE
+  return coCountsQ4;
+#else
+  return coChannel.filtered();
+#endif
+}
+
+#if MQ7_HEATER_CYCLE
+// Function to run the MQ-7 heater cycle and latch the CO reading at the end
+// of every low phase. MQ135 and MQ4 keep sampling at full rate throughout.
+void updateHeater() {
+  pollSampler();
+  if (heater.update(millis())) {
+    coCountsQ4 = coChannel.filtered();
+    coValid = true;
+    if (calibrationCycles > 0) collectCoCalibration();
+  }
+}
+#endif
+
+// Function to get the flags sent with a sample. The device only reports
+// live once every channel, CO included, has a valid reading.
+uint8_t sampleFlags() {
+  uint8_t flags = 0;
+  if (warmup.warming() || !coValid) flags |= SAMPLE_FLAG_WARMING;
+#if MQ7_HEATER_CYCLE
+  if (heater.phase() == HEATER_LOW) flags |= SAMPLE_FLAG_HEATER_LOW;
+#endif
+  return flags;
+}
+
+// Function to convert the filtered values to PPM using the sensor-specific tables
+void updateReadings() {
+#define CHANNEL_UPDATE(channel, pin, curve, limits, slot, field, rawField, displayField, label, counts) channel.update(counts);
+  GAS_CHANNELS(CHANNEL_UPDATE)
+}
+
+// Function to get the latest co, ch4 and airQuality readings in wire units
+void wireReadings(uint16_t* values) {
+#define CHANNEL_WIRE(channel, pin, curve, limits, slot, ...) values[slot] = channel.wire();
+  GAS_CHANNELS(CHANNEL_WIRE)
+}
+
+// Function to send the readings as soon as they move, used instead of the
+// fixed transmit interval in report-on-change mode
+void checkReport() {
+  pollSampler();
+  updateReadings();
+
+  uint16_t values[3];
+  wireReadings(values);
+  uint8_t flags = sampleFlags();
+
+  uint32_t now = millis();
+  if (!reporter.due(values, flags, now)) return;
+  sendDataToPC();
+  reporter.reported(values, flags, now);
+}
+
+// Function to switch between interval and report-on-change transmission
+void setReportOnChange(bool enabled) {
+  reportOnChange = enabled;
+  uint32_t now = millis();
+  schedulerSetEnabled(tasks[TRANSMIT_TASK], !enabled, now);
+  schedulerSetEnabled(tasks[REPORT_TASK], enabled, now);
+  reporter.force();
+}
+
+// Function to format a "<label><value> ppm" display line
+void formatPpmLine(char* out, PGM_P label, ppm_t ppm) {
+  strcpy_P(out, label);
+  char* end = formatPpm(out + strlen(out), ppm);
+  strcpy_P(end, PSTR(" ppm"));
+}
+
+// Function to decide whether the OLED should be lit now
+bool displayLit(uint32_t now) {
+  if (displayPower != DISPLAY_AUTO) return displayPower == DISPLAY_ON;
+  return DISPLAY_CYCLE_MS == 0 || now % DISPLAY_CYCLE_MS < DISPLAY_ON_MS;
 }
 
 void updateDisplay() {
-  display.clearDisplay();
-  
-  display.setTextSize(1);
-  display.setCursor(0, 0);
-  display.print(F("AQI: "));
-  display.setTextSize(2);
-  display.setCursor(0, 10);
-  display.print(aqi);
-  
-  display.setTextSize(1);
-  display.setCursor(0, 28);
-  display.println(airQualityMessage);
-
-  display.setCursor(0, 38);
-  display.print(F("CO: "));
-  display.print(co_ppm, 1);
-  display.println(F(" ppm"));
-
-  display.setCursor(0, 48);
-  display.print(F("CH4: "));
-  display.print(ch4_ppm, 1);
-  display.println(F(" ppm"));
-
-  display.setCursor(0, 58);
-  display.print(F("AQ: "));
-  display.print(air_quality_ppm, 1);
-  display.println(F(" ppm"));
-
-  display.display();
+  PROFILE_SCOPE(PROFILE_UPDATE_DISPLAY);
+  char text[OLED_FIELD_TEXT_SIZE];
+
+  // Fields are still updated while blanked, waking sends what changed
+  oled.setPower(displayLit(millis()));
+
+  itoa(aqi, text, 10);
+  oled.setField(FIELD_AQI, text);
+  if (warmup.warming()) {
+    strcpy_P(text, PSTR("Warming up "));
+    itoa(warmup.stability(), text + strlen(text), 10);
+    strcat_P(text, PSTR("%"));
+    oled.setField(FIELD_STATUS, text);
+  } else {
+    oled.setField(FIELD_STATUS, airQualityMessage);
+  }
+
+#define CHANNEL_LINE(channel, pin, curve, limits, slot, field, rawField, displayField, label, counts) \
+  formatPpmLine(text, PSTR(label), channel.ppm());                                                \
+  oled.setField(displayField, text);
+  GAS_CHANNELS(CHANNEL_LINE)
+
+  // Push only the pages and columns that changed
+  oled.flush();
 }
 
 // Function to send data to PC/server
 void sendDataToPC() {
+  PROFILE_SCOPE(PROFILE_SEND_DATA);
+
+#if BUS_MODE
+  // The gateway collects buffered records with its polls
+  appendBatchRecord();
+  return;
+#endif
+
+  if (batchSize > 0) {
+    queueBatchRecord();
+    return;
+  }
+
+  if (protocolMode == PROTOCOL_BINARY) {
+    sendBinaryFrame();
+    return;
+  }
+
   // Send all sensor readings in JSON format
-  Serial.print(F("{\"co\":"));
-  Serial.print(co_ppm, 1);
-  Serial.print(F(",\"methane\":"));  // Match the field name in SensorData.js
-  Serial.print(ch4_ppm, 1);
-  Serial.print(F(",\"airQuality\":"));  // Match the field name in SensorData.js
-  Serial.print(air_quality_ppm, 1);
-  
-  // Include estimation for PM2.5 and PM10 based on MQ135 readings if possible
-  // These are very rough estimations and should be replaced with actual PM sensor data
-  float estimated_pm25 = air_quality_ppm * 0.3;  // Very rough estimate
-  float estimated_pm10 = air_quality_ppm * 0.5;  // Very rough estimate
-  
-  Serial.print(F(",\"pm25\":"));
-  Serial.print(estimated_pm25, 1);
-  Serial.print(F(",\"pm10\":"));
-  Serial.print(estimated_pm10, 1);
-  
-  // You can add additional sensor data here as needed
-  
-  Serial.println(F("}"));
+  int32_t values[GAS_SLOT_COUNT];
+#define CHANNEL_DECI(channel, pin, curve, limits, slot, ...) values[slot] = channel.deci();
+  GAS_CHANNELS(CHANNEL_DECI)
+
+  const char* end = jsonLine + sizeof(jsonLine);
+  char* p = renderJson(jsonLine, end, JSON_SAMPLE, values);
+#if PM_SENSOR
+  // Only measured particulate values are sent, never stale ones
+  if (pmFresh()) {
+    int32_t pm[2] = { pm25Channel.deci(), pm10Channel.deci() };
+    p = renderJson(p, end, JSON_PM, pm);
+  }
+#endif
+  uint8_t flags = sampleFlags();
+  if (flags & SAMPLE_FLAG_WARMING) {
+    int32_t stability = warmup.stability();
+    p = renderJson(p, end, JSON_WARMING, &stability);
+  }
+#if MQ7_HEATER_CYCLE
+  p = renderJson(p, end, flags & SAMPLE_FLAG_HEATER_LOW ? JSON_HEATER_LOW : JSON_HEATER_HIGH, NULL);
+#endif
+  // Additional sensor fields get their own template here
+  int32_t id[2] = { sampleSeq, (int32_t)wallClockNow() };
+  p = renderJson(p, end, JSON_SAMPLE_ID, id);
+  p = renderJson(p, end, JSON_LINE_END, NULL);
+
+  txQueue.write((const uint8_t*)jsonLine, p - jsonLine);
+  sampleSeq++;
+}
+
+// Function to send the latest readings as one binary sample frame
+void sendBinaryFrame() {
+  SampleRecord sample;
+  sample.seq = sampleSeq++;
+#define CHANNEL_SAMPLE(channel, pin, curve, limits, slot, field, rawField, ...) \
+  sample.rawField = channel.lastRaw();                                      \
+  sample.field = channel.wire();
+  GAS_CHANNELS(CHANNEL_SAMPLE)
+  sample.flags = sampleFlags();
+  sample.stability = warmup.stability();
+  sample.time = wallClockNow();
+
+  uint8_t frame[SAMPLE_FRAME_SIZE];
+  uint8_t len = encodeSamplePayload(frame + FRAME_HEADER_SIZE, sample);
+  txQueue.write(frame, encodeFrame(frame, FRAME_TYPE_SAMPLE, frame + FRAME_HEADER_SIZE, len));
+}
+
+// Function to store the latest readings for the next burst
+void queueBatchRecord() {
+  appendBatchRecord();
+  if (++pendingRecords >= burstSize()) {
+    flushBatch();
+  }
+}
+
+// Function to get the records one burst carries: batchSize, but JSON lines
+// and plain frames hold at most BATCH_MAX_RECORDS
+uint8_t burstSize() {
+  bool delta = protocolMode == PROTOCOL_BINARY && batchEncoding == BATCH_ENCODING_DELTA;
+  if (!delta && batchSize > BATCH_MAX_RECORDS) return BATCH_MAX_RECORDS;
+  return batchSize;
+}
+
+// Function to add the latest readings to the batch buffer
+void appendBatchRecord() {
+  BatchRecord record;
+  record.seq = sampleSeq++;
+  record.timeMs = millis();
+#define CHANNEL_RECORD(channel, pin, curve, limits, slot, field, ...) record.field = channel.wire();
+  GAS_CHANNELS(CHANNEL_RECORD)
+  record.flags = sampleFlags();
+  batch.append(record);
+}
+
+// Function to encode the oldest buffered records in the current batch encoding.
+// Returns the payload size and sets *type to the matching frame type.
+uint8_t encodeBufferedRecords(uint8_t* payload, uint8_t capacity, uint8_t* type) {
+  uint8_t count = batch.count();
+  if (batchEncoding == BATCH_ENCODING_DELTA) {
+    *type = FRAME_TYPE_BATCH_DELTA;
+    return encodeDeltaBatchPayload(payload, capacity, millis(), batch, 0, &count);
+  }
+
+  uint8_t fits = (capacity - BATCH_HEADER_SIZE) / BATCH_RECORD_SIZE;
+  if (count > fits) count = fits;
+  *type = FRAME_TYPE_BATCH;
+  return encodeBatchPayload(payload, millis(), batch, 0, count);
+}
+
+// Function to send the oldest unacknowledged records as one burst.
+// The server answers "ack <seq>", which releases them and, if a backlog
+// remains, triggers the next burst.
+void flushBatch() {
+  pendingRecords = 0;
+  uint8_t count = batch.count();
+  if (count == 0) return;
+
+  if (protocolMode == PROTOCOL_BINARY) {
+    uint8_t type;
+    uint8_t* payload = txFrame + FRAME_HEADER_SIZE;
+    uint8_t len = encodeBufferedRecords(payload, FRAME_MAX_PAYLOAD, &type);
+    txQueue.write(txFrame, encodeFrame(txFrame, type, payload, len));
+    return;
+  }
+
+  uint32_t now = millis();
+  if (count > BATCH_MAX_RECORDS) count = BATCH_MAX_RECORDS;
+
+  // JSON: {"batch":{"now":ms,"records":[[seq,timeMs,co,methane,airQuality,flags],...]}}
+  // rendered one record at a time into the line buffer
+  const char* end = jsonLine + sizeof(jsonLine);
+  int32_t header = now;
+  txQueue.write((const uint8_t*)jsonLine, renderJson(jsonLine, end, JSON_BATCH_START, &header) - jsonLine);
+  for (uint8_t i = 0; i < count; i++) {
+    const BatchRecord& record = batch.at(i);
+    int32_t values[3 + GAS_SLOT_COUNT];
+    values[0] = record.seq;
+    values[1] = record.timeMs;
+#define CHANNEL_BATCH(channel, pin, curve, limits, slot, field, ...) values[2 + slot] = (int32_t)record.field * 10 / limits::wireScale;
+    GAS_CHANNELS(CHANNEL_BATCH)
+    values[2 + GAS_SLOT_COUNT] = record.flags;
+    char* p = renderJson(jsonLine, end, i > 0 ? JSON_BATCH_NEXT : JSON_BATCH_RECORD, values);
+    txQueue.write((const uint8_t*)jsonLine, p - jsonLine);
+  }
+  txQueue.write((const uint8_t*)jsonLine, renderJson(jsonLine, end, JSON_BATCH_END, NULL) - jsonLine);
+}
+
+#if PM_SENSOR
+// Function to take a frame from the PM sensor. In binary mode every frame is
+// forwarded as it arrives; JSON samples carry the latest values instead.
+void pollPm() {
+  PmsReading reading;
+  if (!pmsRead(reading)) return;
+
+  uint32_t now = millis();
+  pm25Channel.setUnits(reading.pm25);
+  pm10Channel.setUnits(reading.pm10);
+  pmTime = now;
+  pmValid = true;
+#if AQI_ON_DEVICE
+  pm25History.add(pm25Channel.deci(), now);
+#endif
+
+#if !BUS_MODE
+  if (protocolMode == PROTOCOL_BINARY) {
+    uint8_t frame[PM_PAYLOAD_SIZE + FRAME_OVERHEAD];
+    uint8_t len = pmsEncodePayload(frame + FRAME_HEADER_SIZE, reading);
+    txQueue.write(frame, encodeFrame(frame, FRAME_TYPE_PM, frame + FRAME_HEADER_SIZE, len));
+  }
+#endif
+}
+
+// Function to check that the PM values come from a sensor that is still sending
+bool pmFresh() {
+  return pmValid && millis() - pmTime < PM_STALE_MS;
+}
+#endif
+
+#if BUS_MODE
+// Function to answer a gateway poll with the oldest unacknowledged records.
+// The poll acknowledges what the gateway stored from the previous reply and
+// now and then carries the time, the node's only way to get one.
+void pollBus() {
+  BusPoll poll;
+  if (!busReceive(poll)) return;
+  if (poll.flags & BUS_POLL_ACK) batch.acknowledge(poll.ackSeq);
+  if ((poll.flags & BUS_POLL_TIME) && poll.time > 0) wallClockSet(poll.time);
+
+  uint8_t* payload = txFrame + FRAME_HEADER_SIZE;
+  payload[0] = busNodeId();
+  uint8_t len = BUS_NODE_HEADER_SIZE + encodeBufferedRecords(payload + BUS_NODE_HEADER_SIZE,
+                                                             FRAME_MAX_PAYLOAD - BUS_NODE_HEADER_SIZE, &payload[1]);
+  busSend(txFrame, encodeFrame(txFrame, FRAME_TYPE_NODE, payload, len));
+}
+#endif
+
+// Reply helpers, replies are always JSON lines so they stay readable in both protocol modes
+void sendAck(const __FlashStringHelper* command) {
+  txQueue.print(F("{\"ack\":\""));
+  txQueue.print(command);
+  txQueue.println(F("\"}"));
+}
+
+void sendError(const __FlashStringHelper* message) {
+  txQueue.print(F("{\"error\":\""));
+  txQueue.print(message);
+  txQueue.println(F("\"}"));
+}
+
+// AQI feedback from the server
+// Format expected: {"aqi":120,"status":"Unhealthy for Sensitive Groups"}
+void handleServerJson(const char* json) {
+  long value;
+  if (readJsonInt(json, PSTR("aqi"), &value)) {
+    aqi = value;
+    hostAqi = true;
+    hostAqiTime = millis();
+  }
+  readJsonString(json, PSTR("status"), airQualityMessage, sizeof(airQualityMessage));
+}
+
+// "ping": link check
+void commandPing(char* args) {
+  sendAck(F("ping"));
+}
+
+// "time [<unix>]": set the clock used for sample timestamps, or show it
+void commandTime(char* args) {
+  char* value = nextToken(&args);
+  if (value != NULL) {
+    uint32_t unixTime = strtoul(value, NULL, 10);
+    if (unixTime == 0) {
+      sendError(F("usage: time [<unix seconds>]"));
+      return;
+    }
+    wallClockSet(unixTime);
+  }
+  txQueue.print(F("{\"ack\":\"time\",\"time\":"));
+  txQueue.print(wallClockNow());
+  txQueue.print(F(",\"source\":\""));
+  ClockSource source = wallClockSource();
+  txQueue.print(source == CLOCK_RTC ? F("rtc") : source == CLOCK_HOST ? F("host") : F("none"));
+  txQueue.println(F("\"}"));
+}
+
+// "mode json|bin": select the sample protocol
+void commandMode(char* args) {
+  char* value = nextToken(&args);
+  if (value != NULL && strcasecmp_P(value, PSTR("json")) == 0) {
+    protocolMode = PROTOCOL_JSON;
+  } else if (value != NULL && strcasecmp_P(value, PSTR("bin")) == 0) {
+    protocolMode = PROTOCOL_BINARY;
+  } else {
+    sendError(F("usage: mode json|bin"));
+    return;
+  }
+  sendAck(F("mode"));
+}
+
+// "report on|off": report-on-change instead of a fixed transmit interval
+void commandReport(char* args) {
+  char* value = nextToken(&args);
+  if (value != NULL && strcasecmp_P(value, PSTR("on")) == 0) {
+    setReportOnChange(true);
+  } else if (value != NULL && strcasecmp_P(value, PSTR("off")) == 0) {
+    setReportOnChange(false);
+  } else {
+    sendError(F("usage: report on|off"));
+    return;
+  }
+  sendAck(F("report"));
+}
+
+const char SENSOR_MQ7[] PROGMEM = "mq7";
+const char SENSOR_MQ135[] PROGMEM = "mq135";
+const char SENSOR_MQ4[] PROGMEM = "mq4";
+
+// Names in GasSensor order
+const char* const sensorNames[GAS_SENSOR_COUNT] PROGMEM = { SENSOR_MQ7, SENSOR_MQ135, SENSOR_MQ4 };
+
+// Function to report the calibration in use as one JSON line
+void printCalibration() {
+  txQueue.print(F("{\"ack\":\"cal\",\"measuring\":"));
+  txQueue.print(calibrationRemaining);
+#if MQ7_HEATER_CYCLE
+  txQueue.print(F(",\"cycles\":"));
+  txQueue.print(calibrationCycles);
+#endif
+  txQueue.print(F(",\"sensors\":["));
+  for (uint8_t i = 0; i < GAS_SENSOR_COUNT; i++) {
+    GasSensor sensor = (GasSensor)i;
+    if (i > 0) txQueue.print(',');
+    txQueue.print(F("{\"name\":\""));
+    txQueue.print((const __FlashStringHelper*)pgm_read_ptr(&sensorNames[i]));
+    txQueue.print(F("\",\"r0\":"));
+    txQueue.print(calibratedR0(sensor), 2);
+    txQueue.print(F(",\"a\":"));
+    txQueue.print(calibratedCurveA(sensor), 1);
+    txQueue.print(F(",\"b\":"));
+    txQueue.print(curveB(sensor), 2);
+    txQueue.print('}');
+  }
+  txQueue.println(F("]}"));
+}
+
+// Function to look up a sensor by name, GAS_SENSOR_COUNT if unknown
+uint8_t findSensor(const char* name) {
+  uint8_t i = 0;
+  while (i < GAS_SENSOR_COUNT && strcasecmp_P(name, (PGM_P)pgm_read_ptr(&sensorNames[i])) != 0) i++;
+  return i;
+}
+
+// "cal": calibration in use. "cal start" measures R0 in clean air,
+// "cal r0|a <sensor> <value>" sets R0 (kOhm) or curve A by hand and
+// "cal reset" restores the compiled defaults. Changes are saved to EEPROM.
+void commandCal(char* args) {
+  char* option = nextToken(&args);
+  if (option == NULL) {
+    printCalibration();
+    return;
+  }
+
+  if (strcasecmp_P(option, PSTR("start")) == 0) {
+    if (warmup.warming()) {
+      sendError(F("sensors warming up"));
+      return;
+    }
+    for (uint8_t i = 0; i < GAS_SENSOR_COUNT; i++) {
+      calibrationSum[i] = 0;
+    }
+    calibrationRemaining = CALIBRATION_READINGS;
+    calibrationCycles = MQ7_HEATER_CYCLE ? CALIBRATION_CYCLES : 0;
+    sendAck(F("cal"));
+    return;
+  }
+
+  if (strcasecmp_P(option, PSTR("reset")) == 0) {
+    for (uint8_t i = 0; i < GAS_SENSOR_COUNT; i++) {
+      GasSensor sensor = (GasSensor)i;
+      setCalibration(sensor, defaultR0(sensor), defaultCurveA(sensor));
+    }
+    saveCalibration();
+    printCalibration();
+    return;
+  }
+
+  bool setR0 = strcasecmp_P(option, PSTR("r0")) == 0;
+  bool setA = strcasecmp_P(option, PSTR("a")) == 0;
+  char* name = nextToken(&args);
+  char* value = nextToken(&args);
+  uint8_t sensor = name != NULL ? findSensor(name) : (uint8_t)GAS_SENSOR_COUNT;
+  float number = value != NULL ? atof(value) : 0;
+  if (!(setR0 || setA) || sensor >= GAS_SENSOR_COUNT || !(number > 0)) {
+    sendError(F("usage: cal [start|reset|r0 <sensor> <kohm>|a <sensor> <value>]"));
+    return;
+  }
+  GasSensor gas = (GasSensor)sensor;
+  setCalibration(gas, setR0 ? number : calibratedR0(gas), setA ? number : calibratedCurveA(gas));
+  saveCalibration();
+  printCalibration();
+}
+
+// "display on|off|auto": keep the OLED lit or blanked, or follow the schedule
+void commandDisplay(char* args) {
+  char* value = nextToken(&args);
+  if (value != NULL && strcasecmp_P(value, PSTR("on")) == 0) {
+    displayPower = DISPLAY_ON;
+  } else if (value != NULL && strcasecmp_P(value, PSTR("off")) == 0) {
+    displayPower = DISPLAY_OFF;
+  } else if (value != NULL && strcasecmp_P(value, PSTR("auto")) == 0) {
+    displayPower = DISPLAY_AUTO;
+  } else {
+    sendError(F("usage: display on|off|auto"));
+    return;
+  }
+  if (displayPresent) oled.setPower(displayLit(millis()));
+  sendAck(F("display"));
+}
+
+// Function to fill in the compiled defaults of every runtime setting
+void defaultSettings(DeviceSettings& settings) {
+  settings.samplePeriod = sensorReadInterval;
+  settings.transmitPeriod = serialTransmitInterval;
+  settings.displayPeriod = displayUpdateInterval;
+  settings.deadbands[0] = REPORT_DEADBAND_CO;
+  settings.deadbands[1] = REPORT_DEADBAND_CH4;
+  settings.deadbands[2] = REPORT_DEADBAND_AQ;
+  settings.heartbeatMs = REPORT_HEARTBEAT_MS;
+  settings.batchSize = DEFAULT_BATCH_SIZE;
+  settings.batchEncoding = DEFAULT_BATCH_ENCODING;
+  settings.protocol = DEFAULT_PROTOCOL;
+  settings.reportOnChange = DEFAULT_REPORT_ON_CHANGE;
+  settings.displayPower = DISPLAY_AUTO;
+}
+
+// Function to record the settings in use
+void captureSettings(DeviceSettings& settings) {
+  settings.samplePeriod = tasks[SENSORS_TASK].period;
+  settings.transmitPeriod = tasks[TRANSMIT_TASK].period;
+  settings.displayPeriod = tasks[DISPLAY_TASK].period;
+  for (uint8_t i = 0; i < 3; i++) {
+    settings.deadbands[i] = reportDeadbands[i];
+  }
+  settings.heartbeatMs = reporter.heartbeat();
+  settings.batchSize = batchSize;
+  settings.batchEncoding = batchEncoding;
+  settings.protocol = protocolMode;
+  settings.reportOnChange = reportOnChange;
+  settings.displayPower = displayPower;
+}
+
+bool validPeriod(uint32_t period) {
+  return period >= CONFIG_MIN_PERIOD && period <= CONFIG_MAX_PERIOD;
+}
+
+// Function to change a task period, an unchanged period keeps its schedule
+void setTaskPeriod(Task& task, uint32_t period) {
+  if (validPeriod(period) && period != task.period) schedulerSetPeriod(task, period, millis());
+}
+
+// Function to take over a set of settings; values out of range keep the
+// current setting. The caller applies reportOnChange.
+void applySettings(const DeviceSettings& settings) {
+  setTaskPeriod(tasks[SENSORS_TASK], settings.samplePeriod);
+  setTaskPeriod(tasks[TRANSMIT_TASK], settings.transmitPeriod);
+  setTaskPeriod(tasks[DISPLAY_TASK], settings.displayPeriod);
+  for (uint8_t i = 0; i < 3; i++) {
+    reportDeadbands[i] = settings.deadbands[i];
+  }
+  if (validPeriod(settings.heartbeatMs)) reporter.setHeartbeat(settings.heartbeatMs);
+  if (settings.batchSize <= BATCH_CAPACITY) batchSize = settings.batchSize;
+  if (settings.batchEncoding <= BATCH_ENCODING_DELTA) batchEncoding = settings.batchEncoding;
+  if (settings.protocol <= PROTOCOL_BINARY) protocolMode = settings.protocol;
+  reportOnChange = settings.reportOnChange != 0;
+  if (settings.displayPower <= DISPLAY_OFF) displayPower = settings.displayPower;
+}
+
+// Function to report the settings in use as one JSON line
+void printConfig() {
+  DeviceSettings settings;
+  captureSettings(settings);
+  txQueue.print(F("{\"ack\":\"config\",\"sample\":"));
+  txQueue.print(settings.samplePeriod);
+  txQueue.print(F(",\"transmit\":"));
+  txQueue.print(settings.transmitPeriod);
+  txQueue.print(F(",\"display\":"));
+  txQueue.print(settings.displayPeriod);
+  txQueue.print(F(",\"heartbeat\":"));
+  txQueue.print(settings.heartbeatMs);
+  txQueue.print(F(",\"deadbands\":["));
+  for (uint8_t i = 0; i < 3; i++) {
+    if (i > 0) txQueue.print(',');
+    txQueue.print(settings.deadbands[i]);
+  }
+  txQueue.print(F("],\"batchSize\":"));
+  txQueue.print(settings.batchSize);
+  txQueue.print(F(",\"encoding\":\""));
+  txQueue.print(settings.batchEncoding == BATCH_ENCODING_DELTA ? F("delta") : F("plain"));
+  txQueue.print(F("\",\"protocol\":\""));
+  txQueue.print(settings.protocol == PROTOCOL_BINARY ? F("bin") : F("json"));
+  txQueue.print(F("\",\"report\":"));
+  txQueue.print(settings.reportOnChange);
+  txQueue.print(F(",\"oled\":"));
+  txQueue.print(settings.displayPower);
+  txQueue.println(F("}"));
+}
+
+const char CHANNEL_CO[] PROGMEM = "co";
+const char CHANNEL_CH4[] PROGMEM = "ch4";
+const char CHANNEL_AQ[] PROGMEM = "aq";
+
+// Wire channels in reportDeadbands order
+const char* const channelNames[3] PROGMEM = { CHANNEL_CO, CHANNEL_CH4, CHANNEL_AQ };
+
+// "config": settings in use. "config sample|transmit|display|heartbeat <ms>"
+// and "config deadband co|ch4|aq <units>" change them at runtime, the modes
+// are set with "mode", "batch", "report" and "display". "config save" stores
+// all of them in EEPROM, "config reset" goes back to the compiled defaults.
+void commandConfig(char* args) {
+  char* key = nextToken(&args);
+  if (key == NULL) {
+    printConfig();
+    return;
+  }
+
+  DeviceSettings settings;
+  if (strcasecmp_P(key, PSTR("save")) == 0) {
+    captureSettings(settings);
+    settingsSave(settings);
+    sendAck(F("config"));
+    return;
+  }
+  if (strcasecmp_P(key, PSTR("reset")) == 0) {
+    settingsClear();
+    defaultSettings(settings);
+    applySettings(settings);
+    setReportOnChange(reportOnChange);
+    printConfig();
+    return;
+  }
+
+  captureSettings(settings);
+  if (strcasecmp_P(key, PSTR("deadband")) == 0) {
+    char* name = nextToken(&args);
+    char* value = nextToken(&args);
+    uint8_t channel = 0;
+    while (name != NULL && channel < 3 && strcasecmp_P(name, (PGM_P)pgm_read_ptr(&channelNames[channel])) != 0) {
+      channel++;
+    }
+    long units = value != NULL ? strtol(value, NULL, 10) : -1;
+    if (name == NULL || channel >= 3 || units < 0 || units > 65535) {
+      sendError(F("usage: config deadband co|ch4|aq <units>"));
+      return;
+    }
+    settings.deadbands[channel] = units;
+  } else {
+    char* value = nextToken(&args);
+    uint32_t period = value != NULL ? strtoul(value, NULL, 10) : 0;
+    uint32_t* target = NULL;
+    if (strcasecmp_P(key, PSTR("sample")) == 0) target = &settings.samplePeriod;
+    else if (strcasecmp_P(key, PSTR("transmit")) == 0) target = &settings.transmitPeriod;
+    else if (strcasecmp_P(key, PSTR("display")) == 0) target = &settings.displayPeriod;
+    else if (strcasecmp_P(key, PSTR("heartbeat")) == 0) target = &settings.heartbeatMs;
+    if (target == NULL || !validPeriod(period)) {
+      sendError(F("usage: config [save|reset|sample|transmit|display|heartbeat <ms>|deadband <ch> <units>]"));
+      return;
+    }
+    *target = period;
+  }
+  applySettings(settings);
+  sendAck(F("config"));
+}
+
+// "send": transmit the latest readings now
+void commandSend(char* args) {
+  sendDataToPC();
+}
+
+// "info": protocol state and uptime
+void commandInfo(char* args) {
+  txQueue.print(F("{\"ack\":\"info\",\"protocol\":\""));
+  txQueue.print(protocolMode == PROTOCOL_BINARY ? F("bin") : F("json"));
+  txQueue.print(F("\",\"baud\":"));
+  txQueue.print(serialBaud);
+  txQueue.print(F(",\"seq\":"));
+  txQueue.print(sampleSeq);
+  txQueue.print(F(",\"uptime\":"));
+  txQueue.print(millis());
+  txQueue.print(F(",\"time\":"));
+  txQueue.print(wallClockNow());
+  txQueue.print(F(",\"rxOverflows\":"));
+  txQueue.print(commandParser.overflowCount());
+  txQueue.print(F(",\"warming\":"));
+  txQueue.print(sampleFlags() & SAMPLE_FLAG_WARMING ? 1 : 0);
+  txQueue.print(F(",\"report\":"));
+  txQueue.print(reportOnChange ? 1 : 0);
+  txQueue.print(F(",\"aqi\":"));
+  txQueue.print(aqi);
+  txQueue.print(F(",\"aqiSource\":\""));
+  txQueue.print(hostAqi ? F("server") : F("device"));
+  txQueue.print('"');
+  txQueue.print(F(",\"display\":"));
+  txQueue.print(displayPresent && oled.powered() ? 1 : 0);
+  txQueue.print(F(",\"reset\":"));
+  txQueue.print(recoveryResetFlags());
+  txQueue.print(F(",\"restarts\":"));
+  txQueue.print(recoveryRestarts());
+  txQueue.print(F(",\"heap\":"));
+  txQueue.print(memoryHeapUsed());
+  txQueue.print(F(",\"batchSize\":"));
+  txQueue.print(batchSize);
+  txQueue.print(F(",\"buffered\":"));
+  txQueue.print(batch.count());
+  txQueue.print(F(",\"dropped\":"));
+  txQueue.print(batch.droppedCount());
+#if ADC_QUIET_SAMPLING
+  txQueue.print(F(",\"quietConversions\":"));
+  txQueue.print(adcSamplerQuietConversions());
+  txQueue.print(F(",\"idleConversions\":"));
+  txQueue.print(adcSamplerIdleConversions());
+#endif
+#if PM_SENSOR
+  txQueue.print(F(",\"pmFresh\":"));
+  txQueue.print(pmFresh() ? 1 : 0);
+  txQueue.print(F(",\"pmChecksumErrors\":"));
+  txQueue.print(pmsChecksumErrors());
+  txQueue.print(F(",\"pmLineErrors\":"));
+  txQueue.print(pmsLineErrors());
+  txQueue.print(F(",\"pmDropped\":"));
+  txQueue.print(pmsDroppedFrames());
+#endif
+#if MQ7_HEATER_CYCLE
+  txQueue.print(F(",\"heaterCycles\":"));
+  txQueue.print(heater.cycles());
+#endif
+#if BUS_MODE
+  txQueue.print(F(",\"node\":"));
+  txQueue.print(busNodeId());
+  txQueue.print(F(",\"busCrcErrors\":"));
+  txQueue.print(busCrcErrors());
+#endif
+  txQueue.println(F("}"));
+}
+
+// "tasks": scheduler timing report, one JSON line per task so the reply
+// stays short however many tasks are built in; "tasks reset" clears it
+void commandTasks(char* args) {
+  char* option = nextToken(&args);
+  if (option != NULL && strcasecmp_P(option, PSTR("reset")) == 0) {
+    schedulerResetStats();
+    sendAck(F("tasks"));
+    return;
+  }
+
+  Task* table = schedulerTasks();
+  uint8_t count = schedulerTaskCount();
+  for (uint8_t i = 0; i < count; i++) {
+    txQueue.print(F("{\"ack\":\"tasks\",\"index\":"));
+    txQueue.print(i);
+    txQueue.print(F(",\"count\":"));
+    txQueue.print(count);
+    txQueue.print(F(",\"name\":\""));
+    txQueue.print((const __FlashStringHelper*)table[i].name);
+    txQueue.print(F("\",\"period\":"));
+    txQueue.print(table[i].period);
+    txQueue.print(F(",\"runs\":"));
+    txQueue.print(table[i].runs);
+    txQueue.print(F(",\"overruns\":"));
+    txQueue.print(table[i].overruns);
+    txQueue.print(F(",\"maxLateMs\":"));
+    txQueue.print(table[i].maxLateness);
+    txQueue.print(F(",\"maxUs\":"));
+    txQueue.print(table[i].maxDuration);
+    txQueue.println('}');
+  }
+}
+
+// Profiling report as one JSON line, cycle counts are CPU clocks
+void printStatsJson() {
+  txQueue.print(F("{\"ack\":\"stats\",\"cpuHz\":"));
+  txQueue.print(F_CPU);
+  txQueue.print(F(",\"sections\":["));
+  for (uint8_t i = 0; i < PROFILE_SECTION_COUNT; i++) {
+    const ProfileStats& stats = profilerStats((ProfileSection)i);
+    if (i > 0) txQueue.print(',');
+    txQueue.print(F("{\"name\":\""));
+    txQueue.print((const __FlashStringHelper*)profilerSectionName((ProfileSection)i));
+    txQueue.print(F("\",\"count\":"));
+    txQueue.print(stats.count);
+    txQueue.print(F(",\"min\":"));
+    txQueue.print(stats.minCycles);
+    txQueue.print(F(",\"max\":"));
+    txQueue.print(stats.maxCycles);
+    txQueue.print(F(",\"mean\":"));
+    txQueue.print(stats.count > 0 ? (uint32_t)(stats.totalCycles / stats.count) : 0);
+    txQueue.print('}');
+  }
+  txQueue.print(F("],\"loopUs\":["));
+  for (uint8_t i = 0; i < PROFILE_LOOP_BUCKETS; i++) {
+    if (i > 0) txQueue.print(',');
+    txQueue.print(profilerLoopBucket(i));
+  }
+  txQueue.print(F("],\"rxOverflows\":"));
+  txQueue.print(commandParser.overflowCount());
+  txQueue.print(F(",\"rxFull\":"));
+  txQueue.print(rxFullCount);
+  txQueue.print(F(",\"adcOverruns\":"));
+  txQueue.print(adcSamplerOverruns());
+  txQueue.print(F(",\"freeRam\":"));
+  txQueue.print(profilerFreeRam());
+  txQueue.print(F(",\"minFreeRam\":"));
+  txQueue.print(profilerMinFreeRam());
+  txQueue.print(F(",\"idlePct\":"));
+  txQueue.print(powerIdlePercent());
+  txQueue.print(F(",\"txHighWater\":"));
+  txQueue.print(txQueue.highWater());
+  txQueue.print(F(",\"txStalls\":"));
+  txQueue.print(txQueue.stalls());
+  txQueue.println(F("}"));
+}
+
+// Function to send the profiling report in the current protocol
+void sendStats() {
+  if (protocolMode == PROTOCOL_BINARY) {
+    uint8_t len = profilerEncodeStats(txFrame + FRAME_HEADER_SIZE, commandParser.overflowCount(),
+                                      rxFullCount, adcSamplerOverruns());
+    uint8_t size = encodeFrame(txFrame, FRAME_TYPE_STATS, txFrame + FRAME_HEADER_SIZE, len);
+    txQueue.write(txFrame, size);
+    return;
+  }
+  printStatsJson();
+}
+
+#if ROLLING_STATS
+// Rolling statistics as one JSON line, values in ppm with one decimal:
+// {"summary":{"now":ms,"windows":[{"seconds":60,"readings":n,"co":[min,max,mean,stddev],...},...]}}
+void printSummaryJson(uint32_t now) {
+  static const uint8_t wireScales[ROLLING_CHANNELS] = { WIRE_SCALE_CO, WIRE_SCALE_CH4, WIRE_SCALE_AQ };
+  const char* end = jsonLine + sizeof(jsonLine);
+  int32_t header = now;
+  txQueue.write((const uint8_t*)jsonLine, renderJson(jsonLine, end, JSON_SUMMARY_START, &header) - jsonLine);
+  for (uint8_t w = 0; w < ROLLING_WINDOW_COUNT; w++) {
+    RollingWindow window = (RollingWindow)w;
+    int32_t values[4];
+    values[0] = RollingStats::windowSeconds(window);
+    values[1] = rolling.readings(window);
+    if (w > 0) txQueue.write(',');
+    txQueue.write((const uint8_t*)jsonLine, renderJson(jsonLine, end, JSON_SUMMARY_WINDOW, values) - jsonLine);
+
+    // One channel per render keeps the longest values within the line buffer
+    for (uint8_t c = 0; c < ROLLING_CHANNELS; c++) {
+      WindowSummary stats;
+      rolling.summary(window, c, stats);
+      values[0] = (int32_t)stats.min * 10 / wireScales[c];
+      values[1] = (int32_t)stats.max * 10 / wireScales[c];
+      values[2] = (int32_t)stats.mean * 10 / wireScales[c];
+      values[3] = (int32_t)stats.stddev * 10 / wireScales[c];
+      PGM_P tmpl = (PGM_P)pgm_read_ptr(&JSON_SUMMARY_CHANNELS[c]);
+      txQueue.write((const uint8_t*)jsonLine, renderJson(jsonLine, end, tmpl, values) - jsonLine);
+    }
+    txQueue.write('}');
+  }
+  txQueue.write((const uint8_t*)jsonLine, renderJson(jsonLine, end, JSON_BATCH_END, NULL) - jsonLine);
+}
+
+// Function to send the rolling statistics in the current protocol
+void sendSummary() {
+  uint32_t now = millis();
+  rolling.update(now);
+  if (protocolMode == PROTOCOL_BINARY) {
+    uint8_t len = rolling.encode(txFrame + FRAME_HEADER_SIZE, now);
+    txQueue.write(txFrame, encodeFrame(txFrame, FRAME_TYPE_SUMMARY, txFrame + FRAME_HEADER_SIZE, len));
+    return;
+  }
+  printSummaryJson(now);
+}
+
+// "summary": rolling statistics now, in the current protocol
+void commandSummary(char* args) {
+  sendSummary();
+}
+#endif
+
+#if SD_LOG
+// Function to send the next part of the log range selected by "log read".
+// One chunk per pass, and only while the TX queue can take it whole, so the
+// stream never waits for the UART and sampling continues under it.
+void streamLog() {
+  if (sdLogBusy()) return;  // Blocks of the range may not be on the card yet
+  if (txQueue.space() < LOG_FRAME_HEADER_SIZE + LOG_CHUNK_SIZE + FRAME_OVERHEAD) return;
+
+  uint8_t* payload = txFrame + FRAME_HEADER_SIZE;
+  uint8_t len = sdLogReadChunk(payload);
+  if (len > 0) {
+    txQueue.write(txFrame, encodeFrame(txFrame, FRAME_TYPE_LOG, payload, len));
+    return;
+  }
+
+  schedulerSetEnabled(tasks[LOG_TASK], false, millis());
+  txQueue.print(F("{\"ack\":\"log\",\"done\":1,\"clock\":"));
+  txQueue.print(sdLogClock());
+  txQueue.println('}');
+}
+
+void printLogInfo() {
+  SdLogInfo info;
+  sdLogInfo(info);
+  txQueue.print(F("{\"ack\":\"log\",\"card\":"));
+  txQueue.print(info.card ? 1 : 0);
+  txQueue.print(F(",\"mounted\":"));
+  txQueue.print(info.mounted ? 1 : 0);
+  txQueue.print(F(",\"capacity\":"));
+  txQueue.print(info.capacity);
+  txQueue.print(F(",\"blocks\":"));
+  txQueue.print(info.blocks);
+  txQueue.print(F(",\"buffered\":"));
+  txQueue.print(info.buffered);
+  txQueue.print(F(",\"lastTime\":"));
+  txQueue.print(info.lastTime);
+  txQueue.print(F(",\"clock\":"));
+  txQueue.print(sdLogClock());
+  txQueue.print(F(",\"channels\":"));
+  txQueue.print(LOG_CHANNELS);
+  txQueue.print(F(",\"errors\":"));
+  txQueue.print(info.errors);
+  txQueue.print(F(",\"dropped\":"));
+  txQueue.print(info.dropped);
+  txQueue.println('}');
+}
+
+// "log": SD card log state; "log read <from> [<to>]" streams the records
+// between two log clock times, "log last <seconds>" the most recent ones,
+// as FRAME_TYPE_LOG frames in either protocol; "log stop" ends a stream,
+// "log flush" writes out the partly filled block, "log format" starts a new log
+void commandLog(char* args) {
+  char* option = nextToken(&args);
+  if (option == NULL || strcasecmp_P(option, PSTR("info")) == 0) {
+    printLogInfo();
+    return;
+  }
+
+  uint32_t now = millis();
+  if (strcasecmp_P(option, PSTR("read")) == 0 || strcasecmp_P(option, PSTR("last")) == 0) {
+    char* first = nextToken(&args);
+    char* second = nextToken(&args);
+    if (first == NULL) {
+      sendError(F("usage: log read <from> [<to>] | log last <seconds>"));
+      return;
+    }
+    uint32_t clock = sdLogClock();
+    uint32_t from = strtoul(first, NULL, 10);
+    uint32_t to = second != NULL ? strtoul(second, NULL, 10) : clock;
+    if (strcasecmp_P(option, PSTR("last")) == 0) from = from < clock ? clock - from : 0;
+
+    // The records still in RAM are part of the range
+    sdLogFlush();
+    if (!sdLogSeek(from, to)) {
+      sendError(F("log: nothing to read"));
+      return;
+    }
+    txQueue.print(F("{\"ack\":\"log\",\"from\":"));
+    txQueue.print(from);
+    txQueue.print(F(",\"to\":"));
+    txQueue.print(to);
+    txQueue.print(F(",\"blocks\":"));
+    txQueue.print(sdLogRemaining());
+    txQueue.print(F(",\"clock\":"));
+    txQueue.print(clock);
+    txQueue.println('}');
+    schedulerSetEnabled(tasks[LOG_TASK], true, now);
+    return;
+  }
+  if (strcasecmp_P(option, PSTR("stop")) == 0) {
+    sdLogSeek(1, 0);  // Empty range, drops the cursor
+    schedulerSetEnabled(tasks[LOG_TASK], false, now);
+    sendAck(F("log"));
+    return;
+  }
+  if (strcasecmp_P(option, PSTR("flush")) == 0) {
+    sdLogFlush();
+    sendAck(F("log"));
+    return;
+  }
+  if (strcasecmp_P(option, PSTR("format")) == 0) {
+    schedulerSetEnabled(tasks[LOG_TASK], false, now);
+    if (sdLogFormat()) {
+      sendAck(F("log"));
+    } else {
+      sendError(F("log: no card"));
+    }
+    return;
+  }
+  sendError(F("usage: log [info|read|last|stop|flush|format]"));
+}
+#endif
+
+// "stats": profiling report as JSON, "stats reset" clears it,
+// "stats every <ms>" sends it periodically in the current protocol (0 = off)
+void commandStats(char* args) {
+  char* option = nextToken(&args);
+  if (option == NULL) {
+    printStatsJson();
+    return;
+  }
+
+  if (strcasecmp_P(option, PSTR("reset")) == 0) {
+    profilerReset();
+    powerResetStats();
+    txQueue.resetStats();
+    rxFullCount = 0;
+    sendAck(F("stats"));
+    return;
+  }
+
+  char* value = nextToken(&args);
+  if (strcasecmp_P(option, PSTR("every")) == 0 && value != NULL) {
+    uint32_t interval = strtoul(value, NULL, 10);
+    if (interval > 0) schedulerSetPeriod(tasks[STATS_TASK], interval, millis());
+    schedulerSetEnabled(tasks[STATS_TASK], interval > 0, millis());
+    sendAck(F("stats"));
+    return;
+  }
+  sendError(F("usage: stats [reset|every <ms>]"));
+}
+
+// "flush": send buffered batch records now
+void commandFlush(char* args) {
+  flushBatch();
+}
+
+// "ack <seq>": server stored every batch record up to seq
+void commandAck(char* args) {
+  char* value = nextToken(&args);
+  if (value == NULL) {
+    sendError(F("usage: ack <seq>"));
+    return;
+  }
+  uint8_t released = batch.acknowledge(strtoul(value, NULL, 10));
+  // Send on while a full burst or records from before the last one remain
+  if (batchSize > 0 && released > 0 && (batch.count() >= burstSize() || batch.count() > pendingRecords)) {
+    flushBatch();
+  }
+}
+
+// "batch <n> [plain|delta]": records per burst, 0 disables batching;
+// optionally the encoding of binary bursts
+void commandBatch(char* args) {
+  char* value = nextToken(&args);
+  char* encoding = nextToken(&args);
+  long size = value != NULL ? strtol(value, NULL, 10) : -1;
+  if (size < 0 || size > BATCH_CAPACITY) {
+    sendError(F("usage: batch 0-32 [plain|delta]"));
+    return;
+  }
+  if (encoding != NULL && strcasecmp_P(encoding, PSTR("delta")) == 0) {
+    batchEncoding = BATCH_ENCODING_DELTA;
+  } else if (encoding != NULL && strcasecmp_P(encoding, PSTR("plain")) == 0) {
+    batchEncoding = BATCH_ENCODING_PLAIN;
+  } else if (encoding != NULL) {
+    sendError(F("usage: batch 0-32 [plain|delta]"));
+    return;
+  }
+  batchSize = size;
+  sendAck(F("batch"));
+  if (batchSize == 0) flushBatch();
+}
+
+typedef void (*CommandHandler)(char* args);
+
+struct ServerCommand {
+  PGM_P name;
+  CommandHandler handler;
+};
+
+const char CMD_PING[] PROGMEM = "ping";
+const char CMD_MODE[] PROGMEM = "mode";
+const char CMD_SEND[] PROGMEM = "send";
+const char CMD_INFO[] PROGMEM = "info";
+const char CMD_TASKS[] PROGMEM = "tasks";
+const char CMD_FLUSH[] PROGMEM = "flush";
+const char CMD_ACK[] PROGMEM = "ack";
+const char CMD_BATCH[] PROGMEM = "batch";
+const char CMD_STATS[] PROGMEM = "stats";
+const char CMD_REPORT[] PROGMEM = "report";
+const char CMD_CAL[] PROGMEM = "cal";
+const char CMD_DISPLAY[] PROGMEM = "display";
+const char CMD_CONFIG[] PROGMEM = "config";
+const char CMD_BAUD[] PROGMEM = "baud";
+const char CMD_SUMMARY[] PROGMEM = "summary";
+const char CMD_LOG[] PROGMEM = "log";
+const char CMD_TIME[] PROGMEM = "time";
+
+// Text commands understood by receiveFromServer(), add new commands here
+const ServerCommand serverCommands[] PROGMEM = {
+  { CMD_PING, commandPing },
+  { CMD_MODE, commandMode },
+  { CMD_SEND, commandSend },
+  { CMD_INFO, commandInfo },
+  { CMD_TASKS, commandTasks },
+  { CMD_FLUSH, commandFlush },
+  { CMD_ACK, commandAck },
+  { CMD_BATCH, commandBatch },
+  { CMD_STATS, commandStats },
+  { CMD_REPORT, commandReport },
+  { CMD_CAL, commandCal },
+  { CMD_DISPLAY, commandDisplay },
+  { CMD_CONFIG, commandConfig },
+  { CMD_BAUD, commandBaud },
+  { CMD_TIME, commandTime },
+#if ROLLING_STATS
+  { CMD_SUMMARY, commandSummary },
+#endif
+#if SD_LOG
+  { CMD_LOG, commandLog },
+#endif
+};
+
+// Function to run one complete line received from the server
+void dispatchCommand(char* line) {
+  if (line[0] == '{') {
+    handleServerJson(line);
+    return;
+  }
+
+  char* args = line;
+  char* name = nextToken(&args);
+  for (uint8_t i = 0; i < sizeof(serverCommands) / sizeof(serverCommands[0]); i++) {
+    PGM_P commandName = (PGM_P)pgm_read_ptr(&serverCommands[i].name);
+    if (strcasecmp_P(name, commandName) == 0) {
+      CommandHandler handler = (CommandHandler)pgm_read_ptr(&serverCommands[i].handler);
+      baudUnconfirmed = false;  // A known command means the host follows the link rate
+      handler(args);
+      return;
+    }
+  }
+  sendError(F("unknown command"));
+}
+
+// Function to move queued output into the UART as it makes room
+void pumpTx() {
+  txQueue.pump();
+}
+
+bool supportedBaud(uint32_t rate) {
+  for (uint8_t i = 0; i < sizeof(supportedBauds) / sizeof(supportedBauds[0]); i++) {
+    if (pgm_read_dword(&supportedBauds[i]) == rate) return true;
+  }
+  return false;
+}
+
+// Function to change the host link rate once everything queued has been sent
+void setSerialBaud(uint32_t rate) {
+  txQueue.drain();
+  Serial.begin(rate);
+  serialBaud = rate;
+
+  // Bytes received around the switch are noise at one rate or the other
+  while (Serial.available() > 0) Serial.read();
+  commandParser.reset();
+}
+
+// "baud <rate>": switch the host link. The ack is sent at the old rate, then
+// any known command at the new rate confirms it; without one within
+// BAUD_CONFIRM_MS the board goes back to the old rate.
+void commandBaud(char* args) {
+  char* value = nextToken(&args);
+  uint32_t rate = value != NULL ? strtoul(value, NULL, 10) : 0;
+  if (!supportedBaud(rate)) {
+    sendError(F("usage: baud 9600|19200|38400|57600|115200|250000|500000|1000000"));
+    return;
+  }
+  txQueue.print(F("{\"ack\":\"baud\",\"rate\":"));
+  txQueue.print(rate);
+  txQueue.println('}');
+
+  fallbackBaud = serialBaud;
+  setSerialBaud(rate);
+  baudUnconfirmed = rate != fallbackBaud;
+  baudSwitchTime = millis();
 }
 
 // Function to receive and parse data from server
+// Reads at most COMMAND_MAX_BYTES_PER_POLL bytes per call and never waits for
+// the rest of a line, so a partial message costs nothing until it completes.
 void receiveFromServer() {
-  if (Serial.available() > 0) {
-    String data = Serial.readStringUntil('\n');
-    
-    // Basic parsing of JSON-like response from server
-    // Format expected: {"aqi":120,"status":"Unhealthy for Sensitive Groups"}
-    if (data.startsWith("{") && data.indexOf("aqi") > 0) {
-      int aqiStart = data.indexOf("aqi") + 5;  // Position after "aqi":"
-      int aqiEnd = data.indexOf(",", aqiStart);
-      if (aqiEnd < 0) aqiEnd = data.indexOf("}", aqiStart);
-      
-      String aqiStr = data.substring(aqiStart, aqiEnd);
-      aqi = aqiStr.toInt();
-      
-      // Extract status message if present
-      int statusStart = data.indexOf("status") + 9;  // Position after "status":"
-      if (statusStart > 9) {  // Found "status":
-        int statusEnd = data.indexOf("\"", statusStart);
-        if (statusEnd > statusStart) {
-          airQualityMessage = data.substring(statusStart, statusEnd);
-        }
-      }
+  PROFILE_SCOPE(PROFILE_RECEIVE);
+
+  if (baudUnconfirmed && millis() - baudSwitchTime >= BAUD_CONFIRM_MS) {
+    baudUnconfirmed = false;
+    setSerialBaud(fallbackBaud);
+  }
+  if (Serial.available() >= SERIAL_RX_BUFFER_SIZE - 1) rxFullCount++;
+  for (uint8_t i = 0; i < COMMAND_MAX_BYTES_PER_POLL && Serial.available() > 0; i++) {
+    if (commandParser.feed(Serial.read())) {
+      dispatchCommand(commandParser.line());
     }
   }
-}
\ No newline at end of file
+}
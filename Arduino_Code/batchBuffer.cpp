@@ -0,0 +1,29 @@
+#include "batchBuffer.h"
+
+BatchBuffer::BatchBuffer() : first(0), size(0), dropped(0) {}
+
+void BatchBuffer::append(const BatchRecord& record) {
+  if (size == BATCH_CAPACITY) {
+    // Full, overwrite the oldest record
+    first = (first + 1) % BATCH_CAPACITY;
+    size--;
+    dropped++;
+  }
+  records[(first + size) % BATCH_CAPACITY] = record;
+  size++;
+}
+
+const BatchRecord& BatchBuffer::at(uint8_t i) const {
+  return records[(first + i) % BATCH_CAPACITY];
+}
+
+uint8_t BatchBuffer::acknowledge(uint16_t seq) {
+  uint8_t released = 0;
+  // Signed distance handles the 16-bit sequence wrap
+  while (size > 0 && (int16_t)(seq - records[first].seq) >= 0) {
+    first = (first + 1) % BATCH_CAPACITY;
+    size--;
+    released++;
+  }
+  return released;
+}
@@ -0,0 +1,47 @@
+#ifndef BATCH_BUFFER_H
+#define BATCH_BUFFER_H
+
+#include <stdint.h>
+
+// RAM buffer of timestamped samples for burst transmission.
+//
+// Records stay in the buffer until the host acknowledges them by sequence
+// number, so samples taken while the host port is closed or reconnecting are
+// sent with the next batch instead of being lost. When the buffer is full
+// the oldest record is overwritten and counted as dropped.
+#define BATCH_CAPACITY 32
+
+struct BatchRecord {
+  uint16_t seq;
+  uint32_t timeMs;      // millis() when the sample was taken
+  uint16_t co;          // Wire units, see serialProtocol.h
+  uint16_t ch4;
+  uint16_t airQuality;
+  uint8_t flags;
+};
+
+class BatchBuffer {
+public:
+  BatchBuffer();
+
+  void append(const BatchRecord& record);
+
+  uint8_t count() const { return size; }
+
+  // i = 0 is the oldest record
+  const BatchRecord& at(uint8_t i) const;
+
+  // Drop every record up to and including seq (wrap-around aware).
+  // Returns the number of records released.
+  uint8_t acknowledge(uint16_t seq);
+
+  uint16_t droppedCount() const { return dropped; }
+
+private:
+  BatchRecord records[BATCH_CAPACITY];
+  uint8_t first;  // Index of the oldest record
+  uint8_t size;
+  uint16_t dropped;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "busLink.h"
+
+static HardwareSerial* busPort = NULL;
+static uint8_t busDePin = 0;
+static uint8_t nodeId = 0;
+static FrameReader reader;
+static uint32_t lastByteTime = 0;
+
+void busBegin(HardwareSerial& port, uint32_t baud, uint8_t dePin, uint8_t id) {
+  busPort = &port;
+  busDePin = dePin;
+  nodeId = id;
+
+  // Receive by default, the line belongs to the gateway
+  digitalWrite(busDePin, LOW);
+  pinMode(busDePin, OUTPUT);
+  busPort->begin(baud);
+}
+
+uint8_t busNodeId() {
+  return nodeId;
+}
+
+bool busReceive(BusPoll& poll) {
+  uint32_t now = millis();
+  if (busPort->available() == 0) {
+    if (now - lastByteTime > BUS_FRAME_GAP_MS) reader.reset();
+    return false;
+  }
+
+  lastByteTime = now;
+  for (uint8_t i = 0; i < BUS_MAX_BYTES_PER_POLL && busPort->available() > 0; i++) {
+    if (!reader.feed(busPort->read())) continue;
+    if (reader.type() != FRAME_TYPE_POLL) continue;
+    if (decodePollPayload(reader.payload(), reader.length(), poll) && poll.node == nodeId) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool busPending() {
+  return busPort->available() > 0;
+}
+
+void busSend(const uint8_t* frame, uint8_t size) {
+  digitalWrite(busDePin, HIGH);
+  busPort->write(frame, size);
+  busPort->flush();
+  digitalWrite(busDePin, LOW);
+}
+
+uint16_t busCrcErrors() {
+  return reader.crcErrors();
+}
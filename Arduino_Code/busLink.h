@@ -0,0 +1,34 @@
+#ifndef BUS_LINK_H
+#define BUS_LINK_H
+
+#include <Arduino.h>
+
+#include "serialProtocol.h"
+
+// Node side of the addressed RS-485 bus (BUS_MODE).
+//
+// Nodes share one half-duplex line through a transceiver whose driver is
+// enabled by dePin. A gateway polls the nodes in turn with FRAME_TYPE_POLL;
+// a node only ever transmits in answer to a poll carrying its own ID, so
+// there are no collisions and a node's latency is bounded by one polling
+// round. Frames addressed to other nodes are skipped by the reader.
+#define BUS_FRAME_GAP_MS 5          // Silence that ends a partial frame
+#define BUS_MAX_BYTES_PER_POLL 32   // Bound on the work done per loop() pass
+
+void busBegin(HardwareSerial& port, uint32_t baud, uint8_t dePin, uint8_t nodeId);
+
+uint8_t busNodeId();
+
+// Read pending bytes, returns true when a poll for this node has arrived
+bool busReceive(BusPoll& poll);
+
+// True if received bytes are waiting for busReceive()
+bool busPending();
+
+// Transmit a complete frame; blocks until the last byte has left the UART
+// so the driver can be released for the gateway
+void busSend(const uint8_t* frame, uint8_t size);
+
+uint16_t busCrcErrors();
+
+#endif
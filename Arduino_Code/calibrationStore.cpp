@@ -0,0 +1,69 @@
+#include <avr/eeprom.h>
+#include <stddef.h>
+
+#include "calibrationStore.h"
+#include "serialProtocol.h"
+
+static uint8_t* slotAddress(uint8_t slot) {
+  return (uint8_t*)(CALIBRATION_EEPROM_BASE + slot * CALIBRATION_SLOT_SIZE);
+}
+
+static uint16_t recordCrc(const CalibrationRecord& record) {
+  const uint8_t* bytes = (const uint8_t*)&record;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < offsetof(CalibrationRecord, crc); i++) {
+    crc = crc16Update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+// Slot of the newest valid record, or -1
+static int8_t newestSlot(CalibrationRecord& newest) {
+  int8_t found = -1;
+  for (uint8_t slot = 0; slot < CALIBRATION_SLOTS; slot++) {
+    CalibrationRecord record;
+    eeprom_read_block(&record, slotAddress(slot), sizeof(record));
+    if (record.version != CALIBRATION_VERSION || record.crc != recordCrc(record)) continue;
+    // Signed distance handles the sequence wrap
+    if (found < 0 || (int16_t)(record.seq - newest.seq) > 0) {
+      newest = record;
+      found = slot;
+    }
+  }
+  return found;
+}
+
+bool calibrationLoad(CalibrationRecord& record) {
+  return newestSlot(record) >= 0;
+}
+
+void calibrationSave(CalibrationRecord& record) {
+  CalibrationRecord newest;
+  int8_t slot = newestSlot(newest);
+
+  record.version = CALIBRATION_VERSION;
+  record.seq = slot >= 0 ? newest.seq + 1 : 0;
+  record.crc = recordCrc(record);
+  eeprom_update_block(&record, slotAddress((slot + 1) % CALIBRATION_SLOTS), sizeof(record));
+}
+
+void calibrationCapture(CalibrationRecord& record) {
+  for (uint8_t i = 0; i < GAS_SENSOR_COUNT; i++) {
+    GasSensor sensor = (GasSensor)i;
+    record.sensors[i].r0 = calibratedR0(sensor);
+    record.sensors[i].curveA = calibratedCurveA(sensor);
+    record.sensors[i].curveB = curveB(sensor);
+  }
+}
+
+uint8_t calibrationApply(const CalibrationRecord& record) {
+  uint8_t applied = 0;
+  for (uint8_t i = 0; i < GAS_SENSOR_COUNT; i++) {
+    GasSensor sensor = (GasSensor)i;
+    const SensorCalibration& stored = record.sensors[i];
+    if (stored.curveB != curveB(sensor) || !(stored.r0 > 0) || !(stored.curveA > 0)) continue;
+    setCalibration(sensor, stored.r0, stored.curveA);
+    applied++;
+  }
+  return applied;
+}
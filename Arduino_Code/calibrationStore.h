@@ -0,0 +1,48 @@
+#ifndef CALIBRATION_STORE_H
+#define CALIBRATION_STORE_H
+
+#include <stdint.h>
+
+#include "ppmConversion.h"
+
+// Sensor calibration kept in EEPROM.
+//
+// Records are written round-robin into CALIBRATION_SLOTS slots, each tagged
+// with an increasing sequence number and a CRC, so every save wears a
+// different slot and an interrupted write only loses that one record. At
+// boot the valid record with the newest sequence number wins.
+#define CALIBRATION_EEPROM_BASE 0
+#define CALIBRATION_SLOTS 16
+#define CALIBRATION_SLOT_SIZE 48
+#define CALIBRATION_VERSION 1
+
+struct SensorCalibration {
+  float r0;      // kOhm in clean air
+  float curveA;
+  float curveB;  // Must match the firmware's curve, see calibrationApply()
+};
+
+struct CalibrationRecord {
+  uint8_t version;
+  uint16_t seq;
+  SensorCalibration sensors[GAS_SENSOR_COUNT];
+  uint16_t crc;
+};
+
+static_assert(sizeof(CalibrationRecord) <= CALIBRATION_SLOT_SIZE, "calibration record outgrew its slot");
+
+// Newest valid record, false when the EEPROM holds none
+bool calibrationLoad(CalibrationRecord& record);
+
+// Write a record into the next slot; seq and crc are filled in
+void calibrationSave(CalibrationRecord& record);
+
+// Record of the conversion's current calibration
+void calibrationCapture(CalibrationRecord& record);
+
+// Hand a record to the conversion. Sensors whose stored slope differs from
+// the compiled curve keep their defaults, the tables would not match.
+// Returns the number of sensors applied.
+uint8_t calibrationApply(const CalibrationRecord& record);
+
+#endif
@@ -0,0 +1,29 @@
+#include "changeReporter.h"
+
+ChangeReporter::ChangeReporter(const uint16_t* deadbands, uint8_t count, uint32_t heartbeatMs)
+    : deadbands(deadbands),
+      count(count > REPORT_MAX_CHANNELS ? REPORT_MAX_CHANNELS : count),
+      heartbeatMs(heartbeatMs),
+      primed(false),
+      lastFlags(0),
+      lastTime(0) {}
+
+bool ChangeReporter::due(const uint16_t* values, uint8_t flags, uint32_t now) const {
+  if (!primed || flags != lastFlags) return true;
+  if (now - lastTime >= heartbeatMs) return true;
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint16_t delta = values[i] > last[i] ? values[i] - last[i] : last[i] - values[i];
+    if (delta > deadbands[i]) return true;
+  }
+  return false;
+}
+
+void ChangeReporter::reported(const uint16_t* values, uint8_t flags, uint32_t now) {
+  for (uint8_t i = 0; i < count; i++) {
+    last[i] = values[i];
+  }
+  lastFlags = flags;
+  lastTime = now;
+  primed = true;
+}
@@ -0,0 +1,41 @@
+#ifndef CHANGE_REPORTER_H
+#define CHANGE_REPORTER_H
+
+#include <stdint.h>
+
+// Report-on-change decision for the telemetry stream.
+//
+// Values are compared in wire units against the last report; a channel that
+// moves by more than its deadband, a change of the sample flags, or an
+// expired heartbeat makes a report due. Flat readings therefore cost one
+// heartbeat frame per heartbeatMs instead of one frame per transmit tick.
+#define REPORT_MAX_CHANNELS 4
+
+class ChangeReporter {
+public:
+  // deadbands is read on every check, so the caller can change it at runtime
+  ChangeReporter(const uint16_t* deadbands, uint8_t count, uint32_t heartbeatMs);
+
+  bool due(const uint16_t* values, uint8_t flags, uint32_t now) const;
+
+  // Remember what was sent
+  void reported(const uint16_t* values, uint8_t flags, uint32_t now);
+
+  // Make the next due() return true, e.g. after the mode is switched on
+  void force() { primed = false; }
+
+  uint32_t heartbeat() const { return heartbeatMs; }
+  void setHeartbeat(uint32_t ms) { heartbeatMs = ms; }
+
+private:
+  const uint16_t* deadbands;
+  uint8_t count;
+  uint32_t heartbeatMs;
+
+  bool primed;
+  uint16_t last[REPORT_MAX_CHANNELS];
+  uint8_t lastFlags;
+  uint32_t lastTime;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "commandParser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+CommandParser::CommandParser() : length(0), state(IN_LINE), overflows(0) {
+  buffer[0] = '\0';
+}
+
+void CommandParser::reset() {
+  length = 0;
+  state = IN_LINE;
+}
+
+bool CommandParser::feed(char c) {
+  if (c == '\n' || c == '\r') {
+    bool complete = (state == IN_LINE && length > 0);
+    state = IN_LINE;
+    buffer[length] = '\0';
+    length = 0;
+    return complete;
+  }
+
+  if (state == DISCARDING) return false;
+
+  if (length >= COMMAND_BUFFER_SIZE - 1) {
+    // Too long for the buffer, drop the rest of this line
+    overflows++;
+    state = DISCARDING;
+    length = 0;
+    return false;
+  }
+
+  // Skip leading whitespace so "  ping" and "ping" are the same command
+  if (length == 0 && (c == ' ' || c == '\t')) return false;
+
+  buffer[length++] = c;
+  return false;
+}
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+char* nextToken(char** cursor) {
+  char* p = *cursor;
+  while (isSpace(*p)) p++;
+  if (*p == '\0') {
+    *cursor = p;
+    return NULL;
+  }
+
+  char* token = p;
+  while (*p != '\0' && !isSpace(*p)) p++;
+  if (*p != '\0') *p++ = '\0';
+  *cursor = p;
+  return token;
+}
+
+const char* findJsonValue(const char* json, PGM_P key) {
+  size_t keyLength = strlen_P(key);
+  for (const char* p = strchr(json, '"'); p != NULL; p = strchr(p + 1, '"')) {
+    if (strncmp_P(p + 1, key, keyLength) != 0 || p[keyLength + 1] != '"') continue;
+
+    const char* value = p + keyLength + 2;
+    while (isSpace(*value)) value++;
+    if (*value != ':') continue;
+    value++;
+    while (isSpace(*value)) value++;
+    return value;
+  }
+  return NULL;
+}
+
+bool readJsonInt(const char* json, PGM_P key, long* value) {
+  const char* start = findJsonValue(json, key);
+  if (start == NULL) return false;
+
+  // Accept both 120 and "120"
+  if (*start == '"') start++;
+  char* end;
+  long parsed = strtol(start, &end, 10);
+  if (end == start) return false;
+  *value = parsed;
+  return true;
+}
+
+bool readJsonString(const char* json, PGM_P key, char* out, uint8_t size) {
+  const char* start = findJsonValue(json, key);
+  if (start == NULL || *start != '"') return false;
+  start++;
+
+  const char* end = strchr(start, '"');
+  if (end == NULL) return false;
+
+  uint8_t length = end - start;
+  if (length >= size) length = size - 1;
+  memcpy(out, start, length);
+  out[length] = '\0';
+  return true;
+}
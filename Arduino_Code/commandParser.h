@@ -0,0 +1,49 @@
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// Incremental, allocation-free line parser for commands from the server.
+//
+// Bytes are fed one at a time into a fixed static buffer. A line longer than
+// the buffer is discarded up to its newline and counted as an overflow, so a
+// garbled or oversized message can never block the loop or touch the heap.
+#define COMMAND_BUFFER_SIZE 64
+#define COMMAND_MAX_BYTES_PER_POLL 32  // Bound on the work done per loop() pass
+
+class CommandParser {
+public:
+  CommandParser();
+
+  // Feed one received byte, returns true when a complete line is available
+  bool feed(char c);
+
+  // Drop a partly received line, e.g. after the link rate changed
+  void reset();
+
+  // The completed line, NUL-terminated and trimmed. Valid until the next feed().
+  char* line() { return buffer; }
+
+  uint16_t overflowCount() const { return overflows; }
+
+private:
+  enum State : uint8_t { IN_LINE, DISCARDING };
+
+  char buffer[COMMAND_BUFFER_SIZE];
+  uint8_t length;
+  State state;
+  uint16_t overflows;
+};
+
+// Split off the next whitespace-separated token from *cursor, or NULL at the end
+char* nextToken(char** cursor);
+
+// Find "key": in a flat JSON object and return a pointer to its value, or NULL
+const char* findJsonValue(const char* json, PGM_P key);
+
+// Read an integer / string value of a flat JSON object
+bool readJsonInt(const char* json, PGM_P key, long* value);
+bool readJsonString(const char* json, PGM_P key, char* out, uint8_t size);
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Build-time configuration for the air quality monitor firmware.
+// Each option can be overridden with a -D flag or by editing the value here.
+
+// Serial protocol used by sendDataToPC()
+#define PROTOCOL_JSON 0    // One JSON object per line (debug fallback)
+#define PROTOCOL_BINARY 1  // Fixed-size CRC-checked frames, see serialProtocol.h
+
+#ifndef DEFAULT_PROTOCOL
+#define DEFAULT_PROTOCOL PROTOCOL_BINARY
+#endif
+
+// ADC sampling engine (adcSampler.h)
+#ifndef ADC_SCAN_RATE_HZ
+#define ADC_SCAN_RATE_HZ 200  // Full scans of all gas channels per second
+#endif
+#define ADC_RING_SIZE 32      // Buffered scans, power of two
+
+// Quiet sampling: instead of the Timer1 stream, a burst of ADC_QUIET_SCANS
+// scans every ADC_QUIET_INTERVAL ms, each conversion taken with the CPU in
+// idle sleep. A burst of 16 scans gives one filter output at the default
+// oversampling (12 bits); with FILTER_OVERSAMPLE_LOG2 6 four bursts give 13.
+#ifndef ADC_QUIET_SAMPLING
+#define ADC_QUIET_SAMPLING 0
+#endif
+#define ADC_QUIET_INTERVAL 250  // ms
+#define ADC_QUIET_SCANS 16      // At most ADC_RING_SIZE
+
+// Per-channel filtering in front of the ppm conversion (sensorFilter.h)
+#ifndef FILTER_OVERSAMPLE_LOG2
+#define FILTER_OVERSAMPLE_LOG2 4  // Decimate 16 scans into one value
+#endif
+#ifndef FILTER_MODE
+#define FILTER_MODE FILTER_EMA    // FILTER_NONE, FILTER_EMA or FILTER_MEDIAN
+#endif
+#define FILTER_EMA_SHIFT 3        // EMA alpha = 1/8
+
+// Batch transmission (batchBuffer.h), 0 sends every sample as it is taken
+#ifndef DEFAULT_BATCH_SIZE
+#define DEFAULT_BATCH_SIZE 0
+#endif
+#define BATCH_ENCODING_PLAIN 0  // Fixed 13-byte records
+#define BATCH_ENCODING_DELTA 1  // Delta/varint records, FRAME_TYPE_BATCH_DELTA
+#ifndef DEFAULT_BATCH_ENCODING
+#define DEFAULT_BATCH_ENCODING BATCH_ENCODING_DELTA
+#endif
+
+// Integer-only sensor math (ppmConversion.h). Readings become int32 values
+// in 0.1 ppm units and no float code is linked into the sample pipeline.
+#ifndef FIXED_POINT_MATH
+#define FIXED_POINT_MATH 0
+#endif
+
+// Hot-path profiling (profiler.h). Section timing costs a few microseconds
+// per call; the "stats" command works either way.
+#ifndef ENABLE_PROFILING
+#define ENABLE_PROFILING 1
+#endif
+#ifndef STATS_INTERVAL
+#define STATS_INTERVAL 0  // ms between unsolicited stats reports, 0 = only on request
+#endif
+
+// Addressed RS-485 bus (busLink.h). Instead of streaming on the USB port the
+// node buffers its samples and hands them to a gateway that polls it on Serial1.
+#ifndef BUS_MODE
+#define BUS_MODE 0
+#endif
+#ifndef BUS_NODE_ID
+#define BUS_NODE_ID 1      // 1-247, unique on the bus
+#endif
+#define BUS_BAUD 115200
+#define BUS_DE_PIN 2       // Transceiver DE and /RE, high while transmitting
+
+// Report-on-change telemetry (changeReporter.h). Readings are checked every
+// REPORT_CHECK_INTERVAL and sent as soon as one leaves its deadband, or after
+// REPORT_HEARTBEAT_MS without a report. Deadbands are in wire units.
+#ifndef DEFAULT_REPORT_ON_CHANGE
+#define DEFAULT_REPORT_ON_CHANGE 0
+#endif
+#define REPORT_CHECK_INTERVAL 250   // ms
+#define REPORT_HEARTBEAT_MS 60000UL
+#define REPORT_DEADBAND_CO 5        // 0.5 ppm
+#define REPORT_DEADBAND_CH4 50      // ppm
+#define REPORT_DEADBAND_AQ 25       // ppm
+
+// MQ-7 heater cycling (heaterCycle.h). Needs the heater switched by a MOSFET
+// on MQ7_HEATER_PIN; with it off the heater is assumed to sit on 5 V and CO
+// is read continuously.
+#ifndef MQ7_HEATER_CYCLE
+#define MQ7_HEATER_CYCLE 0
+#endif
+#define MQ7_HEATER_PIN 9   // OC2B, Timer2 PWM
+#define HEATER_CHECK_INTERVAL 100  // ms
+
+// Low-power idle (lowPower.h). The CPU sleeps between scheduler passes and
+// wakes on the next interrupt. With DISPLAY_CYCLE_MS set the OLED is only lit
+// for the first DISPLAY_ON_MS of every cycle, "display on|off|auto" overrides.
+#ifndef LOW_POWER_IDLE
+#define LOW_POWER_IDLE 1
+#endif
+#ifndef DISPLAY_CYCLE_MS
+#define DISPLAY_CYCLE_MS 0UL     // 0 = never blank
+#endif
+#define DISPLAY_ON_MS 10000UL
+
+// Host link (txQueue.h). The board boots at SERIAL_BAUD; "baud <rate>"
+// switches up and falls back unless the host confirms the new rate within
+// BAUD_CONFIRM_MS. TX_CTS_PIN enables hardware flow control, -1 = none.
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 9600
+#endif
+#define BAUD_CONFIRM_MS 2000
+#ifndef TX_CTS_PIN
+#define TX_CTS_PIN -1
+#endif
+
+// On-device AQI (aqiEngine.h) from the 8-hour CO average. An AQI sent by the
+// server replaces it on the display for AQI_HOST_HOLD_MS.
+#ifndef AQI_ON_DEVICE
+#define AQI_ON_DEVICE 1
+#endif
+#define AQI_HOST_HOLD_MS 300000UL
+
+// Rolling 1-minute, 15-minute and hourly statistics (rollingStats.h), sent
+// as a summary every SUMMARY_INTERVAL ms and on "summary". The 1-minute
+// window keeps up to ROLLING_RAW_CAPACITY readings, a minute at the default
+// 2 s sample period; faster sampling shortens it to the newest readings.
+#ifndef ROLLING_STATS
+#define ROLLING_STATS 1
+#endif
+#ifndef SUMMARY_INTERVAL
+#define SUMMARY_INTERVAL 60000UL  // 0 = only on request
+#endif
+#define ROLLING_RAW_CAPACITY 32
+
+// PMS5003 particulate sensor on Serial2's RX pin (pmsSensor.h). Readings
+// older than PM_STALE_MS, from a sensor that stopped sending, are not reported.
+#ifndef PM_SENSOR
+#define PM_SENSOR 0
+#endif
+#define PM_STALE_MS 10000UL
+
+// Append-only log of the readings on an SD card (sdLog.h), on the hardware
+// SPI pins (50-52) with chip select on SD_CS_PIN
+#ifndef SD_LOG
+#define SD_LOG 0
+#endif
+#define SD_CS_PIN 53
+
+// DS3231 real-time clock on the I2C bus for sample timestamps (wallClock.h);
+// without it the time comes from the server's "time" command
+#ifndef RTC_DS3231
+#define RTC_DS3231 0
+#endif
+#define RTC_SYNC_INTERVAL 600000UL  // ms between RTC reads
+
+// Hardware watchdog and warm restart from a RAM snapshot (recovery.h)
+#ifndef WATCHDOG
+#define WATCHDOG 1
+#endif
+#define WATCHDOG_TIMEOUT WDTO_2S  // From avr/wdt.h
+#define WATCHDOG_TIMEOUT_MS 2000UL
+
+// Static-allocation profile (memoryGuard.h): the heap is a fixed arena
+// sized for the OLED frame buffer and closed after setup()
+#ifndef STATIC_ALLOCATION
+#define STATIC_ALLOCATION 0
+#endif
+#ifndef MEMORY_HEAP_SIZE
+#define MEMORY_HEAP_SIZE (128 * 64 / 8 + 2)  // 128x64 SSD1306 buffer plus malloc's size header
+#endif
+
+#endif
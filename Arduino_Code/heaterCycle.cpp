@@ -0,0 +1,35 @@
+#include <Arduino.h>
+
+#include "heaterCycle.h"
+
+HeaterCycle::HeaterCycle() : pin(0), currentPhase(HEATER_HIGH), phaseStart(0), completedCycles(0) {}
+
+void HeaterCycle::begin(uint8_t heaterPin, uint32_t now) {
+  pin = heaterPin;
+  completedCycles = 0;
+  pinMode(pin, OUTPUT);
+  enter(HEATER_HIGH, now);
+}
+
+void HeaterCycle::enter(HeaterPhase phase, uint32_t now) {
+  currentPhase = phase;
+  phaseStart = now;
+  if (phase == HEATER_HIGH) {
+    digitalWrite(pin, HIGH);
+  } else {
+    analogWrite(pin, HEATER_LOW_DUTY);
+  }
+}
+
+bool HeaterCycle::update(uint32_t now) {
+  uint32_t elapsed = now - phaseStart;
+  if (currentPhase == HEATER_HIGH) {
+    if (elapsed >= HEATER_HIGH_MS) enter(HEATER_LOW, now);
+    return false;
+  }
+
+  if (elapsed < HEATER_LOW_MS) return false;
+  enter(HEATER_HIGH, now);
+  completedCycles++;
+  return true;
+}
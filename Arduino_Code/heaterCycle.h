@@ -0,0 +1,45 @@
+#ifndef HEATER_CYCLE_H
+#define HEATER_CYCLE_H
+
+#include <stdint.h>
+
+// MQ-7 heater cycling.
+//
+// The MQ-7 only gives a valid CO reading if its heater alternates between a
+// 5 V cleaning phase and a 1.4 V measuring phase, read at the very end of
+// the low phase. The heater is driven through a logic-level MOSFET from a
+// PWM pin; the low phase uses the duty cycle that dissipates the same power
+// as 1.4 V DC, (1.4 / 5)^2 = 7.8 %. update() only switches phases, nothing
+// here blocks.
+#define HEATER_HIGH_MS 60000UL
+#define HEATER_LOW_MS 90000UL
+#define HEATER_LOW_DUTY 20  // of 255, RMS-equivalent of 1.4 V from 5 V
+
+enum HeaterPhase : uint8_t { HEATER_HIGH, HEATER_LOW };
+
+class HeaterCycle {
+public:
+  HeaterCycle();
+
+  // Start with the high (cleaning) phase
+  void begin(uint8_t heaterPin, uint32_t now);
+
+  // Advance the cycle; returns true when a low phase has just ended, which
+  // is the moment the CO reading is valid
+  bool update(uint32_t now);
+
+  HeaterPhase phase() const { return currentPhase; }
+
+  // Completed measuring phases since begin()
+  uint16_t cycles() const { return completedCycles; }
+
+private:
+  void enter(HeaterPhase phase, uint32_t now);
+
+  uint8_t pin;
+  HeaterPhase currentPhase;
+  uint32_t phaseStart;
+  uint16_t completedCycles;
+};
+
+#endif
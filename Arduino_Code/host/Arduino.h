@@ -0,0 +1,78 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Minimal Arduino API for building the pure-logic modules natively (see
+// bench.cpp). Only what those modules use is provided; anything touching
+// registers or peripherals stays on the device.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(PSTR(string_literal)))
+
+// Host clock driven by the harness instead of a timer
+extern uint32_t hostMillis;
+inline unsigned long millis() { return hostMillis; }
+
+inline char* ltoa(long value, char* out, int base) {
+  (void)base;
+  sprintf(out, "%ld", value);
+  return out;
+}
+
+inline char* itoa(int value, char* out, int base) {
+  return ltoa(value, out, base);
+}
+
+inline char* dtostrf(double value, signed char width, unsigned char precision, char* out) {
+  sprintf(out, "%*.*f", width, precision, value);
+  return out;
+}
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+
+  size_t write(const char* text) {
+    size_t n = 0;
+    while (*text) n += write((uint8_t)*text++);
+    return n;
+  }
+
+  size_t print(const __FlashStringHelper* text) { return write((const char*)text); }
+  size_t print(const char* text) { return write(text); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value) { return print((long)value); }
+  size_t print(unsigned int value) { return print((unsigned long)value); }
+  size_t print(long value) { return printf("%ld", value); }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+  size_t println() { return write('\n'); }
+
+private:
+  template <typename... Args>
+  size_t printf(const char* format, Args... args) {
+    char text[32];
+    snprintf(text, sizeof(text), format, args...);
+    return write(text);
+  }
+};
+
+#endif
@@ -0,0 +1,409 @@
+// Host benchmark and replay harness for the firmware's pure-logic modules.
+// The Arduino IDE only builds the sketch folder itself, so host/ is ignored there.
+//
+// Build natively from Arduino_Code/ against the shim in host/ (add
+// -DFIXED_POINT_MATH=1 to measure the integer pipeline):
+//   g++ -std=gnu++11 -O2 -Ihost -I. -o bench host/bench.cpp ppmConversion.cpp
+//       sensorFilter.cpp commandParser.cpp warmupMonitor.cpp jsonTemplate.cpp
+//
+//   ./bench                     conversion, parser and JSON microbenchmarks
+//   ./bench parse <replies>     parser throughput over a recorded server log
+//   ./bench replay [trace.csv]  run an ADC trace through filter, conversion and warm-up
+//
+// A trace holds one scan per line as "mq7,mq135,mq4" raw counts taken at
+// ADC_SCAN_RATE_HZ; without a file a synthetic warm-up trace is used. Replay
+// prints CSV on stdout so the output of two builds can be diffed, timings go
+// to stderr.
+#include <Arduino.h>
+#include <chrono>
+
+#include "config.h"
+#include "commandParser.h"
+#include "jsonTemplate.h"
+#include "ppmConversion.h"
+#include "sensorFilter.h"
+#include "warmupMonitor.h"
+
+#define BENCH_SENSOR_INTERVAL 2000     // Matches sensorReadInterval in arduinoCode.cpp
+#define BENCH_PARSER_BYTES 4000000UL   // Input volume per parser run
+#define BENCH_SYNTHETIC_SCANS (ADC_SCAN_RATE_HZ * 180UL)
+#define BENCH_JSON_RECORDS 1000000UL
+
+uint32_t hostMillis = 0;
+
+static volatile float floatSink;
+static volatile int32_t intSink;
+
+class StdoutPrint : public Print {
+public:
+  size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+};
+
+static StdoutPrint out;
+
+static double nowSeconds() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Deterministic input, the same on every run
+static uint32_t randomState = 0x2545F491;
+
+static uint32_t nextRandom() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+// Conversion ---------------------------------------------------------------
+
+typedef float (*ExactFunction)(float);
+typedef ppm_t (*TableFunction)(uint16_t);
+
+struct Curve {
+  const char* name;
+  ExactFunction exact;
+  TableFunction table;
+  // Range kept by convertReadings(), errors outside it are clamped away. CO
+  // starts at 1 ppm since output is quantised to 0.1 ppm.
+  double low;
+  double high;
+};
+
+static const Curve curves[] = {
+  { "co", calculateCOppmExact, calculateCOppm, 1.0, 1000.0 },
+  { "ch4", calculateCH4ppmExact, calculateCH4ppm, 500.0, 10000.0 },
+  { "airQuality", calculateAirQualityppmExact, calculateAirQualityppm, 400.0, 5000.0 },
+};
+
+#define COUNTS_Q4_MIN (1 << FILTER_FRAC_BITS)
+#define COUNTS_Q4_MAX (1023 << FILTER_FRAC_BITS)
+
+static void benchConversion() {
+  const int passes = 50;
+  const double calls = (double)passes * (COUNTS_Q4_MAX - COUNTS_Q4_MIN + 1);
+
+  printf("%-12s %12s %12s %10s\n", "curve", "pow ns", FIXED_POINT_MATH ? "fixed ns" : "lut ns", "max err %");
+  for (const Curve& curve : curves) {
+    double start = nowSeconds();
+    for (int pass = 0; pass < passes; pass++) {
+      for (uint16_t q = COUNTS_Q4_MIN; q <= COUNTS_Q4_MAX; q++) {
+        floatSink = curve.exact(q / (float)(1 << FILTER_FRAC_BITS));
+      }
+    }
+    double exactNs = (nowSeconds() - start) / calls * 1e9;
+
+    start = nowSeconds();
+    for (int pass = 0; pass < passes; pass++) {
+      for (uint16_t q = COUNTS_Q4_MIN; q <= COUNTS_Q4_MAX; q++) {
+        intSink = ppmToDeci(curve.table(q));
+      }
+    }
+    double tableNs = (nowSeconds() - start) / calls * 1e9;
+
+    // Relative error against pow(), over the readings the device reports
+    double maxError = 0;
+    for (uint16_t q = COUNTS_Q4_MIN; q <= COUNTS_Q4_MAX; q++) {
+      double exact = curve.exact(q / (float)(1 << FILTER_FRAC_BITS));
+      if (exact < curve.low || exact > curve.high) continue;
+      double error = fabs(ppmToDeci(curve.table(q)) / 10.0 - exact) / exact * 100.0;
+      if (error > maxError) maxError = error;
+    }
+    printf("%-12s %12.1f %12.1f %10.3f\n", curve.name, exactNs, tableNs, maxError);
+  }
+}
+
+// Parser --------------------------------------------------------------------
+
+static const char* const sampleReplies[] = {
+  "{\"aqi\":57,\"status\":\"Moderate\"}\n",
+  "{\"aqi\":162,\"status\":\"Unhealthy\"}\r\n",
+  "ack 1234\n",
+  "ping\n",
+  "batch 16\n",
+  "info\n",
+};
+
+struct ParserResult {
+  unsigned long bytes;
+  unsigned long lines;
+  unsigned long jsonValues;
+  unsigned int overflows;
+  double seconds;
+};
+
+// Feed bytes the way receiveFromServer() does and decode each line the way
+// dispatchCommand() would
+static ParserResult runParser(const char* data, size_t size, unsigned long totalBytes) {
+  CommandParser parser;
+  ParserResult result = { 0, 0, 0, 0, 0 };
+  double start = nowSeconds();
+  while (result.bytes < totalBytes) {
+    for (size_t i = 0; i < size; i++) {
+      if (!parser.feed(data[i])) continue;
+      result.lines++;
+
+      char* line = parser.line();
+      if (line[0] == '{') {
+        long aqi;
+        char status[32];
+        result.jsonValues += readJsonInt(line, PSTR("aqi"), &aqi);
+        result.jsonValues += readJsonString(line, PSTR("status"), status, sizeof(status));
+      } else {
+        char* args = line;
+        while (nextToken(&args) != NULL) {}
+      }
+    }
+    result.bytes += size;
+  }
+  result.seconds = nowSeconds() - start;
+  result.overflows = parser.overflowCount();
+  return result;
+}
+
+static void printParserResult(const char* name, const ParserResult& result) {
+  printf("%-12s %8.2f MB/s %10lu lines %10lu values %6u overflows\n", name,
+         result.bytes / result.seconds / 1e6, result.lines, result.jsonValues, result.overflows);
+}
+
+// Noise with valid replies mixed in: long lines, stray CRs, binary garbage
+static size_t buildFuzzInput(char* data, size_t size) {
+  size_t length = 0;
+  while (length < size - 64) {
+    uint32_t choice = nextRandom() % 8;
+    if (choice < 3) {
+      const char* reply = sampleReplies[nextRandom() % (sizeof(sampleReplies) / sizeof(sampleReplies[0]))];
+      size_t n = strlen(reply);
+      memcpy(data + length, reply, n);
+      length += n;
+    } else {
+      size_t n = nextRandom() % (choice == 7 ? 60 : 160);
+      for (size_t i = 0; i < n && length < size - 64; i++) {
+        data[length++] = (char)(nextRandom() & 0xFF);
+      }
+      data[length++] = '\n';
+    }
+  }
+  return length;
+}
+
+static void benchParser() {
+  static char fuzz[1 << 16];
+  size_t size = buildFuzzInput(fuzz, sizeof(fuzz));
+  printParserResult("fuzzed", runParser(fuzz, size, BENCH_PARSER_BYTES));
+
+  static char replies[256];
+  size_t length = 0;
+  for (const char* reply : sampleReplies) {
+    size_t n = strlen(reply);
+    memcpy(replies + length, reply, n);
+    length += n;
+  }
+  printParserResult("replies", runParser(replies, length, BENCH_PARSER_BYTES));
+}
+
+static int benchParserFile(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return 1;
+  }
+  static char data[1 << 20];
+  size_t size = fread(data, 1, sizeof(data), file);
+  fclose(file);
+  if (size == 0) {
+    fprintf(stderr, "%s: empty\n", path);
+    return 1;
+  }
+  printParserResult("recorded", runParser(data, size, BENCH_PARSER_BYTES));
+  return 0;
+}
+
+// JSON ----------------------------------------------------------------------
+
+// Counts what would be sent instead of printing it
+class NullPrint : public Print {
+public:
+  size_t write(uint8_t) override { bytes++; return 1; }
+  size_t write(const uint8_t*, size_t size) override { bytes += size; return size; }
+  unsigned long bytes = 0;
+};
+
+// Keeps what is printed, for comparing the two ways of writing a record
+class BufferPrint : public Print {
+public:
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    if (size > sizeof(text) - length) size = sizeof(text) - length;
+    memcpy(text + length, buffer, size);
+    length += size;
+    return size;
+  }
+  char text[160];
+  size_t length = 0;
+};
+
+// The sample record of sendDataToPC() once warmed up, without a PM sensor or
+// heater cycle: the readings, then seq and time, from the same templates
+static const char JSON_SAMPLE[] PROGMEM = "{\"co\":" JSON_DECI ",\"methane\":" JSON_DECI ",\"airQuality\":" JSON_DECI;
+static const char JSON_SAMPLE_ID[] PROGMEM = ",\"seq\":" JSON_UINT ",\"time\":" JSON_UINT;
+static const char JSON_LINE_END[] PROGMEM = "}\r\n";
+
+static char* renderSample(char* line, const char* end, const int32_t* values) {
+  char* p = renderJson(line, end, JSON_SAMPLE, values);
+  p = renderJson(p, end, JSON_SAMPLE_ID, values + 3);
+  return renderJson(p, end, JSON_LINE_END, NULL);
+}
+
+// The same record through a chain of Print calls, as before the templates
+static void printSample(Print& out, const int32_t* values) {
+  out.print(F("{\"co\":"));
+  printDeci(out, values[0]);
+  out.print(F(",\"methane\":"));
+  printDeci(out, values[1]);
+  out.print(F(",\"airQuality\":"));
+  printDeci(out, values[2]);
+  out.print(F(",\"seq\":"));
+  out.print(values[3]);
+  out.print(F(",\"time\":"));
+  out.print(values[4]);
+  out.print(F("}\r\n"));
+}
+
+static void benchJson() {
+  static int32_t values[256][5];
+  for (auto& record : values) {
+    for (int32_t& value : record) value = nextRandom() % 100000;
+  }
+
+  NullPrint printed;
+  double start = nowSeconds();
+  for (unsigned long i = 0; i < BENCH_JSON_RECORDS; i++) {
+    printSample(printed, values[i & 0xFF]);
+  }
+  double printNs = (nowSeconds() - start) / BENCH_JSON_RECORDS * 1e9;
+
+  NullPrint rendered;
+  char line[160];
+  start = nowSeconds();
+  for (unsigned long i = 0; i < BENCH_JSON_RECORDS; i++) {
+    char* end = renderSample(line, line + sizeof(line), values[i & 0xFF]);
+    rendered.write((const uint8_t*)line, end - line);
+  }
+  double templateNs = (nowSeconds() - start) / BENCH_JSON_RECORDS * 1e9;
+
+  // Both must write the same bytes, record by record
+  bool same = printed.bytes == rendered.bytes;
+  for (auto& record : values) {
+    BufferPrint expected;
+    printSample(expected, record);
+    char* end = renderSample(line, line + sizeof(line), record);
+    if ((size_t)(end - line) != expected.length || memcmp(line, expected.text, expected.length) != 0) same = false;
+  }
+
+  printf("%-12s %12s %12s %10s\n", "json", "print ns", "template ns", "bytes");
+  printf("%-12s %12.1f %12.1f %10s\n", "sample", printNs, templateNs, same ? "same" : "DIFFER");
+}
+
+// Replay --------------------------------------------------------------------
+
+// MQ heater warm-up: every channel settles from a high start with some noise
+static bool syntheticScan(unsigned long index, uint16_t* raw) {
+  static const uint16_t settled[3] = { 40, 255, 220 };
+  static const uint16_t initial[3] = { 180, 520, 480 };
+  if (index >= BENCH_SYNTHETIC_SCANS) return false;
+
+  double t = (double)index / ADC_SCAN_RATE_HZ;
+  for (uint8_t i = 0; i < 3; i++) {
+    double value = settled[i] + (initial[i] - settled[i]) * exp(-t / (8.0 + 4 * i));
+    raw[i] = (uint16_t)constrain(value + (int)(nextRandom() % 7) - 3, 0.0, 1023.0);
+  }
+  return true;
+}
+
+static bool traceScan(FILE* trace, uint16_t* raw) {
+  unsigned int mq7, mq135, mq4;
+  char line[64];
+  while (fgets(line, sizeof(line), trace) != NULL) {
+    if (sscanf(line, "%u,%u,%u", &mq7, &mq135, &mq4) == 3) {
+      raw[0] = mq7;
+      raw[1] = mq135;
+      raw[2] = mq4;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int replay(const char* path) {
+  FILE* trace = NULL;
+  if (path != NULL && (trace = fopen(path, "r")) == NULL) {
+    perror(path);
+    return 1;
+  }
+
+  // Same filters and order (GasSensor, the ADC scan order) as the GAS_CHANNELS table in arduinoCode.cpp
+  SensorFilter filters[3] = {
+    SensorFilter(FILTER_OVERSAMPLE_LOG2, FILTER_MODE, FILTER_EMA_SHIFT),
+    SensorFilter(FILTER_OVERSAMPLE_LOG2, FILTER_MODE, FILTER_EMA_SHIFT),
+    SensorFilter(FILTER_OVERSAMPLE_LOG2, FILTER_MODE, FILTER_EMA_SHIFT),
+  };
+  WarmupMonitor warmup;
+  warmup.begin(0);
+
+  printf("timeMs,co,ch4,airQuality,warming,stability\n");
+  unsigned long scans = 0;
+  uint32_t nextRead = BENCH_SENSOR_INTERVAL;
+  uint16_t raw[3];
+  double start = nowSeconds();
+  while (trace != NULL ? traceScan(trace, raw) : syntheticScan(scans, raw)) {
+    hostMillis = scans * 1000UL / ADC_SCAN_RATE_HZ;
+    scans++;
+    for (uint8_t i = 0; i < 3; i++) {
+      filters[i].push(raw[i]);
+    }
+    if ((int32_t)(hostMillis - nextRead) < 0) continue;
+    nextRead += BENCH_SENSOR_INTERVAL;
+
+    // Same steps as readSensors()
+    GasReadings readings = convertReadings(filters[0].value(), filters[1].value(), filters[2].value());
+    uint16_t filtered[3] = { filters[0].value(), filters[1].value(), filters[2].value() };
+    warmup.update(filtered, 3, hostMillis);
+
+    printf("%lu,", (unsigned long)hostMillis);
+    printPpm(out, readings.co);
+    out.print(',');
+    printPpm(out, readings.ch4);
+    out.print(',');
+    printPpm(out, readings.airQuality);
+    printf(",%d,%u\n", warmup.warming() ? 1 : 0, warmup.stability());
+  }
+  double seconds = nowSeconds() - start;
+  if (trace != NULL) fclose(trace);
+
+  fprintf(stderr, "replayed %lu scans (%.1f s of sampling) in %.1f ms, %.1f ns/scan\n", scans,
+          (double)scans / ADC_SCAN_RATE_HZ, seconds * 1e3, scans > 0 ? seconds / scans * 1e9 : 0.0);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && strcmp(argv[1], "replay") == 0) {
+    return replay(argc >= 3 ? argv[2] : NULL);
+  }
+  if (argc >= 3 && strcmp(argv[1], "parse") == 0) {
+    return benchParserFile(argv[2]);
+  }
+  if (argc != 1) {
+    fprintf(stderr, "usage: %s [parse <replies> | replay [trace.csv]]\n", argv[0]);
+    return 2;
+  }
+
+  printf("FIXED_POINT_MATH=%d FILTER_MODE=%d\n\n", FIXED_POINT_MATH, FILTER_MODE);
+  benchConversion();
+  printf("\n");
+  benchParser();
+  printf("\n");
+  benchJson();
+  return 0;
+}
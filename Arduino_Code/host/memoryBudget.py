@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+# RAM and flash budget per subsystem from the avr-ld map of a firmware build.
+#
+# Get a map by adding this line to the AVR core's platform.local.txt (next to
+# its platform.txt) and building with "Show verbose output during compilation"
+# to see the build folder:
+#   compiler.c.elf.extra_flags=-Wl,-Map,{build.path}/{build.project_name}.map
+#
+#   python3 host/memoryBudget.py arduinoCode.cpp.map
+#   python3 host/memoryBudget.py --min-stack 1536 --budget rollingStats=1400 --budget txQueue=300 build.map
+#
+# The core builds with -ffunction-sections -fdata-sections, so the map has an
+# input section per variable and function and sizes are counted per symbol.
+# Symbols of a module are charged to it; the sketch's own globals (rolling,
+# batch, txQueue, jsonLine, the task table, ...) are charged to the subsystem
+# that SUBSYSTEMS below gives them, falling back to the sketch itself. Names
+# are demangled with avr-c++filt or c++filt when one is on the PATH. Each
+# library is one more subsystem; the Arduino core and the C runtime are
+# grouped as "core" and "libc". --symbols lists every symbol.
+#
+# Flash counts code, PROGMEM tables and the initial values of .data; RAM
+# counts .data, .bss and .noinit. What is left of the 8 KB between the end of
+# .noinit and the top of SRAM is shared by the heap and the stack: with
+# STATIC_ALLOCATION the heap is an arena in .bss and already counted,
+# otherwise pass its size with --heap (1026 bytes with the 128x64 display).
+# The exit status is 1 when the stack would get less than --min-stack bytes
+# or a --budget is exceeded, so the script can gate a build.
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+from collections import defaultdict
+
+MEGA_RAM = 8192
+MEGA_FLASH = 256 * 1024 - 8 * 1024  # Less the bootloader
+SKETCH = "arduinoCode"
+
+# Sketch symbols by subsystem, first match wins. The pattern is searched in
+# the demangled name without its argument list; add an entry with every new
+# global in the sketch, or it is charged to the sketch itself.
+SUBSYSTEMS = [
+    ("rollingStats", r"^rolling$|RollingStats|Summary"),
+    ("batchBuffer", r"^batch|BatchBuffer|Batch|^pendingRecords$|^burstSize$|BufferedRecords"),
+    ("txQueue", r"^txQueue$|^txFrame$|TxQueue"),
+    ("jsonTemplate", r"^jsonLine$|^JSON_|renderJson"),
+    ("commandParser", r"^commandParser$|CommandParser|^command[A-Z]|^CMD_|^commands$|receiveFromServer"),
+    ("taskScheduler", r"^tasks$|^TASK_"),
+    ("oledRenderer", r"^display|^oled|OledRenderer|Adafruit|^FIELD_|updateDisplay"),
+    ("aqiEngine", r"^aqi|History$|HourlyAverage|airQualityMessage|^hostAqi"),
+    ("calibrationStore", r"^calibration|Calibration"),
+    ("changeReporter", r"^report|ChangeReporter|^reporter$"),
+    ("sensorChannel", r"Channel|^SENSOR_|^MQ\d+_PIN$|^warmup$|^coCounts|^coValid$"),
+    ("heaterCycle", r"^heater$|HeaterCycle"),
+    ("pmsSensor", r"^pm[A-Z0-9]"),
+    ("sdLog", r"^log[A-Z]|Log$"),
+    ("recovery", r"[Ss]napshot|^printBoot$"),
+    ("serialProtocol", r"[Bb]aud|^protocolMode$|^sampleSeq$|Frame$|^rxFullCount$"),
+]
+
+# " .bss.rolling  0x00800300  0x3c0 /path/arduinoCode.cpp.o", the name may be
+# on a line of its own with the address and size on the next one
+SECTION = re.compile(r"^ (\S+)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*))?$")
+CONTINUATION = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+ARCHIVE = re.compile(r"^(.*)\((.*)\)$")
+
+
+def kind(section):
+    if section.startswith((".text", ".progmem", ".init", ".fini", ".vectors", ".trampolines", ".ctors", ".dtors", ".jumptables", ".lowtext")):
+        return "text"
+    if section.startswith((".data", ".rodata")):
+        return "data"
+    if section.startswith((".bss", ".noinit", "COMMON")):
+        return "bss"
+    return None
+
+
+def module(path):
+    archive = ARCHIVE.match(path)
+    if archive:
+        name = os.path.basename(archive.group(1))
+        if name in ("libc.a", "libm.a", "libgcc.a") or name.startswith("libprintf"):
+            return "libc"
+        if name == "core.a":
+            return "core"
+        return re.sub(r"^lib|\.a$", "", name)
+    parts = path.replace("\\", "/").split("/")
+    if "libraries" in parts[:-1]:
+        return parts[parts.index("libraries") + 1]
+    if "core" in parts[:-1]:
+        return "core"
+    name = parts[-1]
+    if name.startswith("crt"):
+        return "libc"
+    for suffix in (".ino.cpp.o", ".cpp.o", ".c.o", ".S.o", ".o"):
+        if name.endswith(suffix):
+            return name[: -len(suffix)]
+    return name
+
+
+def symbol(section):
+    # ".bss.rolling" -> "rolling", ".text._ZN7TxQueue5writeEh" -> "_ZN7TxQueue5writeEh"
+    for prefix in (".text.", ".data.", ".rodata.", ".bss.", ".noinit.", ".progmem.data."):
+        if section.startswith(prefix):
+            return section[len(prefix):]
+    return None
+
+
+def demangle(names):
+    tool = shutil.which("avr-c++filt") or shutil.which("c++filt")
+    if not tool or not names:
+        return {name: name for name in names}
+    result = subprocess.run([tool], input="\n".join(names), capture_output=True, text=True)
+    lines = result.stdout.splitlines()
+    if result.returncode != 0 or len(lines) != len(names):
+        return {name: name for name in names}
+    return dict(zip(names, lines))
+
+
+def subsystem(owner, name):
+    if owner != SKETCH or name is None:
+        return owner
+    base = re.sub(r"\(.*$", "", name)
+    if base.startswith("vtable for "):
+        base = base[len("vtable for "):]
+    for system, pattern in SUBSYSTEMS:
+        if re.search(pattern, base):
+            return system
+    return owner
+
+
+def parse(lines):
+    entries = []  # (section, size, object path)
+    in_map = False
+    pending = None
+    for line in lines:
+        line = line.rstrip("\n")
+        if not in_map:
+            in_map = line.startswith("Linker script and memory map")
+            continue
+        if pending is not None:
+            section, pending = pending, None
+            match = CONTINUATION.match(line)
+            if match:
+                entries.append((section, int(match.group(2), 16), match.group(3).strip()))
+                continue
+        match = SECTION.match(line)
+        if not match or match.group(1) == "*fill*":
+            continue
+        section = match.group(1)
+        if match.group(2) is None:
+            if kind(section):
+                pending = section
+        else:
+            entries.append((section, int(match.group(3), 16), match.group(4).strip()))
+    if not in_map:
+        sys.exit("no memory map in the input, was the map written with -Wl,-Map?")
+    return entries
+
+
+def tally(entries):
+    sizes = defaultdict(lambda: {"text": 0, "data": 0, "bss": 0})
+    symbols = []
+    names = demangle(sorted({symbol(section) for section, _, _ in entries if symbol(section)}))
+    for section, size, path in entries:
+        what = kind(section)
+        if not what or not size:
+            continue
+        raw = symbol(section)
+        name = names.get(raw, raw) if raw else None
+        system = subsystem(module(path), name)
+        sizes[system][what] += size
+        symbols.append((system, what, size, name or section))
+    return sizes, symbols
+
+
+def main():
+    parser = argparse.ArgumentParser(description="RAM and flash budget per subsystem from a linker map")
+    parser.add_argument("map", help="linker map file, - for stdin")
+    parser.add_argument("--ram", type=int, default=MEGA_RAM)
+    parser.add_argument("--flash", type=int, default=MEGA_FLASH)
+    parser.add_argument("--heap", type=int, default=0, help="heap bytes not in the map")
+    parser.add_argument("--min-stack", type=int, default=1024, help="least free SRAM left for the stack")
+    parser.add_argument("--budget", action="append", default=[], metavar="NAME=BYTES", help="RAM limit of one subsystem")
+    parser.add_argument("--symbols", action="store_true", help="list the symbols of every subsystem")
+    args = parser.parse_args()
+
+    with (sys.stdin if args.map == "-" else open(args.map)) as f:
+        sizes, symbols = tally(parse(f))
+
+    if args.symbols:
+        for system, what, size, name in sorted(symbols, key=lambda entry: (entry[0], entry[1], -entry[2])):
+            print(f"{system:<20} {what:<5} {size:>6} {name}")
+        print()
+
+    print(f"{'subsystem':<20} {'flash':>7} {'data':>6} {'bss':>6} {'ram':>6}")
+    total_flash = total_ram = 0
+    for name, s in sorted(sizes.items(), key=lambda item: (-(item[1]["data"] + item[1]["bss"]), -item[1]["text"])):
+        flash = s["text"] + s["data"]
+        ram = s["data"] + s["bss"]
+        total_flash += flash
+        total_ram += ram
+        print(f"{name:<20} {flash:>7} {s['data']:>6} {s['bss']:>6} {ram:>6}")
+    stack = args.ram - total_ram - args.heap
+    print(f"{'total':<20} {total_flash:>7} {'':>6} {'':>6} {total_ram:>6}")
+    print(f"flash {total_flash}/{args.flash} ({100 * total_flash // args.flash}%), "
+          f"ram {total_ram}/{args.ram}, heap {args.heap}, left for the stack {stack}")
+
+    ok = True
+    if stack < args.min_stack:
+        print(f"stack: {stack} bytes, below the {args.min_stack} byte minimum", file=sys.stderr)
+        ok = False
+    for budget in args.budget:
+        name, _, limit = budget.partition("=")
+        ram = sizes[name]["data"] + sizes[name]["bss"] if name in sizes else 0
+        if ram > int(limit):
+            print(f"{name}: {ram} bytes of RAM, over its {limit} byte budget", file=sys.stderr)
+            ok = False
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,60 @@
+#include "jsonTemplate.h"
+
+static const uint32_t powersOfTen[] PROGMEM = {
+  1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL, 10000UL, 1000UL, 100UL, 10UL,
+};
+
+char* writeDecimal(char* out, uint32_t value) {
+  bool started = false;
+  for (uint8_t i = 0; i < sizeof(powersOfTen) / sizeof(powersOfTen[0]); i++) {
+    uint32_t power = pgm_read_dword(&powersOfTen[i]);
+    char digit = '0';
+    while (value >= power) {
+      value -= power;
+      digit++;
+    }
+    if (started || digit != '0') {
+      *out++ = digit;
+      started = true;
+    }
+  }
+  *out++ = '0' + value;
+  return out;
+}
+
+char* writeDeci(char* out, int32_t tenths) {
+  uint32_t magnitude = tenths;
+  if (tenths < 0) {
+    *out++ = '-';
+    magnitude = -(uint32_t)tenths;
+  }
+  // Write all digits, then move the last one behind a decimal point
+  char* digits = out;
+  out = writeDecimal(out, magnitude);
+  if (out - digits == 1) {
+    digits[1] = digits[0];
+    digits[0] = '0';
+    out++;
+  }
+  char last = out[-1];
+  out[-1] = '.';
+  *out++ = last;
+  return out;
+}
+
+char* renderJson(char* out, const char* end, PGM_P tmpl, const int32_t* values) {
+  for (;;) {
+    char c = pgm_read_byte(tmpl++);
+    if (c == '\0') return out;
+
+    if (c == JSON_SLOT_DECI || c == JSON_SLOT_UINT) {
+      if (end - out < JSON_SLOT_MAX_SIZE) return out;
+      int32_t value = *values++;
+      out = c == JSON_SLOT_DECI ? writeDeci(out, value) : writeDecimal(out, (uint32_t)value);
+      continue;
+    }
+
+    if (out >= end) return out;
+    *out++ = c;
+  }
+}
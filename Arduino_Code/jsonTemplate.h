@@ -0,0 +1,34 @@
+#ifndef JSON_TEMPLATE_H
+#define JSON_TEMPLATE_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// Template-based JSON rendering into a RAM buffer, integer math only.
+//
+// A template is a PROGMEM string holding the constant keys and punctuation,
+// with a marker byte where each value goes. renderJson() copies it into the
+// buffer and writes the values in order into the slots, so a whole record
+// costs one pass over the template and a single write of the result instead
+// of a chain of Print calls. Numbers are converted by subtracting powers of
+// ten, with no 32-bit division and no float formatting.
+#define JSON_SLOT_DECI '\x01'  // Signed tenths, written with one decimal: 123 -> 12.3
+#define JSON_SLOT_UINT '\x02'  // Unsigned integer, the value's bits read as uint32_t
+#define JSON_SLOT_MAX_SIZE 12  // "-214748364.8"
+
+// The markers as strings, for building templates: "{\"co\":" JSON_DECI "}"
+#define JSON_DECI "\x01"
+#define JSON_UINT "\x02"
+
+// Write an unsigned integer, returns the end (not NUL-terminated)
+char* writeDecimal(char* out, uint32_t value);
+
+// Write a value in tenths with one decimal, returns the end
+char* writeDeci(char* out, int32_t tenths);
+
+// Render tmpl with values into out, stopping before end. Returns the end of
+// the rendered text (not NUL-terminated); a template that does not fit is cut
+// short, so make the buffer large enough for the longest values.
+char* renderJson(char* out, const char* end, PGM_P tmpl, const int32_t* values);
+
+#endif
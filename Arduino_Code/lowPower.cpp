@@ -0,0 +1,65 @@
+#include <Arduino.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+
+#include "config.h"
+#include "lowPower.h"
+
+static uint32_t idleMs = 0;
+static uint16_t idleMicros = 0;  // Remainder below 1 ms
+static uint32_t statsStart = 0;
+
+void powerBegin() {
+  // Unused by the board: Timer3/4 and USART3, plus SPI, Serial1, Timer2 and
+  // USART2 when the SD log, bus, heater cycling and PM sensor are built out
+#if !SD_LOG
+  power_spi_disable();
+#endif
+  power_timer3_disable();
+  power_timer4_disable();
+#if !PM_SENSOR
+  power_usart2_disable();
+#endif
+  power_usart3_disable();
+#if !BUS_MODE
+  power_usart1_disable();
+#endif
+#if !MQ7_HEATER_CYCLE
+  power_timer2_disable();
+#endif
+  ACSR |= _BV(ACD);  // Analog comparator off
+
+  powerResetStats();
+}
+
+void powerIdle() {
+  uint32_t start = micros();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  // The instruction after sei always runs before a pending interrupt, so
+  // nothing can slip in between the caller's check and the sleep
+  sei();
+  sleep_cpu();
+  sleep_disable();
+
+  uint32_t slept = micros() - start + idleMicros;
+  idleMs += slept / 1000;
+  idleMicros = slept % 1000;
+}
+
+uint32_t powerIdleMs() {
+  return idleMs;
+}
+
+uint8_t powerIdlePercent() {
+  uint32_t elapsed = millis() - statsStart;
+  if (elapsed < 100) return 0;
+  uint32_t percent = idleMs / (elapsed / 100);
+  return percent > 100 ? 100 : percent;
+}
+
+void powerResetStats() {
+  idleMs = 0;
+  idleMicros = 0;
+  statsStart = millis();
+}
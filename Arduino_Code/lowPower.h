@@ -0,0 +1,32 @@
+#ifndef LOW_POWER_H
+#define LOW_POWER_H
+
+#include <stdint.h>
+
+// Idle sleep between scheduler passes (LOW_POWER_IDLE).
+//
+// All the work that runs on every pass is fed by interrupts: the ADC ISR
+// fills the scan ring, the UART ISRs fill the serial buffers and the Timer0
+// tick advances millis() for the periodic tasks. Once a pass has handled
+// everything pending the CPU can stop until the next of those interrupts.
+// SLEEP_MODE_IDLE keeps clkIO running, so the timers, the ADC and the UARTs
+// carry on and a received byte wakes the CPU within a few cycles. Deeper
+// modes such as SLEEP_MODE_ADC would stop Timer0 and the UART receivers.
+
+// Switch off the clocks of peripherals the firmware never uses
+void powerBegin();
+
+// Sleep until the next interrupt. Call with interrupts disabled, after
+// checking that no work is pending; interrupts are enabled on return. An
+// interrupt that arrived after the check wakes the CPU straight away.
+void powerIdle();
+
+// Time spent asleep since the last reset, in ms
+uint32_t powerIdleMs();
+
+// Idle share of the time since the last reset, in percent
+uint8_t powerIdlePercent();
+
+void powerResetStats();
+
+#endif
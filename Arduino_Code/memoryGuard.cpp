@@ -0,0 +1,44 @@
+#include <Arduino.h>
+#include <stdlib.h>
+
+#include "memoryGuard.h"
+
+extern char __heap_start;
+extern char* __brkval;
+extern char* __malloc_heap_start;
+extern char* __malloc_heap_end;
+
+#if STATIC_ALLOCATION
+static char heapArena[MEMORY_HEAP_SIZE];
+#endif
+
+void memoryBegin() {
+#if STATIC_ALLOCATION
+  __malloc_heap_start = heapArena;
+  __malloc_heap_end = heapArena + sizeof(heapArena);
+#endif
+}
+
+void memoryLock() {
+#if STATIC_ALLOCATION
+  // Blocks already handed out stay valid, nothing new fits
+  __malloc_heap_end = __brkval != 0 ? __brkval : __malloc_heap_start;
+#endif
+}
+
+char* memoryFreeStart() {
+  // With the arena __brkval lies inside .bss, below __heap_start
+  return __brkval > &__heap_start ? __brkval : &__heap_start;
+}
+
+uint16_t memoryHeapUsed() {
+  return __brkval != 0 ? __brkval - __malloc_heap_start : 0;
+}
+
+bool memoryGuardIntact() {
+  const char* p = memoryFreeStart();
+  for (uint8_t i = 0; i < MEMORY_GUARD_SIZE; i++) {
+    if (p[i] != (char)MEMORY_PAINT) return false;
+  }
+  return true;
+}
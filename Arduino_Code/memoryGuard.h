@@ -0,0 +1,37 @@
+#ifndef MEMORY_GUARD_H
+#define MEMORY_GUARD_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+// Heap discipline and the stack guard.
+//
+// The only heap user is the SSD1306 driver, which mallocs its frame buffer
+// in display.begin(). With STATIC_ALLOCATION the heap is a fixed arena of
+// MEMORY_HEAP_SIZE bytes in .bss, so it is counted in the linker map (see
+// host/memoryBudget.py) and can never grow toward the stack; memoryLock()
+// at the end of setup() closes it and any later malloc() returns NULL.
+//
+// Either way the lowest MEMORY_GUARD_SIZE bytes of free SRAM, painted at
+// boot with MEMORY_PAINT, are watched: the stack only reaches them just
+// before it would run into the heap or .bss.
+#define MEMORY_PAINT 0xC5
+#define MEMORY_GUARD_SIZE 16
+
+// Point malloc() at the arena; first thing in setup(), before any allocation
+void memoryBegin();
+
+// No more heap allocations from here on (STATIC_ALLOCATION)
+void memoryLock();
+
+// Bottom of the free SRAM between the heap (or .bss) and the stack
+char* memoryFreeStart();
+
+// Heap bytes handed out so far, including malloc's headers
+uint16_t memoryHeapUsed();
+
+// False once the stack has overwritten the guard bytes
+bool memoryGuardIntact();
+
+#endif
@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "oledRenderer.h"
+
+#define OLED_CHAR_WIDTH 6   // 5x7 font plus spacing
+#define OLED_CHAR_HEIGHT 8
+#define OLED_DATA_PREFIX 0x40
+
+OledRenderer::OledRenderer(Adafruit_SSD1306& display, uint8_t address)
+    : display(display), address(address), fields(NULL), fieldCount(0),
+      poweredOn(true), dirty(false), flushBytes(0) {}
+
+void OledRenderer::begin(const OledField* layout, uint8_t count) {
+  fields = layout;
+  fieldCount = count > OLED_MAX_FIELDS ? OLED_MAX_FIELDS : count;
+  for (uint8_t i = 0; i < fieldCount; i++) {
+    shown[i][0] = '\0';
+  }
+
+  // One full push to get the panel in sync with the framebuffer
+  display.display();
+  dirty = false;
+  flushBytes = display.width() * display.height() / 8;
+}
+
+void OledRenderer::markDirty(int16_t x0, int16_t y0, int16_t x1, int16_t y1) {
+  if (x0 < 0) x0 = 0;
+  if (y0 < 0) y0 = 0;
+  if (x1 > display.width() - 1) x1 = display.width() - 1;
+  if (y1 > display.height() - 1) y1 = display.height() - 1;
+  if (x1 < x0 || y1 < y0) return;
+
+  if (!dirty) {
+    dirtyX0 = x0;
+    dirtyY0 = y0;
+    dirtyX1 = x1;
+    dirtyY1 = y1;
+    dirty = true;
+    return;
+  }
+  if (x0 < dirtyX0) dirtyX0 = x0;
+  if (y0 < dirtyY0) dirtyY0 = y0;
+  if (x1 > dirtyX1) dirtyX1 = x1;
+  if (y1 > dirtyY1) dirtyY1 = y1;
+}
+
+void OledRenderer::setField(uint8_t field, const char* text) {
+  if (field >= fieldCount) return;
+  char* current = shown[field];
+  if (strncmp(current, text, OLED_FIELD_TEXT_SIZE - 1) == 0) return;
+
+  const OledField& layout = fields[field];
+  uint8_t oldLength = strlen(current);
+  strncpy(current, text, OLED_FIELD_TEXT_SIZE - 1);
+  current[OLED_FIELD_TEXT_SIZE - 1] = '\0';
+  uint8_t newLength = strlen(current);
+
+  // Blank whatever the old or new text covers, then draw the new text
+  uint8_t length = oldLength > newLength ? oldLength : newLength;
+  int16_t width = length * OLED_CHAR_WIDTH * layout.textSize;
+  int16_t height = OLED_CHAR_HEIGHT * layout.textSize;
+  display.fillRect(layout.x, layout.y, width, height, SSD1306_BLACK);
+  display.setTextSize(layout.textSize);
+  display.setCursor(layout.x, layout.y);
+  display.print(current);
+
+  markDirty(layout.x, layout.y, layout.x + width - 1, layout.y + height - 1);
+}
+
+void OledRenderer::flush() {
+  flushBytes = 0;
+  if (!dirty || !poweredOn) return;
+
+  uint8_t page0 = dirtyY0 / 8;
+  uint8_t page1 = dirtyY1 / 8;
+
+  // Restrict the panel's write window to the dirty pages and columns; in
+  // horizontal addressing mode the data then wraps inside that window
+  display.ssd1306_command(SSD1306_PAGEADDR);
+  display.ssd1306_command(page0);
+  display.ssd1306_command(page1);
+  display.ssd1306_command(SSD1306_COLUMNADDR);
+  display.ssd1306_command(dirtyX0);
+  display.ssd1306_command(dirtyX1);
+
+  const uint8_t* buffer = display.getBuffer();
+  uint8_t chunk = 0;
+  for (uint8_t page = page0; page <= page1; page++) {
+    const uint8_t* row = buffer + page * display.width();
+    for (int16_t x = dirtyX0; x <= dirtyX1; x++) {
+      if (chunk == 0) {
+        Wire.beginTransmission(address);
+        Wire.write((uint8_t)OLED_DATA_PREFIX);
+        chunk = 1;
+      }
+      Wire.write(row[x]);
+      flushBytes++;
+      if (++chunk >= BUFFER_LENGTH) {
+        Wire.endTransmission();
+        chunk = 0;
+      }
+    }
+  }
+  if (chunk > 0) Wire.endTransmission();
+
+  dirty = false;
+}
+
+void OledRenderer::setPower(bool on) {
+  if (on == poweredOn) return;
+  poweredOn = on;
+  // The panel keeps its RAM while off, so waking it only needs what changed
+  display.ssd1306_command(on ? SSD1306_DISPLAYON : SSD1306_DISPLAYOFF);
+  if (on) flush();
+}
@@ -0,0 +1,58 @@
+#ifndef OLED_RENDERER_H
+#define OLED_RENDERER_H
+
+#include <Adafruit_SSD1306.h>
+
+// Change-only renderer for the SSD1306.
+//
+// The screen is split into text fields. setField() compares the new text with
+// what is already on screen and only redraws a field that changed, growing a
+// dirty rectangle. flush() then pushes just the SSD1306 pages and columns
+// inside that rectangle instead of the whole 1 KB framebuffer.
+#define OLED_MAX_FIELDS 6
+#define OLED_FIELD_TEXT_SIZE 22  // 21 columns at text size 1
+
+struct OledField {
+  int16_t x;
+  int16_t y;
+  uint8_t textSize;
+};
+
+class OledRenderer {
+public:
+  OledRenderer(Adafruit_SSD1306& display, uint8_t address);
+
+  // Clear the screen, draw any static text with the display API, then call
+  // begin() to push it and start tracking the given fields
+  void begin(const OledField* fields, uint8_t count);
+
+  // Redraw field if its text changed
+  void setField(uint8_t field, const char* text);
+
+  // Push the dirty region to the panel. While the panel is off nothing is
+  // sent and changes accumulate until it is switched back on.
+  void flush();
+
+  // Switch the panel on or off, the framebuffer is kept either way
+  void setPower(bool on);
+  bool powered() const { return poweredOn; }
+
+  // Bytes sent by the last flush(), for checking the savings
+  uint16_t lastFlushBytes() const { return flushBytes; }
+
+private:
+  void markDirty(int16_t x0, int16_t y0, int16_t x1, int16_t y1);
+
+  Adafruit_SSD1306& display;
+  uint8_t address;
+  const OledField* fields;
+  uint8_t fieldCount;
+  char shown[OLED_MAX_FIELDS][OLED_FIELD_TEXT_SIZE];
+
+  bool poweredOn;
+  bool dirty;
+  int16_t dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+  uint16_t flushBytes;
+};
+
+#endif
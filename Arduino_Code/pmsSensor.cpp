@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include <avr/power.h>
+
+#include "config.h"
+#include "pmsSensor.h"
+#include "ringBuffer.h"
+#include "serialProtocol.h"
+
+// Built out without the sensor, the ISR would claim USART2 for nothing
+#if PM_SENSOR
+
+#define PMS_START1 0x42
+#define PMS_START2 0x4D
+#define PMS_NO_FRAME 0xFF
+
+static uint8_t frames[2][PMS_FRAME_SIZE];
+static volatile uint8_t readyFrame = PMS_NO_FRAME;  // Buffer handed to pmsRead(), written by both sides in turn
+static uint8_t fillFrame = 0;                       // ISR only
+static uint8_t fillPos = 0;                         // ISR only
+static volatile uint16_t lineErrors = 0;
+static volatile uint16_t droppedFrames = 0;
+static uint16_t checksumErrors = 0;
+
+void pmsBegin() {
+  power_usart2_enable();
+  UBRR2 = F_CPU / 8 / PMS_BAUD - 1;  // Double speed mode, 0.2% error at 16 MHz
+  UCSR2A = _BV(U2X2);
+  UCSR2C = _BV(UCSZ21) | _BV(UCSZ20);  // 8N1
+  UCSR2B = _BV(RXEN2) | _BV(RXCIE2);
+}
+
+static uint16_t readWord(const uint8_t* frame, uint8_t offset) {
+  return ((uint16_t)frame[offset] << 8) | frame[offset + 1];
+}
+
+bool pmsRead(PmsReading& reading) {
+  uint8_t index = readyFrame;
+  if (index == PMS_NO_FRAME) return false;
+
+  // The ISR fills the other buffer until this one is released
+  const uint8_t* frame = frames[index];
+  uint16_t sum = 0;
+  for (uint8_t i = 0; i < PMS_FRAME_SIZE - 2; i++) sum += frame[i];
+  bool valid = sum == readWord(frame, PMS_FRAME_SIZE - 2) && readWord(frame, 2) == PMS_FRAME_SIZE - 4;
+  if (valid) {
+    reading.pm1 = readWord(frame, 10);
+    reading.pm25 = readWord(frame, 12);
+    reading.pm10 = readWord(frame, 14);
+    for (uint8_t i = 0; i < PMS_COUNT_BINS; i++) reading.counts[i] = readWord(frame, 16 + 2 * i);
+  } else {
+    checksumErrors++;
+  }
+
+  RING_BARRIER();
+  readyFrame = PMS_NO_FRAME;
+  return valid;
+}
+
+static uint8_t* putWord(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+  return out + 2;
+}
+
+uint8_t pmsEncodePayload(uint8_t* out, const PmsReading& reading) {
+  uint8_t* p = putWord(out, reading.pm1);
+  p = putWord(p, reading.pm25);
+  p = putWord(p, reading.pm10);
+  for (uint8_t i = 0; i < PMS_COUNT_BINS; i++) p = putWord(p, reading.counts[i]);
+  return p - out;
+}
+
+bool pmsPending() {
+  return readyFrame != PMS_NO_FRAME;
+}
+
+uint16_t pmsChecksumErrors() {
+  return checksumErrors;
+}
+
+uint16_t pmsLineErrors() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t count = lineErrors;
+  SREG = oldSREG;
+  return count;
+}
+
+uint16_t pmsDroppedFrames() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t count = droppedFrames;
+  SREG = oldSREG;
+  return count;
+}
+
+ISR(USART2_RX_vect) {
+  uint8_t status = UCSR2A;
+  uint8_t data = UDR2;
+  if (status & (_BV(FE2) | _BV(DOR2) | _BV(UPE2))) {
+    lineErrors++;
+    fillPos = 0;
+    return;
+  }
+
+  // Hunt for the two start bytes, anything else before them is noise
+  if (fillPos == 0 && data != PMS_START1) return;
+  if (fillPos == 1 && data != PMS_START2) {
+    fillPos = data == PMS_START1 ? 1 : 0;
+    return;
+  }
+  frames[fillFrame][fillPos] = data;
+  if (++fillPos < PMS_FRAME_SIZE) return;
+
+  fillPos = 0;
+  if (readyFrame != PMS_NO_FRAME) {
+    // pmsRead() still holds the other buffer, the next frame reuses this one
+    droppedFrames++;
+    return;
+  }
+  readyFrame = fillFrame;
+  fillFrame ^= 1;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef PMS_SENSOR_H
+#define PMS_SENSOR_H
+
+#include <stdint.h>
+
+// Plantower PMS5003 particulate sensor on USART2 (PM_SENSOR).
+//
+// In its default active mode the sensor sends a 32-byte frame every one to
+// two seconds at 9600 baud: 0x42 0x4D, a length of 28, thirteen big-endian
+// data words and a 16-bit sum of the preceding bytes. The USART2 receive
+// interrupt assembles frames straight into one of two frame buffers, with
+// no byte ring in between; once a frame is complete the buffers swap and
+// pmsRead() checks and decodes the finished one in place while the next is
+// being received. Only RX2 (pin 17) is used, the sensor's TX goes there.
+#define PMS_FRAME_SIZE 32
+#define PMS_BAUD 9600
+#define PMS_COUNT_BINS 6
+
+struct PmsReading {
+  uint16_t pm1;   // Atmospheric concentrations, ug/m3
+  uint16_t pm25;
+  uint16_t pm10;
+  uint16_t counts[PMS_COUNT_BINS];  // Particles > 0.3, 0.5, 1, 2.5, 5, 10 um per 0.1 L
+};
+
+// Power up and configure USART2, frames are collected from here on
+void pmsBegin();
+
+// Decode the latest complete frame, false if none arrived or its checksum failed
+bool pmsRead(PmsReading& reading);
+
+// True if a complete frame is waiting for pmsRead()
+bool pmsPending();
+
+// Serialize a FRAME_TYPE_PM payload, see serialProtocol.h for the layout
+uint8_t pmsEncodePayload(uint8_t* out, const PmsReading& reading);
+
+uint16_t pmsChecksumErrors();
+uint16_t pmsLineErrors();     // Framing, parity or overrun errors on the line
+uint16_t pmsDroppedFrames();  // Frames overwritten before pmsRead() took them
+
+#endif
@@ -0,0 +1,300 @@
+#include <Arduino.h>
+
+#include "ppmConversion.h"
+#include "sensorChannel.h"
+#include "sensorFilter.h"
+
+// Compile-time math used to build the tables. C++11 constexpr functions are
+// limited to a single return statement, hence the recursive formulation.
+namespace {
+
+constexpr float LN2 = 0.69314718f;
+
+// ln(m) = 2 * atanh(t) with t = (m - 1) / (m + 1), for m in [1, 2)
+constexpr float atanhSeries(float t2, float power, int n) {
+  return n > 10 ? 0.0f : power / (2 * n + 1) + atanhSeries(t2, power * t2, n + 1);
+}
+
+constexpr float lnMantissa(float t) {
+  return 2.0f * t * atanhSeries(t * t, 1.0f, 0);
+}
+
+constexpr float constLn(float x) {
+  return x >= 2.0f ? constLn(x * 0.5f) + LN2
+       : x < 1.0f ? constLn(x * 2.0f) - LN2
+       : lnMantissa((x - 1.0f) / (x + 1.0f));
+}
+
+constexpr float square(float v) {
+  return v * v;
+}
+
+// Taylor series of exp(y), accurate for |y| <= 0.5
+constexpr float expSeries(float y, float term, int n) {
+  return n > 10 ? term : term + expSeries(y, term * y / (n + 1), n + 1);
+}
+
+constexpr float constExp(float y) {
+  return y > 0.5f ? square(constExp(y * 0.5f))
+       : y < -0.5f ? 1.0f / constExp(-y)
+       : expSeries(y, 1.0f, 0);
+}
+
+// Same Rs formula as the original per-sample conversion (10K load resistor)
+constexpr float loadResistance(float counts) {
+  return ((5.0f * 10.0f) / (counts * (5.0f / 1023.0f))) - 10.0f;
+}
+
+constexpr float curvePpm(float logRatio, float a, float b) {
+  return b * logRatio >= constLn(PPM_TABLE_MAX / a) ? PPM_TABLE_MAX : a * constExp(b * logRatio);
+}
+
+// ppm at an ADC count for ppm = a * (Rs/R0)^b
+constexpr float countsEntry(int counts, float a, float b, float r0) {
+  return counts == 0 ? 0.0f
+       : counts >= 1023 ? PPM_TABLE_MAX
+       : curvePpm(constLn(loadResistance(counts) / r0), a, b);
+}
+
+// ppm at table index i
+constexpr float tableEntry(int i, float a, float b, float r0) {
+  return countsEntry(i << PPM_TABLE_STEP_LOG2, a, b, r0);
+}
+
+}  // namespace
+
+#define PPM_ROW4(f, i) f(i), f(i + 1), f(i + 2), f(i + 3)
+#define PPM_ROW16(f, i) PPM_ROW4(f, i), PPM_ROW4(f, i + 4), PPM_ROW4(f, i + 8), PPM_ROW4(f, i + 12)
+#define PPM_ROW64(f, i) PPM_ROW16(f, i), PPM_ROW16(f, i + 16), PPM_ROW16(f, i + 32), PPM_ROW16(f, i + 48)
+#define PPM_ROW256(f, i) PPM_ROW64(f, i), PPM_ROW64(f, i + 64), PPM_ROW64(f, i + 128), PPM_ROW64(f, i + 192)
+#define PPM_TABLE(f) { PPM_ROW256(f, 0), f(256) }
+
+#define PPM_FINE_TABLE(f) { PPM_ROW16(f, 0), f(16) }
+
+static_assert(PPM_TABLE_SIZE == 257, "PPM_TABLE expands to 257 entries");
+static_assert(PPM_FINE_COUNTS == 16, "PPM_FINE_TABLE expands to 17 entries");
+
+// R0 is derived from the ratio in clean air, as in the original conversion
+#define MQ7_ENTRY(i) tableEntry(i, MQ7_CURVE_A, MQ7_CURVE_B, 10.0f * MQ7_RATIO_CLEAN_AIR)
+#define MQ7_FINE_ENTRY(counts) countsEntry(counts, MQ7_CURVE_A, MQ7_CURVE_B, 10.0f * MQ7_RATIO_CLEAN_AIR)
+#define MQ4_ENTRY(i) tableEntry(i, MQ4_CURVE_A, MQ4_CURVE_B, 10.0f * MQ4_RATIO_CLEAN_AIR)
+#define MQ135_ENTRY(i) tableEntry(i, MQ135_CURVE_A, MQ135_CURVE_B, 10.0f * MQ135_RATIO_CLEAN_AIR)
+
+// Integer builds store 0.1 ppm units, the table is still evaluated in float
+// by the compiler so no float code reaches the device
+#if FIXED_POINT_MATH
+typedef uint32_t TableEntry;
+#define TABLE_VALUE(ppm) ((TableEntry)((ppm) * 10.0f + 0.5f))
+#define readTableEntry(address) pgm_read_dword(address)
+#else
+typedef float TableEntry;
+#define TABLE_VALUE(ppm) (ppm)
+#define readTableEntry(address) pgm_read_float(address)
+#endif
+
+#define MQ7_VALUE(i) TABLE_VALUE(MQ7_ENTRY(i))
+#define MQ7_FINE_VALUE(counts) TABLE_VALUE(MQ7_FINE_ENTRY(counts))
+#define MQ4_VALUE(i) TABLE_VALUE(MQ4_ENTRY(i))
+#define MQ135_VALUE(i) TABLE_VALUE(MQ135_ENTRY(i))
+
+// constexpr makes a non-constant initializer a compile error instead of a
+// silent runtime write into flash
+static constexpr TableEntry coTable[PPM_TABLE_SIZE] PROGMEM = PPM_TABLE(MQ7_VALUE);
+static constexpr TableEntry coFineTable[PPM_FINE_COUNTS + 1] PROGMEM = PPM_FINE_TABLE(MQ7_FINE_VALUE);
+static constexpr TableEntry ch4Table[PPM_TABLE_SIZE] PROGMEM = PPM_TABLE(MQ4_VALUE);
+static constexpr TableEntry airQualityTable[PPM_TABLE_SIZE] PROGMEM = PPM_TABLE(MQ135_VALUE);
+
+#define PPM_TABLE_FRAC_BITS (FILTER_FRAC_BITS + PPM_TABLE_STEP_LOG2)
+
+// Calibration factor on the table values, see setCalibration()
+#if FIXED_POINT_MATH
+#define SCALE_ONE 65536UL  // Q16
+typedef uint32_t CalibrationScale;
+#else
+#define SCALE_ONE 1.0f
+typedef float CalibrationScale;
+#endif
+
+struct SensorCurve {
+  float r0;
+  float curveA;
+  CalibrationScale scale;
+};
+
+static SensorCurve curves[GAS_SENSOR_COUNT] = {
+  { 10.0f * MQ7_RATIO_CLEAN_AIR, MQ7_CURVE_A, SCALE_ONE },
+  { 10.0f * MQ135_RATIO_CLEAN_AIR, MQ135_CURVE_A, SCALE_ONE },
+  { 10.0f * MQ4_RATIO_CLEAN_AIR, MQ4_CURVE_A, SCALE_ONE },
+};
+
+// Linear interpolation between the two entries around a position with
+// fracBits fractional bits; the caller keeps it inside the table
+static ppm_t interpolate(const TableEntry* table, uint16_t position, uint8_t fracBits) {
+  uint16_t index = position >> fracBits;
+  uint8_t frac = position & ((1 << fracBits) - 1);
+  TableEntry low = readTableEntry(&table[index]);
+  TableEntry high = readTableEntry(&table[index + 1]);
+#if FIXED_POINT_MATH
+  // Tables are increasing, (high - low) * 63 stays well inside 32 bits
+  return low + (((high - low) * frac) >> fracBits);
+#else
+  return low + (high - low) * frac / (float)(1 << fracBits);
+#endif
+}
+
+// Value of the table around countsQ4, from the fine table below PPM_FINE_COUNTS when there is one
+static ppm_t lookupPpm(const TableEntry* table, const TableEntry* fine, uint16_t countsQ4) {
+  if (fine != NULL && countsQ4 < (PPM_FINE_COUNTS << FILTER_FRAC_BITS)) return interpolate(fine, countsQ4, FILTER_FRAC_BITS);
+  if ((countsQ4 >> PPM_TABLE_FRAC_BITS) >= PPM_TABLE_SIZE - 1) return readTableEntry(&table[PPM_TABLE_SIZE - 1]);
+  return interpolate(table, countsQ4, PPM_TABLE_FRAC_BITS);
+}
+
+static ppm_t calibratedPpm(const TableEntry* table, const TableEntry* fine, GasSensor sensor, uint16_t countsQ4) {
+  ppm_t value = lookupPpm(table, fine, countsQ4);
+  CalibrationScale scale = curves[sensor].scale;
+  if (scale == SCALE_ONE) return value;
+#if FIXED_POINT_MATH
+  uint64_t scaled = ((uint64_t)value * scale) >> 16;
+  return scaled > 0x7FFFFFFF ? 0x7FFFFFFF : (ppm_t)scaled;
+#else
+  return value * scale;
+#endif
+}
+
+ppm_t calculateCOppm(uint16_t countsQ4) {
+  return calibratedPpm(coTable, coFineTable, GAS_MQ7, countsQ4);
+}
+
+ppm_t calculateCH4ppm(uint16_t countsQ4) {
+  return calibratedPpm(ch4Table, NULL, GAS_MQ4, countsQ4);
+}
+
+ppm_t calculateAirQualityppm(uint16_t countsQ4) {
+  return calibratedPpm(airQualityTable, NULL, GAS_MQ135, countsQ4);
+}
+
+static const float DEFAULT_CURVE_A[GAS_SENSOR_COUNT] = { MQ7_CURVE_A, MQ135_CURVE_A, MQ4_CURVE_A };
+static const float CURVE_B[GAS_SENSOR_COUNT] = { MQ7_CURVE_B, MQ135_CURVE_B, MQ4_CURVE_B };
+static const float RATIO_CLEAN_AIR[GAS_SENSOR_COUNT] = {
+  MQ7_RATIO_CLEAN_AIR, MQ135_RATIO_CLEAN_AIR, MQ4_RATIO_CLEAN_AIR
+};
+
+float defaultR0(GasSensor sensor) {
+  return 10.0f * RATIO_CLEAN_AIR[sensor];
+}
+
+float defaultCurveA(GasSensor sensor) {
+  return DEFAULT_CURVE_A[sensor];
+}
+
+float curveB(GasSensor sensor) {
+  return CURVE_B[sensor];
+}
+
+float ratioCleanAir(GasSensor sensor) {
+  return RATIO_CLEAN_AIR[sensor];
+}
+
+void setCalibration(GasSensor sensor, float r0, float curveA) {
+  SensorCurve& curve = curves[sensor];
+  curve.r0 = r0;
+  curve.curveA = curveA;
+
+  float scale = (curveA / defaultCurveA(sensor)) * pow(defaultR0(sensor) / r0, curveB(sensor));
+#if FIXED_POINT_MATH
+  curve.scale = scale * SCALE_ONE + 0.5f;
+#else
+  curve.scale = scale;
+#endif
+  if (r0 == defaultR0(sensor) && curveA == defaultCurveA(sensor)) curve.scale = SCALE_ONE;
+}
+
+float calibratedR0(GasSensor sensor) {
+  return curves[sensor].r0;
+}
+
+float calibratedCurveA(GasSensor sensor) {
+  return curves[sensor].curveA;
+}
+
+float sensorResistance(uint16_t countsQ4) {
+  if (countsQ4 == 0) return PPM_TABLE_MAX;
+  float counts = countsQ4 * (1.0f / (1 << FILTER_FRAC_BITS));
+  return loadResistance(counts);
+}
+
+GasReadings convertReadings(uint16_t mq7Q4, uint16_t mq135Q4, uint16_t mq4Q4) {
+  // Same conversion and limits as the sketch's sensor channels
+  GasReadings readings;
+  readings.co = CoLimits::clamp(Mq7Curve::convert(mq7Q4));
+  readings.ch4 = Ch4Limits::clamp(Mq4Curve::convert(mq4Q4));
+  readings.airQuality = AirQualityLimits::clamp(Mq135Curve::convert(mq135Q4));
+  return readings;
+}
+
+int32_t ppmToDeci(ppm_t value) {
+#if FIXED_POINT_MATH
+  return value;
+#else
+  return (int32_t)(value * 10.0f + 0.5f);
+#endif
+}
+
+void printDeci(Print& out, int32_t deciPpm) {
+  if (deciPpm < 0) {
+    out.print('-');
+    deciPpm = -deciPpm;
+  }
+  out.print(deciPpm / 10);
+  out.print('.');
+  out.print((char)('0' + deciPpm % 10));
+}
+
+void printPpm(Print& out, ppm_t value) {
+#if FIXED_POINT_MATH
+  printDeci(out, value);
+#else
+  out.print(value, 1);
+#endif
+}
+
+char* formatPpm(char* out, ppm_t value) {
+#if FIXED_POINT_MATH
+  if (value < 0) {
+    *out++ = '-';
+    value = -value;
+  }
+  ltoa(value / 10, out, 10);
+  out += strlen(out);
+  *out++ = '.';
+  *out++ = '0' + value % 10;
+  *out = '\0';
+  return out;
+#else
+  dtostrf(value, 1, 1, out);
+  return out + strlen(out);
+#endif
+}
+
+// ppm = a * (Rs/R0)^b with R0 from the ratio in clean air, as in the original conversion
+static float exactPpm(float sensorValue, float curveA, float curveB, float ratio) {
+  float voltage = sensorValue * (5.0 / 1023.0);
+  float rs = ((5.0 * 10.0) / voltage) - 10.0;  // 10K load resistor
+  float r0 = 10.0 * ratio;
+  return curveA * pow(rs / r0, curveB);
+}
+
+// Function to calculate CO (MQ7)
+float calculateCOppmExact(float sensorValue) {
+  return exactPpm(sensorValue, MQ7_CURVE_A, MQ7_CURVE_B, MQ7_RATIO_CLEAN_AIR);
+}
+
+// Function to calculate Methane/CH4 (MQ4)
+float calculateCH4ppmExact(float sensorValue) {
+  return exactPpm(sensorValue, MQ4_CURVE_A, MQ4_CURVE_B, MQ4_RATIO_CLEAN_AIR);
+}
+
+// Function to calculate air quality (MQ135)
+float calculateAirQualityppmExact(float sensorValue) {
+  return exactPpm(sensorValue, MQ135_CURVE_A, MQ135_CURVE_B, MQ135_RATIO_CLEAN_AIR);
+}
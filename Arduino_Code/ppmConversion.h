@@ -0,0 +1,109 @@
+#ifndef PPM_CONVERSION_H
+#define PPM_CONVERSION_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+class Print;
+
+// ADC-count to ppm conversion for the MQ gas sensors.
+//
+// Every sensor follows ppm = a * (Rs/R0)^b with Rs taken from a 10K load
+// resistor divider. Instead of a float divide and a software pow() per call,
+// the curves are evaluated by the compiler into PROGMEM tables (one entry
+// every PPM_TABLE_STEP counts) and conversion is a linear interpolation
+// between two entries.
+//
+// The CO curve bends too fast at the bottom of its range for a 4-count
+// step, so MQ-7 readings below PPM_FINE_COUNTS come from a second table
+// with an entry per count. Against pow(), the interpolated value is within
+// 0.6% for CO and 0.1% for CH4 and MQ135 across their clamp ranges. The
+// larger error is the 0.1 ppm resolution of a reading (and of the
+// FIXED_POINT_MATH tables). host/bench.cpp measures the rounded CO reading
+// at up to 4% off near 1 ppm (5.5% fixed point), and within 1.2% (2.1%)
+// from 5 ppm up. With a 4-count step alone it was 9% at 1 ppm.
+
+// Type of a ppm reading. With FIXED_POINT_MATH it is an integer count of
+// 0.1 ppm, otherwise a float in ppm. PPM() turns a constant into either.
+#if FIXED_POINT_MATH
+typedef int32_t ppm_t;
+#define PPM(value) ((ppm_t)((value) * 10 + 0.5))
+#else
+typedef float ppm_t;
+#define PPM(value) ((ppm_t)(value))
+#endif
+
+// Sensor calibration values (adjust based on datasheet or calibration)
+constexpr float MQ7_RATIO_CLEAN_AIR = 9.83;
+constexpr float MQ135_RATIO_CLEAN_AIR = 3.6;
+constexpr float MQ4_RATIO_CLEAN_AIR = 4.4;
+
+// MQ7 has a different curve than other sensors
+// Rs/R0 = 1 at 100ppm CO in clean air, a≈100, b≈-1.5
+constexpr float MQ7_CURVE_A = 100.0;
+constexpr float MQ7_CURVE_B = -1.5;
+
+// MQ4 is calibrated for methane
+// Rs/R0 = 1 at around 1000ppm CH4 in clean air, a≈1000, b≈-2.95 (steeper curve)
+constexpr float MQ4_CURVE_A = 1000.0;
+constexpr float MQ4_CURVE_B = -2.95;
+
+// MQ135 is primarily for CO2 and other gases
+// Rs/R0 = 1 at 400ppm CO2 in clean air, a≈400, b≈-2.2
+constexpr float MQ135_CURVE_A = 400.0;
+constexpr float MQ135_CURVE_B = -2.2;
+
+#define PPM_TABLE_STEP_LOG2 2                           // One entry every 4 counts
+#define PPM_TABLE_SIZE ((1024 >> PPM_TABLE_STEP_LOG2) + 1)
+#define PPM_TABLE_MAX 1.0e6                             // Cap for Rs -> 0
+#define PPM_FINE_COUNTS 16                              // CO counts covered by the per-count table
+
+// Sensors in filter order, also the layout of a calibration record
+enum GasSensor : uint8_t { GAS_MQ7, GAS_MQ135, GAS_MQ4, GAS_SENSOR_COUNT };
+
+// Runtime calibration.
+//
+// The tables are built for the default R0 (10K * ratio in clean air) and
+// curve A. Since ppm = A * (Rs/R0)^B, a measured R0 or a new A only scales
+// every entry, by (A / A0) * (R0_0 / R0)^B; setCalibration() works that
+// factor out once so a conversion costs one extra multiply. The slope B
+// shapes the tables and stays a compile-time constant.
+float defaultR0(GasSensor sensor);
+float defaultCurveA(GasSensor sensor);
+float curveB(GasSensor sensor);
+float ratioCleanAir(GasSensor sensor);
+
+void setCalibration(GasSensor sensor, float r0, float curveA);
+float calibratedR0(GasSensor sensor);
+float calibratedCurveA(GasSensor sensor);
+
+// Sensor resistance in kOhm for a filtered value, as used for R0
+float sensorResistance(uint16_t countsQ4);
+
+// Table-based conversion, input is ADC counts << FILTER_FRAC_BITS
+ppm_t calculateCOppm(uint16_t countsQ4);
+ppm_t calculateCH4ppm(uint16_t countsQ4);
+ppm_t calculateAirQualityppm(uint16_t countsQ4);
+
+// One reading of all three sensors, clamped to the range reported upstream
+struct GasReadings {
+  ppm_t co;
+  ppm_t ch4;
+  ppm_t airQuality;
+};
+
+GasReadings convertReadings(uint16_t mq7Q4, uint16_t mq135Q4, uint16_t mq4Q4);
+
+// Reference implementations using pow(), input in (fractional) ADC counts
+float calculateCOppmExact(float sensorValue);
+float calculateCH4ppmExact(float sensorValue);
+float calculateAirQualityppmExact(float sensorValue);
+
+// Formatting with one decimal, integer-only in a FIXED_POINT_MATH build
+int32_t ppmToDeci(ppm_t value);
+void printPpm(Print& out, ppm_t value);
+void printDeci(Print& out, int32_t deciPpm);
+char* formatPpm(char* out, ppm_t value);  // Returns the terminating NUL
+
+#endif
@@ -0,0 +1,151 @@
+#include <Arduino.h>
+
+#include "memoryGuard.h"
+#include "profiler.h"
+#include "serialProtocol.h"
+
+#define STACK_GUARD 64  // Bytes below the current stack pointer left unpainted
+
+static volatile uint16_t cycleHigh = 0;
+static ProfileStats sectionStats[PROFILE_SECTION_COUNT];
+static uint16_t loopHistogram[PROFILE_LOOP_BUCKETS];
+static uint32_t lastLoopMark = 0;
+
+static const char SECTION_READ_SENSORS[] PROGMEM = "readSensors";
+static const char SECTION_UPDATE_DISPLAY[] PROGMEM = "updateDisplay";
+static const char SECTION_SEND_DATA[] PROGMEM = "sendDataToPC";
+static const char SECTION_RECEIVE[] PROGMEM = "receiveFromServer";
+
+static const char* const sectionNames[PROFILE_SECTION_COUNT] PROGMEM = {
+  SECTION_READ_SENSORS,
+  SECTION_UPDATE_DISPLAY,
+  SECTION_SEND_DATA,
+  SECTION_RECEIVE,
+};
+
+// Fill unused SRAM with a marker; bytes the stack later touches lose it
+static void paintStack() {
+  char* p = memoryFreeStart();
+  char* limit = (char*)SP - STACK_GUARD;
+  while (p < limit) *p++ = MEMORY_PAINT;
+}
+
+void profilerBegin() {
+  profilerReset();
+  paintStack();
+
+  // Timer5 free-running at clk/1, normal mode
+  TCCR5A = 0;
+  TCCR5B = _BV(CS50);
+  TCNT5 = 0;
+  TIFR5 = _BV(TOV5);
+  TIMSK5 = _BV(TOIE5);
+
+  lastLoopMark = profilerCycles();
+}
+
+uint32_t profilerCycles() {
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t low = TCNT5;
+  uint16_t high = cycleHigh;
+  // Overflow happened but its interrupt has not run yet
+  if ((TIFR5 & _BV(TOV5)) && low < 0x8000) high++;
+  SREG = sreg;
+  return ((uint32_t)high << 16) | low;
+}
+
+void profilerRecord(ProfileSection section, uint32_t cycles) {
+  ProfileStats& stats = sectionStats[section];
+  if (stats.count == 0 || cycles < stats.minCycles) stats.minCycles = cycles;
+  if (cycles > stats.maxCycles) stats.maxCycles = cycles;
+  stats.totalCycles += cycles;
+  stats.count++;
+}
+
+void profilerLoopMark() {
+  uint32_t now = profilerCycles();
+  uint32_t micros = (now - lastLoopMark) / (F_CPU / 1000000UL);
+  lastLoopMark = now;
+
+  uint8_t bucket = 0;
+  while (micros > 1 && bucket < PROFILE_LOOP_BUCKETS - 1) {
+    micros >>= 1;
+    bucket++;
+  }
+  if (loopHistogram[bucket] < 0xFFFF) loopHistogram[bucket]++;
+}
+
+void profilerReset() {
+  for (uint8_t i = 0; i < PROFILE_SECTION_COUNT; i++) {
+    sectionStats[i].count = 0;
+    sectionStats[i].minCycles = 0;
+    sectionStats[i].maxCycles = 0;
+    sectionStats[i].totalCycles = 0;
+  }
+  for (uint8_t i = 0; i < PROFILE_LOOP_BUCKETS; i++) {
+    loopHistogram[i] = 0;
+  }
+}
+
+const ProfileStats& profilerStats(ProfileSection section) {
+  return sectionStats[section];
+}
+
+const char* profilerSectionName(ProfileSection section) {
+  return (const char*)pgm_read_ptr(&sectionNames[section]);
+}
+
+uint16_t profilerLoopBucket(uint8_t bucket) {
+  return loopHistogram[bucket];
+}
+
+uint16_t profilerFreeRam() {
+  char top;
+  return &top - memoryFreeStart();
+}
+
+uint16_t profilerMinFreeRam() {
+  // Painted bytes directly above the heap were never reached by the stack
+  const char* start = memoryFreeStart();
+  const char* p = start;
+  const char* limit = (const char*)SP;
+  while (p < limit && *p == (char)MEMORY_PAINT) p++;
+  return p - start;
+}
+
+static uint8_t* putU16(uint8_t* p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t* putU32(uint8_t* p, uint32_t v) {
+  return putU16(putU16(p, v & 0xFFFF), v >> 16);
+}
+
+uint8_t profilerEncodeStats(uint8_t* out, uint16_t rxOverflows, uint16_t rxFull, uint16_t adcOverruns) {
+  uint8_t* p = out;
+  *p++ = PROFILE_SECTION_COUNT;
+  for (uint8_t i = 0; i < PROFILE_SECTION_COUNT; i++) {
+    const ProfileStats& stats = sectionStats[i];
+    p = putU32(p, stats.count);
+    p = putU32(p, stats.minCycles);
+    p = putU32(p, stats.maxCycles);
+    p = putU32(p, stats.count > 0 ? (uint32_t)(stats.totalCycles / stats.count) : 0);
+  }
+  *p++ = PROFILE_LOOP_BUCKETS;
+  for (uint8_t i = 0; i < PROFILE_LOOP_BUCKETS; i++) {
+    p = putU16(p, loopHistogram[i]);
+  }
+  p = putU16(p, rxOverflows);
+  p = putU16(p, rxFull);
+  p = putU16(p, adcOverruns);
+  p = putU16(p, profilerFreeRam());
+  p = putU16(p, profilerMinFreeRam());
+  return p - out;
+}
+
+ISR(TIMER5_OVF_vect) {
+  cycleHigh++;
+}
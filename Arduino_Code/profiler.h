@@ -0,0 +1,71 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+// Hot-path instrumentation.
+//
+// Timer5 runs free at the CPU clock and its overflow interrupt extends it to
+// a 32-bit cycle counter (wraps every ~268 s, so any single measurement up to
+// that long is exact). PROFILE_SCOPE records min/max/mean cycles of the
+// enclosing block, profilerLoopMark() builds a histogram of loop() iteration
+// times, and the stack is painted at boot to find the free SRAM low-water mark.
+enum ProfileSection : uint8_t {
+  PROFILE_READ_SENSORS,
+  PROFILE_UPDATE_DISPLAY,
+  PROFILE_SEND_DATA,
+  PROFILE_RECEIVE,
+  PROFILE_SECTION_COUNT
+};
+
+// Loop histogram bucket i counts iterations of [2^i, 2^(i+1)) microseconds,
+// the last bucket also takes everything longer
+#define PROFILE_LOOP_BUCKETS 16
+
+struct ProfileStats {
+  uint32_t count;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint64_t totalCycles;
+};
+
+void profilerBegin();
+uint32_t profilerCycles();
+
+void profilerRecord(ProfileSection section, uint32_t cycles);
+void profilerLoopMark();
+void profilerReset();
+
+const ProfileStats& profilerStats(ProfileSection section);
+const char* profilerSectionName(ProfileSection section);  // PROGMEM string
+uint16_t profilerLoopBucket(uint8_t bucket);
+
+// SRAM between the heap and the stack, now and the lowest ever seen
+uint16_t profilerFreeRam();
+uint16_t profilerMinFreeRam();
+
+// Serialize a FRAME_TYPE_STATS payload, see serialProtocol.h for the layout
+uint8_t profilerEncodeStats(uint8_t* out, uint16_t rxOverflows, uint16_t rxFull, uint16_t adcOverruns);
+
+// Times the enclosing scope
+class ScopedProfile {
+public:
+  explicit ScopedProfile(ProfileSection section) : section(section), start(profilerCycles()) {}
+  ~ScopedProfile() { profilerRecord(section, profilerCycles() - start); }
+
+private:
+  ProfileSection section;
+  uint32_t start;
+};
+
+#if ENABLE_PROFILING
+#define PROFILE_SCOPE(section) ScopedProfile profileScope_(section)
+#define PROFILE_LOOP_MARK() profilerLoopMark()
+#else
+#define PROFILE_SCOPE(section)
+#define PROFILE_LOOP_MARK()
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+#include <Arduino.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "config.h"
+#include "recovery.h"
+#include "serialProtocol.h"
+#include "taskScheduler.h"
+
+#define RECOVERY_MAGIC 0x5243  // "RC"
+
+// Why the last reset happened, written just before it. The Mega's
+// stk500v2 bootloader clears MCUSR before starting the sketch, so this is
+// the only reliable record of a reset the firmware caused.
+#define RESET_WATCHDOG 0x57  // "W", the watchdog interrupt fired
+#define RESET_GUARD 0x47     // "G", recoveryRestart()
+
+struct NoinitState {
+  uint16_t magic;
+  uint8_t restarts;
+  RecoverySnapshot snapshot;
+  uint16_t crc;
+};
+
+// Survive a reset: .noinit is neither zeroed nor initialised at startup
+static NoinitState saved __attribute__((section(".noinit")));
+static uint32_t kickMs __attribute__((section(".noinit")));      // millis() at the last kick
+static uint32_t kickMsCheck __attribute__((section(".noinit")));  // ~kickMs, guards the pair
+static uint8_t resetMarker __attribute__((section(".noinit")));
+static uint8_t resetMarkerCheck __attribute__((section(".noinit")));  // ~resetMarker
+static uint8_t markedTask __attribute__((section(".noinit")));
+
+static uint8_t resetFlags __attribute__((section(".noinit")));
+static uint8_t resetCause = RECOVERY_RESET_UNKNOWN;
+static uint8_t hungTask = RECOVERY_NO_TASK;
+static bool resumable = false;
+static bool stable = false;
+static uint32_t bootMs = 0;  // millis() when this run started, after a resume
+
+// Timer0's millisecond count in the Arduino core
+extern volatile unsigned long timer0_millis;
+
+// Runs before the C runtime sets up RAM: take the reset cause, if a
+// bootloader left it, and stop a watchdog still armed by the reset
+void captureResetFlags() __attribute__((naked, used, section(".init3")));
+void captureResetFlags() {
+  resetFlags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+static void markReset(uint8_t marker) {
+  resetMarker = marker;
+  resetMarkerCheck = ~marker;
+  markedTask = schedulerRunningTask();
+}
+
+static void resetNow() {
+  wdt_enable(WDTO_15MS);
+  for (;;) {
+  }
+}
+
+#if WATCHDOG
+// Interrupt-then-reset mode: the first timeout lands here instead of
+// resetting, so the reason and the hung task can be recorded
+ISR(WDT_vect) {
+  markReset(RESET_WATCHDOG);
+  resetNow();
+}
+#endif
+
+static uint16_t stateCrc() {
+  const uint8_t* bytes = (const uint8_t*)&saved;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < offsetof(NoinitState, crc); i++) crc = crc16Update(crc, bytes[i]);
+  return crc;
+}
+
+uint16_t recoveryChecksum(const void* data, uint16_t size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint8_t sum1 = 0;
+  uint8_t sum2 = 0;
+  while (size--) {
+    sum1 += *bytes++;
+    sum2 += sum1;
+  }
+  return ((uint16_t)sum2 << 8) | sum1;
+}
+
+void recoveryBegin() {
+  uint8_t marker = (uint8_t)(resetMarker ^ resetMarkerCheck) == 0xFF ? resetMarker : 0;
+  resetMarker = resetMarkerCheck = 0;
+
+  if (marker == RESET_WATCHDOG) {
+    resetCause = RECOVERY_RESET_WATCHDOG;
+  } else if (marker == RESET_GUARD) {
+    resetCause = RECOVERY_RESET_GUARD;
+  } else if (resetFlags & _BV(BORF)) {
+    resetCause = RECOVERY_RESET_BROWNOUT;
+  } else if (resetFlags & _BV(PORF)) {
+    resetCause = RECOVERY_RESET_POWER;
+  } else if (resetFlags & _BV(EXTRF)) {
+    resetCause = RECOVERY_RESET_EXTERNAL;
+  }
+
+  // Only a reset this firmware made itself is known to have kept the
+  // heaters powered; power-on, brown-out, the reset button and the host's
+  // DTR pulse all look alike once the bootloader has cleared MCUSR
+  bool valid = saved.magic == RECOVERY_MAGIC && saved.crc == stateCrc();
+  if (!valid) saved.restarts = 0;
+  if (resetCause == RECOVERY_RESET_WATCHDOG) {
+    hungTask = markedTask;
+    if (valid) saved.restarts++;
+  }
+  resumable = valid && resetCause == RECOVERY_RESET_WATCHDOG && saved.restarts <= RECOVERY_MAX_RESTARTS;
+  saved.magic = 0;  // Nothing to resume until the next save
+}
+
+uint8_t recoveryResetCause() {
+  return resetCause;
+}
+
+uint8_t recoveryResetFlags() {
+  return resetFlags;
+}
+
+bool recoveryResume(RecoverySnapshot& snapshot) {
+  if (!resumable) return false;
+  snapshot = saved.snapshot;
+
+  // No reading was stamped after the last kick, and the reset came at
+  // least a watchdog period later, so time never runs backwards
+  uint32_t resumeMs = saved.snapshot.wallMs;
+  if ((kickMs ^ kickMsCheck) == 0xFFFFFFFFUL && kickMs - resumeMs < 0x80000000UL) resumeMs = kickMs;
+  resumeMs += WATCHDOG_TIMEOUT_MS;
+  noInterrupts();
+  timer0_millis += resumeMs;
+  interrupts();
+  bootMs = millis();
+  return true;
+}
+
+uint8_t recoveryRestarts() {
+  return saved.restarts;
+}
+
+uint8_t recoveryHungTask() {
+  return hungTask;
+}
+
+void recoveryStart() {
+#if WATCHDOG
+  wdt_enable(WATCHDOG_TIMEOUT);
+  WDTCSR |= _BV(WDIE);  // Interrupt first, the reset follows from WDT_vect
+#endif
+}
+
+void recoveryKick() {
+#if WATCHDOG
+  wdt_reset();
+#endif
+  uint32_t now = millis();
+  kickMs = now;
+  kickMsCheck = ~now;
+}
+
+void recoveryRestart() {
+  noInterrupts();
+  saved.magic = 0;
+  markReset(RESET_GUARD);
+  resetNow();
+}
+
+void recoverySave(const RecoverySnapshot& snapshot) {
+  if (!stable && millis() - bootMs >= RECOVERY_STABLE_MS) {
+    stable = true;
+    saved.restarts = 0;
+  }
+  saved.snapshot = snapshot;
+  saved.magic = RECOVERY_MAGIC;
+  saved.crc = stateCrc();
+}
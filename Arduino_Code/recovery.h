@@ -0,0 +1,82 @@
+#ifndef RECOVERY_H
+#define RECOVERY_H
+
+#include <stdint.h>
+
+#include "calibrationStore.h"
+
+// Watchdog supervision and warm restart (WATCHDOG).
+//
+// The hardware watchdog resets the board when loop() stops coming round
+// for WATCHDOG_TIMEOUT, e.g. a task stuck on a dead bus. It runs in
+// interrupt-then-reset mode: the interrupt records the reason and the task
+// that hung in .noinit RAM, which a reset does not clear, and then resets.
+// A small snapshot of the running state is kept there too; after a
+// watchdog reset setup() takes it back instead of starting cold, so the
+// board is sampling again within about a second with its sequence numbers,
+// clock, calibration and rolling statistics intact and without repeating
+// the sensor warm-up. State that lives directly in .noinit (the rolling
+// statistics) is covered by a checksum in the snapshot.
+//
+// Every other reset starts cold, as do RECOVERY_MAX_RESTARTS watchdog
+// resets in a row, in case the state itself is what crashes it. The Mega's
+// stk500v2 bootloader clears MCUSR, so a power-on, a brown-out, the reset
+// button and the host's DTR pulse cannot be told apart and the heaters may
+// have lost power; MCUSR is only reported, for boards without it.
+#define RECOVERY_MAX_RESTARTS 3
+#define RECOVERY_STABLE_MS 60000UL  // Uptime after which the board counts as recovered
+#define RECOVERY_NO_TASK 0xFF
+
+#define RECOVERY_LIVE 0x01  // Sensor warm-up was over
+
+enum RecoveryReset : uint8_t {
+  RECOVERY_RESET_UNKNOWN,   // MCUSR cleared by the bootloader
+  RECOVERY_RESET_WATCHDOG,
+  RECOVERY_RESET_GUARD,     // recoveryRestart()
+  RECOVERY_RESET_BROWNOUT,
+  RECOVERY_RESET_POWER,
+  RECOVERY_RESET_EXTERNAL
+};
+
+struct RecoverySnapshot {
+  uint32_t wallTime;   // wallClockNow() at the save, 0 if unset
+  uint32_t wallMs;     // millis() at the save
+  uint8_t clockSource;
+  uint16_t sampleSeq;
+  uint8_t flags;       // RECOVERY_*
+  CalibrationRecord calibration;
+  uint16_t stateSum;   // recoveryChecksum() of the state kept in .noinit
+};
+
+// Read the reset cause and the previous run's snapshot; first thing in setup()
+void recoveryBegin();
+
+// Why the board reset, RECOVERY_RESET_*
+uint8_t recoveryResetCause();
+
+// MCUSR at reset: PORF, EXTRF, BORF, WDRF, JTRF; 0 after the bootloader
+uint8_t recoveryResetFlags();
+
+// If the previous run can be resumed, copy its snapshot out and continue
+// millis() from where it stopped. False means start cold.
+bool recoveryResume(RecoverySnapshot& snapshot);
+
+// Watchdog restarts in a row, and the task that was running at the last one
+uint8_t recoveryRestarts();
+uint8_t recoveryHungTask();
+
+// Start the watchdog, then kick it every pass
+void recoveryStart();
+void recoveryKick();
+
+// Keep the state for a warm restart, cheap enough for every sensor tick
+void recoverySave(const RecoverySnapshot& snapshot);
+
+// Reset now and start cold, for when RAM can no longer be trusted. The
+// next boot reports it as RECOVERY_RESET_GUARD.
+void recoveryRestart();
+
+// Fletcher-16 over a block of RAM
+uint16_t recoveryChecksum(const void* data, uint16_t size);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdint.h>
+
+// Compiler barrier so item writes are not reordered past the index update
+#define RING_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+// Lock-free single-producer/single-consumer ring buffer.
+//
+// One side (typically an ISR) only calls push(), the other side only calls
+// pop(). Each index is a single byte written by exactly one side, so on AVR
+// no interrupt masking is needed. Size must be a power of two up to 128.
+template <typename T, uint8_t Size>
+class SpscRing {
+  static_assert(Size >= 2 && Size <= 128 && (Size & (Size - 1)) == 0,
+                "SpscRing size must be a power of two between 2 and 128");
+
+public:
+  SpscRing() : head(0), tail(0) {}
+
+  // Producer side, returns false if the ring is full
+  bool push(const T& item) {
+    uint8_t h = head;
+    if ((uint8_t)(h - tail) >= Size) return false;
+    items[h & (Size - 1)] = item;
+    RING_BARRIER();
+    head = h + 1;
+    return true;
+  }
+
+  // Consumer side, returns false if the ring is empty
+  bool pop(T& item) {
+    uint8_t t = tail;
+    if (t == head) return false;
+    item = items[t & (Size - 1)];
+    RING_BARRIER();
+    tail = t + 1;
+    return true;
+  }
+
+  uint8_t count() const { return (uint8_t)(head - tail); }
+  bool empty() const { return head == tail; }
+
+private:
+  T items[Size];
+  volatile uint8_t head;  // Written by the producer only
+  volatile uint8_t tail;  // Written by the consumer only
+};
+
+#endif
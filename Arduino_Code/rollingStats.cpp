@@ -0,0 +1,219 @@
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "rollingStats.h"
+
+static const uint16_t windowLengths[ROLLING_WINDOW_COUNT] PROGMEM = { 60, 900, 3600 };
+
+// Integer square root, rounded down
+static uint16_t squareRoot(uint32_t value) {
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > value) bit >>= 2;
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+// Mean and deviation from n readings with the given sum and sum of squares
+static void finishSummary(uint32_t n, uint32_t sum, uint64_t squares, WindowSummary& out) {
+  out.mean = (sum + n / 2) / n;
+  // n * sum(x^2) - sum(x)^2 >= 0 by Cauchy-Schwarz, so this never underflows
+  uint64_t spread = squares * n - (uint64_t)sum * sum;
+  out.stddev = squareRoot(spread / ((uint64_t)n * n));
+}
+
+// Merge the `count` newest entries of a ring of summaries, weighted by the
+// readings behind each. Returns the total readings, 0 if all were empty.
+static uint16_t combine(const WindowSummary* entries, const uint8_t* readings, uint8_t size,
+                        uint8_t newest, uint8_t count, WindowSummary& out) {
+  uint16_t total = 0;
+  uint32_t sum = 0;
+  uint64_t squares = 0;
+  out.min = 0xFFFF;
+  out.max = 0;
+
+  uint8_t slot = newest;
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t n = readings[slot];
+    if (n > 0) {
+      const WindowSummary& entry = entries[slot];
+      total += n;
+      sum += (uint32_t)n * entry.mean;
+      // An entry's sum of squares is n * (deviation^2 + mean^2)
+      squares += (uint64_t)n * ((uint64_t)entry.stddev * entry.stddev + (uint32_t)entry.mean * entry.mean);
+      if (entry.min < out.min) out.min = entry.min;
+      if (entry.max > out.max) out.max = entry.max;
+    }
+    slot = slot == 0 ? size - 1 : slot - 1;
+  }
+
+  if (total == 0) {
+    memset(&out, 0, sizeof(out));
+    return 0;
+  }
+  finishSummary(total, sum, squares, out);
+  return total;
+}
+
+// Leaves the state alone, so an instance in .noinit survives a warm restart
+RollingStats::RollingStats() {}
+
+void RollingStats::reset(uint32_t now) {
+  rawFirst = 0;
+  rawCount = 0;
+  for (uint8_t c = 0; c < ROLLING_CHANNELS; c++) {
+    rawSum[c] = 0;
+    rawSquares[c] = 0;
+    rawMin[c].clear();
+    rawMax[c].clear();
+  }
+  memset(minuteReadings, 0, sizeof(minuteReadings));
+  memset(blockReadings, 0, sizeof(blockReadings));
+  memset(combined, 0, sizeof(combined));
+  memset(combinedReadings, 0, sizeof(combinedReadings));
+  minuteNewest = 0;
+  blockNewest = 0;
+  blockMinutes = 0;
+  minuteStart = now;
+}
+
+void RollingStats::add(const uint16_t* values, uint32_t now) {
+  update(now);
+
+  // A full ring drops its oldest reading early, see ROLLING_RAW_CAPACITY
+  if (rawCount == ROLLING_RAW_CAPACITY) dropOldest();
+
+  uint8_t slot = rawFirst + rawCount;
+  if (slot >= ROLLING_RAW_CAPACITY) slot -= ROLLING_RAW_CAPACITY;
+  times[slot] = now;
+  for (uint8_t c = 0; c < ROLLING_CHANNELS; c++) {
+    uint16_t value = values[c];
+    raw[c][slot] = value;
+    rawSum[c] += value;
+    rawSquares[c] += (uint32_t)value * value;
+    rawMin[c].push(raw[c], slot, false);
+    rawMax[c].push(raw[c], slot, true);
+  }
+  rawCount++;
+}
+
+void RollingStats::update(uint32_t now) {
+  // Close every minute that ended since the last call. After a gap of more
+  // than an hour there is nothing left to keep, so start over.
+  if (now - minuteStart >= ROLLING_BLOCKS * ROLLING_BLOCK_MINUTES * ROLLING_MINUTE_MS) {
+    reset(now);
+    return;
+  }
+  while (now - minuteStart >= ROLLING_MINUTE_MS) {
+    minuteStart += ROLLING_MINUTE_MS;
+    // Leaves the readings in [minuteStart - 1 min, minuteStart)
+    expireRaw(minuteStart - 1);
+    closeMinute();
+  }
+  expireRaw(now);
+}
+
+void RollingStats::expireRaw(uint32_t now) {
+  while (rawCount > 0 && now - times[rawFirst] >= ROLLING_MINUTE_MS) dropOldest();
+}
+
+void RollingStats::dropOldest() {
+  for (uint8_t c = 0; c < ROLLING_CHANNELS; c++) {
+    uint16_t value = raw[c][rawFirst];
+    rawSum[c] -= value;
+    rawSquares[c] -= (uint32_t)value * value;
+    rawMin[c].expire(rawFirst);
+    rawMax[c].expire(rawFirst);
+  }
+  if (++rawFirst == ROLLING_RAW_CAPACITY) rawFirst = 0;
+  rawCount--;
+}
+
+// The raw window now holds exactly the minute that ended
+void RollingStats::closeMinute() {
+  if (++minuteNewest == ROLLING_MINUTES) minuteNewest = 0;
+  minuteReadings[minuteNewest] = rawCount;
+  for (uint8_t c = 0; c < ROLLING_CHANNELS; c++) {
+    rawSummary(c, minutes[c][minuteNewest]);
+  }
+
+  if (++blockMinutes == ROLLING_BLOCK_MINUTES) {
+    blockMinutes = 0;
+    if (++blockNewest == ROLLING_BLOCKS) blockNewest = 0;
+    uint16_t total = 0;
+    for (uint8_t c = 0; c < ROLLING_CHANNELS; c++) {
+      total = combine(minutes[c], minuteReadings, ROLLING_MINUTES, minuteNewest, ROLLING_BLOCK_MINUTES,
+                      blocks[c][blockNewest]);
+    }
+    blockReadings[blockNewest] = total;
+  }
+
+  for (uint8_t c = 0; c < ROLLING_CHANNELS; c++) {
+    combinedReadings[0] = combine(minutes[c], minuteReadings, ROLLING_MINUTES, minuteNewest, ROLLING_MINUTES,
+                                  combined[0][c]);
+    combinedReadings[1] = combine(blocks[c], blockReadings, ROLLING_BLOCKS, blockNewest, ROLLING_BLOCKS,
+                                  combined[1][c]);
+  }
+}
+
+void RollingStats::rawSummary(uint8_t channel, WindowSummary& out) const {
+  if (rawCount == 0) {
+    memset(&out, 0, sizeof(out));
+    return;
+  }
+  out.min = rawMin[channel].front(raw[channel]);
+  out.max = rawMax[channel].front(raw[channel]);
+  finishSummary(rawCount, rawSum[channel], rawSquares[channel], out);
+}
+
+bool RollingStats::summary(RollingWindow window, uint8_t channel, WindowSummary& out) const {
+  if (window == WINDOW_1MIN) {
+    rawSummary(channel, out);
+  } else {
+    out = combined[window - 1][channel];
+  }
+  return readings(window) > 0;
+}
+
+uint16_t RollingStats::readings(RollingWindow window) const {
+  return window == WINDOW_1MIN ? rawCount : combinedReadings[window - 1];
+}
+
+uint16_t RollingStats::windowSeconds(RollingWindow window) {
+  return pgm_read_word(&windowLengths[window]);
+}
+
+static uint8_t* putWord(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+  return out + 2;
+}
+
+uint8_t RollingStats::encode(uint8_t* out, uint32_t now) const {
+  uint8_t* p = out;
+  for (uint8_t i = 0; i < 4; i++) *p++ = (now >> (8 * i)) & 0xFF;
+  *p++ = ROLLING_WINDOW_COUNT;
+  *p++ = ROLLING_CHANNELS;
+  for (uint8_t w = 0; w < ROLLING_WINDOW_COUNT; w++) {
+    RollingWindow window = (RollingWindow)w;
+    p = putWord(p, windowSeconds(window));
+    p = putWord(p, readings(window));
+    for (uint8_t c = 0; c < ROLLING_CHANNELS; c++) {
+      WindowSummary stats;
+      summary(window, c, stats);
+      p = putWord(p, stats.min);
+      p = putWord(p, stats.max);
+      p = putWord(p, stats.mean);
+      p = putWord(p, stats.stddev);
+    }
+  }
+  return p - out;
+}
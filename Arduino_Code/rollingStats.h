@@ -0,0 +1,139 @@
+#ifndef ROLLING_STATS_H
+#define ROLLING_STATS_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+// Rolling min/max/mean/standard deviation of the readings (ROLLING_STATS).
+//
+// Holding an hour of raw readings would take 10 KB at the default 2 s
+// sample period, so only the 1-minute window keeps them: a ring of
+// timestamped readings with running sums and a monotonic deque per channel
+// for the minimum and maximum, all updated in O(1) per reading. Every
+// completed minute is folded into a summary entry; the 15-minute window is
+// the last 15 of those and the hour window the last 12 five-minute blocks.
+// Those windows therefore advance in steps of their entries, and their
+// deviation is recombined from the entries' means and deviations.
+//
+// Values are in wire units (serialProtocol.h) and stay 16-bit throughout.
+#define ROLLING_CHANNELS 3  // co, ch4, airQuality
+#define ROLLING_MINUTE_MS 60000UL
+#define ROLLING_MINUTES 15        // Entries of the 15-minute window
+#define ROLLING_BLOCK_MINUTES 5   // Minutes per entry of the hour window
+#define ROLLING_BLOCKS 12
+
+enum RollingWindow : uint8_t { WINDOW_1MIN, WINDOW_15MIN, WINDOW_1H, ROLLING_WINDOW_COUNT };
+
+struct WindowSummary {
+  uint16_t min;
+  uint16_t max;
+  uint16_t mean;
+  uint16_t stddev;
+};
+
+// Sliding minimum or maximum over the values of a ring (monotonic deque).
+//
+// Holds ring slots whose values only decrease (maximum) or increase
+// (minimum) from the front, so the front is the extreme of the window.
+// A new value drops every queued value it beats, as those can never be
+// the extreme again; each slot is queued and dropped once, O(1) amortized.
+template <uint8_t Size>
+class ExtremeQueue {
+public:
+  // No initialisation, RollingStats::reset() clears the queue
+  ExtremeQueue() {}
+
+  void clear() {
+    first = 0;
+    count = 0;
+  }
+
+  // The value at values[slot] joins the window
+  void push(const uint16_t* values, uint8_t slot, bool maximum) {
+    uint16_t value = values[slot];
+    while (count > 0) {
+      uint16_t last = values[items[wrap(first + count - 1)]];
+      if (maximum ? last > value : last < value) break;
+      count--;
+    }
+    items[wrap(first + count)] = slot;
+    count++;
+  }
+
+  // Ring slot `slot`, the oldest in the window, leaves it
+  void expire(uint8_t slot) {
+    if (count > 0 && items[first] == slot) {
+      first = wrap(first + 1);
+      count--;
+    }
+  }
+
+  uint16_t front(const uint16_t* values) const { return values[items[first]]; }
+
+private:
+  static uint8_t wrap(uint8_t index) { return index >= Size ? index - Size : index; }
+
+  uint8_t items[Size];
+  uint8_t first;
+  uint8_t count;
+};
+
+class RollingStats {
+public:
+  // Construction leaves the state as it is, call reset() before use
+  RollingStats();
+
+  void reset(uint32_t now);
+
+  // One reading of every channel
+  void add(const uint16_t* values, uint32_t now);
+
+  // Age out old readings and close finished minutes, add() does this itself
+  void update(uint32_t now);
+
+  // Summary of one channel over a window, false while it holds no readings
+  bool summary(RollingWindow window, uint8_t channel, WindowSummary& out) const;
+
+  // Readings the window is based on
+  uint16_t readings(RollingWindow window) const;
+
+  // Length of a window in seconds
+  static uint16_t windowSeconds(RollingWindow window);
+
+  // Serialize a FRAME_TYPE_SUMMARY payload, see serialProtocol.h for the layout
+  uint8_t encode(uint8_t* out, uint32_t now) const;
+
+private:
+  void expireRaw(uint32_t now);
+  void dropOldest();
+  void closeMinute();
+  void rawSummary(uint8_t channel, WindowSummary& out) const;
+
+  // 1-minute window
+  uint32_t times[ROLLING_RAW_CAPACITY];
+  uint16_t raw[ROLLING_CHANNELS][ROLLING_RAW_CAPACITY];
+  uint8_t rawFirst;
+  uint8_t rawCount;
+  uint32_t rawSum[ROLLING_CHANNELS];
+  uint64_t rawSquares[ROLLING_CHANNELS];
+  ExtremeQueue<ROLLING_RAW_CAPACITY> rawMin[ROLLING_CHANNELS];
+  ExtremeQueue<ROLLING_RAW_CAPACITY> rawMax[ROLLING_CHANNELS];
+
+  // Completed minutes and five-minute blocks, 0 readings = empty entry
+  WindowSummary minutes[ROLLING_CHANNELS][ROLLING_MINUTES];
+  uint8_t minuteReadings[ROLLING_MINUTES];
+  uint8_t minuteNewest;
+  WindowSummary blocks[ROLLING_CHANNELS][ROLLING_BLOCKS];
+  uint8_t blockReadings[ROLLING_BLOCKS];
+  uint8_t blockNewest;
+  uint8_t blockMinutes;  // Minutes closed since the last block
+
+  // 15-minute and hour summaries, recombined when a minute closes
+  WindowSummary combined[2][ROLLING_CHANNELS];
+  uint16_t combinedReadings[2];
+
+  uint32_t minuteStart;
+};
+
+#endif
@@ -0,0 +1,529 @@
+#include "config.h"
+
+// Built out without a card, so the SD library is not linked in
+#if SD_LOG
+
+#include <Arduino.h>
+#include <SD.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "recovery.h"
+#include "sdLog.h"
+#include "serialProtocol.h"
+
+#define LOG_SUPER_MAGIC 0x474C5141UL  // "AQLG"
+#define LOG_BLOCK_MAGIC 0x4C42        // "BL"
+#define LOG_FILL_MAGIC 0x4C46         // "FL"
+#define LOG_VERSION 1
+#define LOG_INDEX_OFFSET 32
+#define LOG_SUPER_CRC_OFFSET 26
+#define LOG_HEADER_CRC_OFFSET 20
+#define LOG_DATA_SIZE (LOG_BLOCK_SIZE - LOG_HEADER_SIZE)
+#define LOG_SUPER_INTERVAL 8  // Data blocks between superblock updates
+#define LOG_WAITING 4         // Readings held while the block is on its way to the card
+
+// Card work left for sdLogTask(), one step per call
+enum WriteStep : uint8_t { STEP_IDLE, STEP_DATA, STEP_SUPER_READ, STEP_SUPER_WRITE };
+
+static Sd2Card card;
+
+static bool cardPresent = false;
+static bool mounted = false;
+static uint8_t channelCount = 0;
+static uint16_t volume = 0;
+static uint32_t capacity = 0;
+static uint32_t head = 0;     // Data blocks on the card
+static uint32_t indexed = 0;  // Of those, the ones the superblock accounts for
+static uint32_t lastTime = 0;
+static uint32_t stride = 1;
+static uint16_t indexCount = 0;
+static uint32_t cardStride = 1;  // stride and indexCount as of the superblock on the card
+static uint16_t cardEntries = 0;
+static uint16_t errors = 0;
+static uint16_t dropped = 0;
+
+// Writing
+static bool superDue = false;  // Update the superblock once the data block is written
+static uint32_t unindexedStart[LOG_SUPER_INTERVAL];  // startTime of data blocks indexed..head-1
+
+struct WaitingRecord {
+  uint32_t time;
+  uint16_t values[LOG_MAX_CHANNELS];
+};
+
+// The block being filled and the readings waiting for it. It lives in
+// .noinit under a checksum, so whatever resets the board its readings are
+// written out on the next boot (restoreFill()) instead of being lost.
+struct LogFill {
+  uint16_t magic;
+  uint16_t volume;
+  uint32_t seq;  // Data block number the block gets
+  uint8_t step;  // WriteStep
+  uint8_t records;
+  uint16_t used;
+  uint32_t startTime;
+  uint32_t endTime;
+  uint16_t previous[LOG_MAX_CHANNELS];
+  uint8_t waitingCount;
+  WaitingRecord waiting[LOG_WAITING];
+  uint16_t sum;
+  uint8_t block[LOG_BLOCK_SIZE];  // Also the superblock scratch while no records are in it
+};
+static LogFill fill __attribute__((section(".noinit")));
+
+// Log clock, seconds that survive the millis() wrap
+static uint32_t clockSeconds = 0;
+static uint32_t clockMs = 0;
+
+// Streaming cursor
+static uint32_t readBlock = 0;
+static uint32_t readEnd = 0;
+static uint32_t readTo = 0;
+static uint16_t readOffset = 0;
+static uint16_t readSize = 0;  // Header + records of readBlock, 0 until its header is read
+
+static uint16_t getU16(const uint8_t* p) {
+  return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t* p) {
+  return getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+}
+
+static uint8_t* putU16(uint8_t* p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t* putU32(uint8_t* p, uint32_t v) {
+  p = putU16(p, v & 0xFFFF);
+  return putU16(p, v >> 16);
+}
+
+static uint8_t* putVarint(uint8_t* p, uint32_t v) {
+  while (v >= 0x80) {
+    *p++ = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+static uint16_t crc16(const uint8_t* data, uint16_t len, uint16_t crc = 0xFFFF) {
+  while (len--) crc = crc16Update(crc, *data++);
+  return crc;
+}
+
+static bool readPart(uint32_t number, uint16_t offset, uint16_t count, uint8_t* dst) {
+  if (card.readData(number, offset, count, dst)) return true;
+  errors++;
+  return false;
+}
+
+static bool writeCard(uint32_t number, const uint8_t* src) {
+  if (card.writeBlock(number, src)) return true;
+  errors++;
+  return false;
+}
+
+// Header of data block n, false if it is not a block of this log
+static bool readHeader(uint32_t n, uint8_t* header) {
+  if (!readPart(n + 1, 0, LOG_HEADER_SIZE, header)) return false;
+  return getU16(header) == LOG_BLOCK_MAGIC && getU16(header + 2) == volume && getU32(header + 4) == n;
+}
+
+static uint32_t blockStart(uint32_t n) {
+  uint8_t header[LOG_HEADER_SIZE];
+  return readHeader(n, header) ? getU32(header + 8) : 0;
+}
+
+// Record data block n in the superblock held in buf
+static void indexBlock(uint8_t* buf, uint32_t n, uint32_t time) {
+  if (n % stride == 0) {
+    if (indexCount == LOG_INDEX_ENTRIES) {
+      // Keep every other entry; the new block then lands on the doubled stride
+      for (uint16_t i = 0; i < LOG_INDEX_ENTRIES / 2; i++) {
+        memcpy(buf + LOG_INDEX_OFFSET + 4 * i, buf + LOG_INDEX_OFFSET + 8 * i, 4);
+      }
+      indexCount = LOG_INDEX_ENTRIES / 2;
+      stride <<= 1;
+    }
+    putU32(buf + LOG_INDEX_OFFSET + 4 * indexCount, time);
+    indexCount++;
+  }
+}
+
+static void putSuper(uint8_t* buf) {
+  putU32(buf, LOG_SUPER_MAGIC);
+  buf[4] = LOG_VERSION;
+  buf[5] = channelCount;
+  putU16(buf + 6, volume);
+  putU32(buf + 8, capacity);
+  putU32(buf + 12, indexed);
+  putU32(buf + 16, lastTime);
+  putU32(buf + 20, stride);
+  putU16(buf + 24, indexCount);
+  putU16(buf + LOG_SUPER_CRC_OFFSET, crc16(buf, LOG_SUPER_CRC_OFFSET));
+}
+
+// Close the block being filled; sdLogTask() writes it out
+static void sealBlock() {
+  uint8_t* p = putU16(fill.block, LOG_BLOCK_MAGIC);
+  p = putU16(p, volume);
+  p = putU32(p, head);
+  p = putU32(p, fill.startTime);
+  p = putU32(p, fill.endTime);
+  p = putU16(p, fill.used);
+  *p++ = channelCount;
+  *p++ = fill.records;
+  memset(fill.block + LOG_HEADER_SIZE + fill.used, 0, LOG_DATA_SIZE - fill.used);
+  uint16_t crc = crc16(fill.block, LOG_HEADER_CRC_OFFSET);
+  putU16(fill.block + LOG_HEADER_CRC_OFFSET, crc16(fill.block + LOG_HEADER_SIZE, fill.used, crc));
+  fill.step = STEP_DATA;
+}
+
+static uint16_t fillSum() {
+  uint16_t sum = recoveryChecksum(&fill, offsetof(LogFill, sum));
+  if (fill.records > 0) sum += recoveryChecksum(fill.block, LOG_HEADER_SIZE + fill.used);
+  return sum;
+}
+
+// Bring the .noinit copy up to date after the fill state changed
+static void keepFill() {
+  fill.magic = LOG_FILL_MAGIC;
+  fill.volume = volume;
+  fill.seq = head;
+  fill.sum = fillSum();
+}
+
+// Write out the block the previous run was filling, or had sealed and not
+// written yet, before the superblock takes the buffer. Any reset leaves
+// .noinit alone and the checksum rules out garbage, so this holds after a
+// DTR or power glitch as well as a watchdog reset. False if there is
+// nothing to take over, the waiting readings included.
+static bool restoreFill() {
+  if (fill.magic != LOG_FILL_MAGIC || fill.sum != fillSum()) return false;
+  uint8_t super[LOG_SUPER_CRC_OFFSET + 2];
+  if (!readPart(0, 0, sizeof(super), super) || getU32(super) != LOG_SUPER_MAGIC || super[5] != channelCount ||
+      getU16(super + 6) != fill.volume || getU16(super + LOG_SUPER_CRC_OFFSET) != crc16(super, LOG_SUPER_CRC_OFFSET)) {
+    return false;
+  }
+  if (fill.records > 0) {
+    volume = fill.volume;
+    head = fill.seq;
+    if (fill.step != STEP_DATA) sealBlock();
+    uint8_t header[LOG_HEADER_SIZE];
+    if (!readHeader(head, header)) writeCard(head + 1, fill.block);  // Mount then finds it from its header
+  }
+  return true;
+}
+
+bool sdLogBegin(uint8_t csPin, uint8_t channels) {
+  channelCount = channels > LOG_MAX_CHANNELS ? LOG_MAX_CHANNELS : channels;
+  cardPresent = card.init(SPI_FULL_SPEED, csPin);
+  if (!cardPresent) return false;
+  card.partialBlockRead(true);
+
+  bool restored = restoreFill();
+  fill.records = 0;
+  fill.step = STEP_IDLE;
+  if (!restored) fill.waitingCount = 0;
+
+  if (!card.readBlock(0, fill.block)) {
+    errors++;
+    return true;
+  }
+  if (getU32(fill.block) != LOG_SUPER_MAGIC || fill.block[4] != LOG_VERSION || fill.block[5] != channelCount ||
+      getU16(fill.block + LOG_SUPER_CRC_OFFSET) != crc16(fill.block, LOG_SUPER_CRC_OFFSET)) {
+    return true;  // Not ours, or another channel layout: wait for "log format"
+  }
+  volume = getU16(fill.block + 6);
+  capacity = getU32(fill.block + 8);
+  head = getU32(fill.block + 12);
+  lastTime = getU32(fill.block + 16);
+  stride = getU32(fill.block + 20);
+  indexCount = getU16(fill.block + 24);
+
+  // A reset between a data block and its superblock update loses neither
+  uint8_t header[LOG_HEADER_SIZE];
+  bool recovered = false;
+  while (head < capacity && readHeader(head, header)) {
+    lastTime = getU32(header + 12);
+    indexBlock(fill.block, head, getU32(header + 8));
+    head++;
+    recovered = true;
+  }
+  indexed = head;
+  cardStride = getU32(fill.block + 20);
+  cardEntries = getU16(fill.block + 24);
+  if (recovered) {
+    putSuper(fill.block);
+    if (writeCard(0, fill.block)) {
+      cardStride = stride;
+      cardEntries = indexCount;
+    }
+  }
+
+  mounted = true;
+  clockSeconds = head > 0 ? lastTime + 1 : lastTime;
+  if (fill.waitingCount > 0 && fill.waiting[fill.waitingCount - 1].time >= clockSeconds) {
+    clockSeconds = fill.waiting[fill.waitingCount - 1].time + 1;
+  }
+  clockMs = millis();
+  keepFill();
+  return true;
+}
+
+bool sdLogFormat() {
+  if (!cardPresent) return false;
+  uint32_t blocks = card.cardSize();
+  if (blocks < 2) {
+    errors++;
+    return false;
+  }
+
+  // A new volume number orphans every data block of the previous log
+  uint8_t old[8];
+  uint16_t previousVolume = readPart(0, 0, sizeof(old), old) && getU32(old) == LOG_SUPER_MAGIC ? getU16(old + 6) : millis();
+  volume = previousVolume + 1;
+  capacity = blocks - 1;
+  head = indexed = 0;
+  lastTime = sdLogClock();
+  stride = cardStride = 1;
+  indexCount = cardEntries = 0;
+  fill.records = 0;
+  fill.step = STEP_IDLE;
+  superDue = false;
+  fill.waitingCount = 0;
+  readBlock = readEnd = 0;
+
+  memset(fill.block, 0, sizeof(fill.block));
+  putSuper(fill.block);
+  mounted = writeCard(0, fill.block);
+  keepFill();
+  return mounted;
+}
+
+uint32_t sdLogClock() {
+  uint32_t elapsed = millis() - clockMs;
+  if (elapsed >= 1000) {
+    uint32_t seconds = elapsed / 1000;
+    clockSeconds += seconds;
+    clockMs += seconds * 1000;
+  }
+  return clockSeconds;
+}
+
+void sdLogSetTime(uint32_t unixTime) {
+  if (unixTime <= sdLogClock()) return;
+  clockSeconds = unixTime;
+  clockMs = millis();
+}
+
+// Add a record to the block being filled. False if it did not fit: the
+// block is sealed and the record has to wait for the next one.
+static bool addRecord(uint32_t now, const uint16_t* values) {
+  if (head >= capacity) return true;  // Card full, the reading is not kept
+
+  if (fill.records == 0) {
+    fill.startTime = fill.endTime = now;
+    fill.used = 0;
+    memset(fill.previous, 0, sizeof(fill.previous));
+  }
+  uint8_t record[LOG_RECORD_MAX_SIZE];
+  uint8_t* p = putVarint(record, now - fill.endTime);
+  for (uint8_t ch = 0; ch < channelCount; ch++) {
+    int32_t delta = (int32_t)values[ch] - fill.previous[ch];
+    p = putVarint(p, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+  }
+  uint8_t size = p - record;
+
+  if (fill.used + size > LOG_DATA_SIZE || fill.records == 255) {
+    sealBlock();
+    return false;
+  }
+  memcpy(fill.block + LOG_HEADER_SIZE + fill.used, record, size);
+  fill.used += size;
+  fill.records++;
+  fill.endTime = now;
+  memcpy(fill.previous, values, channelCount * sizeof(uint16_t));
+  return true;
+}
+
+static void holdRecord(uint32_t now, const uint16_t* values) {
+  if (fill.waitingCount == LOG_WAITING) {
+    dropped++;
+    return;
+  }
+  WaitingRecord& record = fill.waiting[fill.waitingCount++];
+  record.time = now;
+  memcpy(record.values, values, channelCount * sizeof(uint16_t));
+}
+
+// Move the held readings into the free block, in order
+static void takeWaiting() {
+  uint8_t taken = 0;
+  while (taken < fill.waitingCount && addRecord(fill.waiting[taken].time, fill.waiting[taken].values)) taken++;
+  memmove(fill.waiting, fill.waiting + taken, (fill.waitingCount - taken) * sizeof(WaitingRecord));
+  fill.waitingCount -= taken;
+}
+
+void sdLogAppend(const uint16_t* values) {
+  uint32_t now = sdLogClock();
+  if (!mounted) return;
+  if (fill.step != STEP_IDLE || fill.waitingCount > 0 || !addRecord(now, values)) holdRecord(now, values);
+  keepFill();
+}
+
+void sdLogFlush() {
+  if (!mounted) return;
+  if (fill.step == STEP_IDLE && fill.records > 0) sealBlock();
+  superDue = true;
+  keepFill();
+}
+
+bool sdLogBusy() {
+  return fill.step != STEP_IDLE;
+}
+
+void sdLogTask() {
+  if (fill.step == STEP_IDLE && fill.waitingCount == 0) {
+    if (superDue && head > indexed) {
+      fill.step = STEP_SUPER_READ;
+      keepFill();
+    } else {
+      superDue = false;
+    }
+    return;
+  }
+
+  switch (fill.step) {
+    case STEP_IDLE:
+      takeWaiting();
+      break;
+
+    case STEP_DATA:
+      // A block the card refused is lost, the log carries on with the next
+      if (writeCard(head + 1, fill.block)) {
+        lastTime = fill.endTime;
+        unindexedStart[head - indexed] = fill.startTime;
+        head++;
+      }
+      fill.records = 0;
+      fill.step = head > indexed && (superDue || head - indexed == LOG_SUPER_INTERVAL) ? STEP_SUPER_READ : STEP_IDLE;
+      break;
+
+    case STEP_SUPER_READ:
+      // The data block is on the card, so the buffer is free for the superblock
+      if (!card.readBlock(0, fill.block)) {
+        // Stop rather than let the index drift, the next boot recovers the blocks
+        errors++;
+        mounted = false;
+        fill.step = STEP_IDLE;
+        break;
+      }
+      for (uint32_t n = indexed; n < head; n++) indexBlock(fill.block, n, unindexedStart[n - indexed]);
+      indexed = head;
+      putSuper(fill.block);
+      fill.step = STEP_SUPER_WRITE;
+      break;
+
+    case STEP_SUPER_WRITE:
+      if (writeCard(0, fill.block)) {
+        cardStride = stride;
+        cardEntries = indexCount;
+      } else {
+        mounted = false;  // The RAM index is ahead of the card now
+      }
+      superDue = false;
+      fill.step = STEP_IDLE;
+      break;
+  }
+  keepFill();
+}
+
+void sdLogInfo(SdLogInfo& info) {
+  info.card = cardPresent;
+  info.mounted = mounted;
+  info.capacity = capacity;
+  info.blocks = head;
+  info.lastTime = fill.records > 0 ? fill.endTime : lastTime;
+  info.buffered = fill.records + fill.waitingCount;
+  info.errors = errors;
+  info.dropped = dropped;
+}
+
+bool sdLogSeek(uint32_t from, uint32_t to) {
+  readBlock = readEnd = 0;
+  uint32_t blocks = head + (fill.step == STEP_DATA ? 1 : 0);  // A sealed block is read once written
+  if (!mounted || blocks == 0 || from > to) return false;
+
+  // Last index entry on the card at or before `from`, then the last block
+  // within its stride; the blocks after the last entry, up to the ones not
+  // indexed yet, are all searched
+  uint32_t first = 0;
+  uint32_t last = head > 0 ? head - 1 : 0;
+  if (cardEntries > 0) {
+    uint8_t entry[4];
+    uint16_t low = 0;
+    uint16_t high = cardEntries - 1;
+    while (low < high) {
+      uint16_t mid = (low + high + 1) / 2;
+      if (!readPart(0, LOG_INDEX_OFFSET + 4 * mid, 4, entry)) return false;
+      if (getU32(entry) <= from) low = mid;
+      else high = mid - 1;
+    }
+    first = (uint32_t)low * cardStride;
+    if (low < cardEntries - 1 && first + cardStride - 1 < last) last = first + cardStride - 1;
+  }
+  while (first < last) {
+    uint32_t mid = first + (last - first + 1) / 2;
+    if (blockStart(mid) <= from) first = mid;
+    else last = mid - 1;
+  }
+
+  readBlock = first;
+  readEnd = blocks;
+  readTo = to;
+  readOffset = 0;
+  readSize = 0;
+  return true;
+}
+
+uint8_t sdLogReadChunk(uint8_t* out) {
+  if (readBlock >= readEnd) return 0;
+
+  if (readSize == 0) {
+    uint8_t header[LOG_HEADER_SIZE];
+    if (!readHeader(readBlock, header) || getU32(header + 8) > readTo) {
+      readBlock = readEnd;
+      return 0;
+    }
+    readSize = LOG_HEADER_SIZE + getU16(header + 16);
+  }
+
+  uint16_t count = readSize - readOffset;
+  if (count > LOG_CHUNK_SIZE) count = LOG_CHUNK_SIZE;
+  uint8_t* p = putU32(out, readBlock);
+  p = putU16(p, readOffset);
+  if (!readPart(readBlock + 1, readOffset, count, p)) {
+    readBlock = readEnd;
+    return 0;
+  }
+
+  readOffset += count;
+  if (readOffset >= readSize) {
+    readBlock++;
+    readOffset = 0;
+    readSize = 0;
+  }
+  return (p - out) + count;
+}
+
+uint32_t sdLogRemaining() {
+  return readEnd - readBlock;
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef SD_LOG_H
+#define SD_LOG_H
+
+#include <stdint.h>
+
+// Append-only SD card log of the readings (SD_LOG).
+//
+// The card is used as a raw block device, not a FAT volume, so a block
+// write costs one SPI transfer and the only RAM needed is the one 512-byte
+// block being filled. "log format" claims the card; its previous contents
+// are lost.
+//
+// Block 0 is the superblock and time index, data block n is card block
+// n + 1. sdLogTask() does the card writes, one card operation per pass: the
+// filled block, then every 8 data blocks (or on a flush) the
+// superblock. Blocks written since its last update are found again from
+// their headers at mount. Readings that arrive while a block is on its way
+// are held in RAM, a few of them; the rest are counted as dropped, which
+// only happens when one card write stalls for several readings. The block
+// being filled and the held readings are kept in .noinit under a checksum,
+// so after any reset, a DTR pulse included, sdLogBegin() writes them out
+// rather than losing up to a block of readings. Timestamps are seconds of the log clock, which continues from the
+// newest logged record after a reboot so they always increase. Once the
+// wall clock is set the log clock follows it, and times are Unix seconds.
+//
+// Superblock (multi-byte fields little-endian):
+//   0 magic u32 "AQLG", 4 version u8, 5 channels u8, 6 volume u16,
+//   8 capacity u32 (data blocks), 12 head u32 (data blocks indexed),
+//   16 lastTime u32, 20 stride u32, 24 indexCount u16, 26 crc16 u16,
+//   32 index: startTime u32 of data blocks 0, stride, 2 * stride, ...
+// When the index fills, every other entry is dropped and stride doubles,
+// so a seek reads at most log2(LOG_INDEX_ENTRIES) + log2(stride) blocks.
+//
+// Data block:
+//   0 magic u16, 2 volume u16, 4 seq u32 (data block number),
+//   8 startTime u32, 12 endTime u32, 16 used u16 (record bytes),
+//   18 channels u8, 19 count u8, 20 crc16 u16 over bytes 0-19 and the records,
+//   22 records: dt (seconds since the previous record, 0 for the first) as
+//   a varint, then per channel a zig-zag varint delta from the previous
+//   record (from 0 for the first), in wire units (serialProtocol.h).
+// The volume number changes on every format, so blocks left over from an
+// earlier log are never mistaken for new ones.
+#define LOG_BLOCK_SIZE 512
+#define LOG_HEADER_SIZE 22
+#define LOG_MAX_CHANNELS 5
+#define LOG_RECORD_MAX_SIZE (5 + 3 * LOG_MAX_CHANNELS)
+#define LOG_INDEX_ENTRIES 120
+#define LOG_CHUNK_SIZE 128  // Block bytes per FRAME_TYPE_LOG frame
+
+struct SdLogInfo {
+  bool card;       // A card answered at boot
+  bool mounted;    // It holds a log with matching channels
+  uint32_t capacity;
+  uint32_t blocks;  // Data blocks written
+  uint32_t lastTime;
+  uint8_t buffered;  // Records waiting in RAM for the block to fill
+  uint16_t errors;   // Failed card operations
+  uint16_t dropped;  // Readings that found the block and the waiting slots busy
+};
+
+// Start the card and mount the log on it. Returns false without a card;
+// an unformatted card is left alone until sdLogFormat().
+bool sdLogBegin(uint8_t csPin, uint8_t channels);
+
+// Start a new, empty log on the card
+bool sdLogFormat();
+
+// Current log clock, seconds
+uint32_t sdLogClock();
+
+// Move the log clock forward to a Unix time; it never goes back
+void sdLogSetTime(uint32_t unixTime);
+
+// Buffer one reading; sdLogTask() writes the block out when it is full
+void sdLogAppend(const uint16_t* values);
+
+// Have a partly filled block and the superblock written out so they can be
+// read back
+void sdLogFlush();
+
+// One step of the pending card work: a data block or superblock read or
+// write, or moving held readings into the free block. Cheap when idle.
+void sdLogTask();
+
+// A block or superblock write is under way; streaming waits for it
+bool sdLogBusy();
+
+void sdLogInfo(SdLogInfo& info);
+
+// Select the blocks that may hold records in [from, to] for streaming
+bool sdLogSeek(uint32_t from, uint32_t to);
+
+// Read the next chunk of the selected blocks into a FRAME_TYPE_LOG payload.
+// Returns its size, 0 once the range is done or on a card error.
+uint8_t sdLogReadChunk(uint8_t* out);
+
+// Data blocks left to stream
+uint32_t sdLogRemaining();
+
+#endif
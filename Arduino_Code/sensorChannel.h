@@ -0,0 +1,103 @@
+#ifndef SENSOR_CHANNEL_H
+#define SENSOR_CHANNEL_H
+
+#include <stdint.h>
+
+#include "config.h"
+#include "ppmConversion.h"
+#include "sensorFilter.h"
+#include "serialProtocol.h"
+
+// Compile-time sensor channels.
+//
+// A channel is a SensorChannel<Pin, Curve, Limits>: the analog pin it is
+// scanned on, a curve policy that turns filtered counts into ppm and a limits
+// policy holding the range kept and the wire scale. Policies are plain types
+// with static members, so a channel's conversion, clamping and serialization
+// are resolved and inlined where they are used; there are no virtual calls
+// and a channel costs only its filter and last reading in SRAM.
+//
+// Readings that do not come from the ADC (a PM sensor on a UART) go through
+// a ValueChannel<Limits>, which has the same ppm()/deci()/wire() interface
+// and is fed by its driver, so the formatting code treats both alike.
+
+// Curves: convert(countsQ4) from the PROGMEM tables, calibration applied
+struct Mq7Curve {
+  static const GasSensor sensor = GAS_MQ7;
+  static ppm_t convert(uint16_t countsQ4) { return calculateCOppm(countsQ4); }
+};
+
+struct Mq135Curve {
+  static const GasSensor sensor = GAS_MQ135;
+  static ppm_t convert(uint16_t countsQ4) { return calculateAirQualityppm(countsQ4); }
+};
+
+struct Mq4Curve {
+  static const GasSensor sensor = GAS_MQ4;
+  static ppm_t convert(uint16_t countsQ4) { return calculateCH4ppm(countsQ4); }
+};
+
+// Limits: the range a reading is clamped to, in tenths, and its wire scale
+template <int32_t MinDeci, int32_t MaxDeci, uint8_t WireScale>
+struct ChannelLimits {
+  static const uint8_t wireScale = WireScale;
+
+  static ppm_t clamp(ppm_t value) {
+    const ppm_t low = PPM(MinDeci / 10.0);
+    const ppm_t high = PPM(MaxDeci / 10.0);
+    return value < low ? low : value > high ? high : value;
+  }
+};
+
+typedef ChannelLimits<1, 10000, WIRE_SCALE_CO> CoLimits;              // 0.1 - 1000 ppm
+typedef ChannelLimits<5000, 100000, WIRE_SCALE_CH4> Ch4Limits;        // 500 - 10000 ppm
+typedef ChannelLimits<4000, 50000, WIRE_SCALE_AQ> AirQualityLimits;  // 400 - 5000 ppm
+typedef ChannelLimits<0, 10000, WIRE_SCALE_PM> PmLimits;              // 0 - 1000 ug/m3
+
+// Last reading of a channel and its serialized forms
+template <typename Limits>
+class ValueChannel {
+public:
+  ValueChannel() : reading(0) {}
+
+  void set(ppm_t value) { reading = Limits::clamp(value); }
+  void setUnits(uint16_t value) { set((ppm_t)value * PPM(1)); }  // Whole units, e.g. ug/m3
+
+  ppm_t ppm() const { return reading; }
+  int32_t deci() const { return ppmToDeci(reading); }
+  uint16_t wire() const { return toWireUnits(deci(), Limits::wireScale); }
+
+private:
+  ppm_t reading;
+};
+
+template <uint8_t Pin, typename Curve, typename Limits>
+class SensorChannel : public ValueChannel<Limits> {
+public:
+  static const uint8_t pin = Pin;
+  static const GasSensor sensor = Curve::sensor;
+
+  SensorChannel() : filter(FILTER_OVERSAMPLE_LOG2, FILTER_MODE, FILTER_EMA_SHIFT), raw(0) {}
+
+  // Counts to clamped ppm, without touching the channel
+  static ppm_t convert(uint16_t countsQ4) { return Limits::clamp(Curve::convert(countsQ4)); }
+
+  // One raw ADC sample from the scan
+  void push(uint16_t sample) {
+    raw = sample;
+    filter.push(sample);
+  }
+
+  // Convert the live filter value, or counts latched elsewhere (MQ-7 heater cycle)
+  void update() { update(filter.value()); }
+  void update(uint16_t countsQ4) { this->set(Curve::convert(countsQ4)); }
+
+  uint16_t lastRaw() const { return raw; }
+  uint16_t filtered() const { return filter.value(); }
+
+private:
+  SensorFilter filter;
+  uint16_t raw;
+};
+
+#endif
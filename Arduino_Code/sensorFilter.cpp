@@ -0,0 +1,82 @@
+#include "sensorFilter.h"
+
+SensorFilter::SensorFilter(uint8_t oversampleLog2, uint8_t mode, uint8_t emaShift)
+    : oversampleLog2(oversampleLog2 > FILTER_MAX_OVERSAMPLE_LOG2 ? FILTER_MAX_OVERSAMPLE_LOG2 : oversampleLog2),
+      mode(mode),
+      emaShift(emaShift) {
+  reset();
+}
+
+void SensorFilter::reset() {
+  accumulator = 0;
+  count = 0;
+  primed = false;
+  output = 0;
+  emaState = 0;
+  tapIndex = 0;
+}
+
+// Scale a sum of 2^oversampleLog2 samples to counts << FILTER_FRAC_BITS
+uint16_t SensorFilter::decimate(uint16_t sum) const {
+  if (oversampleLog2 <= FILTER_FRAC_BITS) {
+    return sum << (FILTER_FRAC_BITS - oversampleLog2);
+  }
+  uint8_t shift = oversampleLog2 - FILTER_FRAC_BITS;
+  return (uint16_t)(((uint32_t)sum + (1u << (shift - 1))) >> shift);
+}
+
+uint16_t SensorFilter::median() const {
+  // Insertion sort of a copy, 5 taps is cheaper than any clever structure
+  uint16_t sorted[FILTER_MEDIAN_TAPS];
+  for (uint8_t i = 0; i < FILTER_MEDIAN_TAPS; i++) {
+    uint16_t v = taps[i];
+    uint8_t j = i;
+    while (j > 0 && sorted[j - 1] > v) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = v;
+  }
+  return sorted[FILTER_MEDIAN_TAPS / 2];
+}
+
+bool SensorFilter::push(uint16_t raw) {
+  if (!primed) {
+    // Show the raw value until the first full decimation window
+    output = raw << FILTER_FRAC_BITS;
+  }
+
+  accumulator += raw;
+  if (++count < (1u << oversampleLog2)) return false;
+
+  uint16_t decimated = decimate(accumulator);
+  accumulator = 0;
+  count = 0;
+
+  switch (mode) {
+    case FILTER_EMA:
+      if (!primed) {
+        emaState = (uint32_t)decimated << emaShift;
+      } else {
+        emaState = emaState - (emaState >> emaShift) + decimated;
+      }
+      output = emaState >> emaShift;
+      break;
+
+    case FILTER_MEDIAN:
+      if (!primed) {
+        for (uint8_t i = 0; i < FILTER_MEDIAN_TAPS; i++) taps[i] = decimated;
+      }
+      taps[tapIndex] = decimated;
+      if (++tapIndex >= FILTER_MEDIAN_TAPS) tapIndex = 0;
+      output = median();
+      break;
+
+    default:
+      output = decimated;
+      break;
+  }
+
+  primed = true;
+  return true;
+}
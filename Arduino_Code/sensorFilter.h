@@ -0,0 +1,52 @@
+#ifndef SENSOR_FILTER_H
+#define SENSOR_FILTER_H
+
+#include <stdint.h>
+
+// Per-channel oversample-and-decimate filter, integer math only.
+//
+// Every raw 10-bit sample is added to an accumulator; after 2^oversampleLog2
+// samples the sum is decimated into one output value, optionally smoothed
+// further by an EMA or a 5-tap moving median. Outputs carry FILTER_FRAC_BITS
+// fractional bits (ADC counts << 4), so oversampling gains resolution instead
+// of throwing it away. push() costs one add and a compare on most calls.
+#define FILTER_FRAC_BITS 4
+#define FILTER_MAX_OVERSAMPLE_LOG2 6  // 64 * 1023 still fits in 16 bits
+
+#define FILTER_NONE 0    // Decimation only
+#define FILTER_EMA 1     // Exponential moving average, alpha = 1 / 2^emaShift
+#define FILTER_MEDIAN 2  // Median of the last FILTER_MEDIAN_TAPS decimated values
+
+#define FILTER_MEDIAN_TAPS 5
+
+class SensorFilter {
+public:
+  SensorFilter(uint8_t oversampleLog2, uint8_t mode, uint8_t emaShift);
+
+  void reset();
+
+  // Add one raw ADC sample, returns true when a new output value is ready
+  bool push(uint16_t raw);
+
+  // Latest output in ADC counts << FILTER_FRAC_BITS
+  uint16_t value() const { return output; }
+
+private:
+  uint16_t decimate(uint16_t sum) const;
+  uint16_t median() const;
+
+  uint8_t oversampleLog2;
+  uint8_t mode;
+  uint8_t emaShift;
+
+  uint16_t accumulator;
+  uint8_t count;
+  bool primed;  // False until the first decimated value
+  uint16_t output;
+
+  uint32_t emaState;  // Output << emaShift
+  uint16_t taps[FILTER_MEDIAN_TAPS];
+  uint8_t tapIndex;
+};
+
+#endif
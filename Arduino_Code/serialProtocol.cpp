@@ -0,0 +1,211 @@
+#include "serialProtocol.h"
+#include "batchBuffer.h"
+
+#include <string.h>
+
+// CRC-16/CCITT-FALSE, bitwise so it needs no lookup table in flash
+uint16_t crc16Update(uint16_t crc, uint8_t data) {
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+uint16_t toWireUnits(int32_t deciPpm, uint8_t scale) {
+  if (deciPpm <= 0) return 0;
+  int32_t scaled = (deciPpm * scale + 5) / 10;
+  return scaled >= 65535 ? 65535 : (uint16_t)scaled;
+}
+
+static uint8_t* putU16(uint8_t* p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t* putU32(uint8_t* p, uint32_t v) {
+  p = putU16(p, v & 0xFFFF);
+  return putU16(p, v >> 16);
+}
+
+uint8_t encodeSamplePayload(uint8_t* out, const SampleRecord& sample) {
+  uint8_t* p = out;
+  p = putU16(p, sample.seq);
+  p = putU16(p, sample.mq7Raw);
+  p = putU16(p, sample.mq135Raw);
+  p = putU16(p, sample.mq4Raw);
+  p = putU16(p, sample.co);
+  p = putU16(p, sample.ch4);
+  p = putU16(p, sample.airQuality);
+  *p++ = sample.flags;
+  *p++ = sample.stability;
+  p = putU32(p, sample.time);
+  return p - out;
+}
+
+uint8_t encodeBatchPayload(uint8_t* out, uint32_t nowMs, const BatchBuffer& batch, uint8_t first, uint8_t count) {
+  if (count > BATCH_MAX_RECORDS) count = BATCH_MAX_RECORDS;
+
+  uint8_t* p = putU32(out, nowMs);
+  *p++ = count;
+  for (uint8_t i = 0; i < count; i++) {
+    const BatchRecord& record = batch.at(first + i);
+    p = putU16(p, record.seq);
+    p = putU32(p, record.timeMs);
+    p = putU16(p, record.co);
+    p = putU16(p, record.ch4);
+    p = putU16(p, record.airQuality);
+    *p++ = record.flags;
+  }
+  return p - out;
+}
+
+static uint8_t* putVarint(uint8_t* p, uint32_t v) {
+  while (v >= 0x80) {
+    *p++ = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+uint8_t encodeDeltaBatchPayload(uint8_t* out, uint8_t capacity, uint32_t nowMs, const BatchBuffer& batch,
+                                uint8_t first, uint8_t* count) {
+  uint8_t* p = putU32(out, nowMs);
+  uint8_t* countField = p++;
+  const uint8_t* end = out + capacity;
+
+  const BatchRecord* previous = NULL;
+  uint32_t interval = 0;
+  uint8_t encoded = 0;
+  for (; encoded < *count; encoded++) {
+    const BatchRecord& record = batch.at(first + encoded);
+    uint8_t scratch[DELTA_RECORD_MAX_SIZE];
+    uint8_t* r = scratch + 1;
+    uint8_t head = record.flags & DELTA_HEAD_FLAGS;
+
+    if (encoded % BATCH_KEYFRAME_INTERVAL == 0) {
+      head |= DELTA_HEAD_KEY;
+      r = putVarint(r, record.seq);
+      r = putVarint(r, record.timeMs);
+      r = putVarint(r, record.co);
+      r = putVarint(r, record.ch4);
+      r = putVarint(r, record.airQuality);
+      interval = 0;
+    } else {
+      uint16_t step = record.seq - previous->seq;
+      uint32_t elapsed = record.timeMs - previous->timeMs;
+      if (step == 1 && elapsed == interval) {
+        head |= DELTA_HEAD_STEADY;
+      } else {
+        r = putVarint(r, step);
+        r = putVarint(r, zigzag((int32_t)(elapsed - interval)));
+      }
+      interval = elapsed;
+
+      const uint16_t values[3] = { record.co, record.ch4, record.airQuality };
+      const uint16_t before[3] = { previous->co, previous->ch4, previous->airQuality };
+      for (uint8_t i = 0; i < 3; i++) {
+        if (values[i] == before[i]) continue;
+        head |= 1 << (DELTA_HEAD_CHANNEL_SHIFT + i);
+        r = putVarint(r, zigzag((int32_t)values[i] - before[i]));
+      }
+    }
+    scratch[0] = head;
+
+    uint8_t size = r - scratch;
+    if (p + size > end) break;
+    memcpy(p, scratch, size);
+    p += size;
+    previous = &record;
+  }
+
+  *countField = encoded;
+  *count = encoded;
+  return p - out;
+}
+
+uint8_t encodeFrame(uint8_t* out, uint8_t type, const uint8_t* payload, uint8_t len) {
+  out[0] = FRAME_SYNC;
+  out[1] = type;
+  out[2] = len;
+  memmove(out + FRAME_HEADER_SIZE, payload, len);
+
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 1; i < FRAME_HEADER_SIZE + len; i++) {
+    crc = crc16Update(crc, out[i]);
+  }
+  putU16(out + FRAME_HEADER_SIZE + len, crc);
+  return len + FRAME_OVERHEAD;
+}
+
+bool decodePollPayload(const uint8_t* payload, uint8_t len, BusPoll& poll) {
+  if (len < BUS_POLL_PAYLOAD_SIZE) return false;
+  poll.node = payload[0];
+  poll.flags = payload[1];
+  poll.ackSeq = payload[2] | ((uint16_t)payload[3] << 8);
+  poll.time = 0;
+  if (poll.flags & BUS_POLL_TIME) {
+    if (len < BUS_POLL_TIME_SIZE) return false;
+    poll.time = payload[4] | ((uint16_t)payload[5] << 8) | ((uint32_t)payload[6] << 16) | ((uint32_t)payload[7] << 24);
+  }
+  return true;
+}
+
+FrameReader::FrameReader() : errors(0) {
+  reset();
+}
+
+void FrameReader::reset() {
+  state = WAIT_SYNC;
+}
+
+bool FrameReader::feed(uint8_t data) {
+  switch (state) {
+    case WAIT_SYNC:
+      if (data == FRAME_SYNC) {
+        crc = 0xFFFF;
+        state = TYPE;
+      }
+      return false;
+
+    case TYPE:
+      frameType = data;
+      crc = crc16Update(crc, data);
+      state = LENGTH;
+      return false;
+
+    case LENGTH:
+      frameLength = data;
+      received = 0;
+      crc = crc16Update(crc, data);
+      state = frameLength > 0 ? PAYLOAD : CRC_LOW;
+      return false;
+
+    case PAYLOAD:
+      if (received < FRAME_READER_MAX_PAYLOAD) buffer[received] = data;
+      received++;
+      crc = crc16Update(crc, data);
+      if (received == frameLength) state = CRC_LOW;
+      return false;
+
+    case CRC_LOW:
+      crcLow = data;
+      state = CRC_HIGH;
+      return false;
+
+    case CRC_HIGH:
+      state = WAIT_SYNC;
+      if ((crcLow | ((uint16_t)data << 8)) != crc) {
+        errors++;
+        return false;
+      }
+      return frameLength <= FRAME_READER_MAX_PAYLOAD;
+  }
+  return false;
+}
@@ -0,0 +1,194 @@
+#ifndef SERIAL_PROTOCOL_H
+#define SERIAL_PROTOCOL_H
+
+#include <stdint.h>
+
+// Binary framing shared with backend/utils/frameDecoder.js
+//
+// Frame layout (multi-byte fields are little-endian):
+//   [0xA5][type][len][payload: len bytes][crc lo][crc hi]
+// The CRC is CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) over type, len
+// and payload. A receiver that sees a bad CRC drops one byte and hunts for
+// the next sync byte, so JSON lines and frames can share the same link.
+#define FRAME_SYNC 0xA5
+#define FRAME_HEADER_SIZE 3
+#define FRAME_OVERHEAD 5  // sync + type + len + crc16
+#define FRAME_MAX_PAYLOAD 250
+
+// Frame types
+#define FRAME_TYPE_SAMPLE 0x01
+#define FRAME_TYPE_BATCH 0x02
+#define FRAME_TYPE_STATS 0x03
+#define FRAME_TYPE_POLL 0x04  // Gateway -> node, see busLink.h
+#define FRAME_TYPE_NODE 0x05  // Node -> gateway, wraps another frame's payload
+#define FRAME_TYPE_BATCH_DELTA 0x06
+#define FRAME_TYPE_SUMMARY 0x07
+#define FRAME_TYPE_PM 0x08
+#define FRAME_TYPE_LOG 0x09
+
+// SampleRecord flags
+#define SAMPLE_FLAG_WARMING 0x01  // Sensors still warming up, see stability
+#define SAMPLE_FLAG_HEATER_LOW 0x02  // MQ-7 heater in its measuring phase (MQ7_HEATER_CYCLE)
+
+// Fixed-point scaling of the ppm values on the wire
+#define WIRE_SCALE_CO 10   // CO in 0.1 ppm
+#define WIRE_SCALE_CH4 1   // CH4 in ppm
+#define WIRE_SCALE_AQ 1    // MQ135 in ppm
+#define WIRE_SCALE_PM 1    // PM2.5 and PM10 in ug/m3
+
+// One sensor sample as carried by a FRAME_TYPE_SAMPLE frame
+struct SampleRecord {
+  uint16_t seq;        // Increments per transmitted sample, wraps at 65535
+  uint16_t mq7Raw;     // ADC counts
+  uint16_t mq135Raw;
+  uint16_t mq4Raw;
+  uint16_t co;         // WIRE_SCALE_CO units
+  uint16_t ch4;        // WIRE_SCALE_CH4 units
+  uint16_t airQuality; // WIRE_SCALE_AQ units
+  uint8_t flags;       // SAMPLE_FLAG_*
+  uint8_t stability;   // Warm-up stability 0-100
+  uint32_t time;       // Unix seconds when sent, 0 until the clock is set (wallClock.h)
+};
+
+#define SAMPLE_PAYLOAD_SIZE 20
+#define SAMPLE_FRAME_SIZE (SAMPLE_PAYLOAD_SIZE + FRAME_OVERHEAD)
+
+// A FRAME_TYPE_BATCH payload is a header followed by `count` records:
+//   header: nowMs u32 (device millis() at send), count u8
+//   record: seq u16, timeMs u32, co u16, ch4 u16, airQuality u16, flags u8
+// The host timestamps each record as its receive time - (nowMs - timeMs).
+#define BATCH_HEADER_SIZE 5
+#define BATCH_RECORD_SIZE 13
+#define BATCH_MAX_RECORDS ((FRAME_MAX_PAYLOAD - BATCH_HEADER_SIZE) / BATCH_RECORD_SIZE)
+
+// A FRAME_TYPE_STATS payload (profiler.h), all counters since boot or "stats reset":
+//   sectionCount u8, then per section: count u32, min u32, max u32, mean u32 (CPU cycles)
+//   bucketCount u8, then per loop histogram bucket: iterations u16
+//   rxOverflows u16, rxFull u16, adcOverruns u16, freeRam u16, minFreeRam u16
+// Sections are readSensors, updateDisplay, sendDataToPC, receiveFromServer.
+
+// A FRAME_TYPE_SUMMARY payload (rollingStats.h), values in wire units:
+//   nowMs u32, windowCount u8, channelCount u8, then per window:
+//   seconds u16, readings u16, then per channel (co, ch4, airQuality):
+//   min u16, max u16, mean u16, stddev u16
+// A window without readings is sent with all values 0.
+#define SUMMARY_PAYLOAD_SIZE 90
+
+// A FRAME_TYPE_PM payload (PM_SENSOR), sent for every frame from the sensor:
+//   pm1 u16, pm25 u16, pm10 u16 (ug/m3), then particle counts per 0.1 L
+//   above 0.3, 0.5, 1, 2.5, 5 and 10 um, u16 each
+#define PM_PAYLOAD_SIZE 18
+
+// A FRAME_TYPE_LOG payload (SD_LOG) carries part of a logged data block in
+// reply to "log read": block u32, offset u16, then the block's bytes from
+// offset on. Blocks are sent in order, each from its header to the end of
+// its records; the block layout is in sdLog.h.
+#define LOG_FRAME_HEADER_SIZE 6
+
+// A FRAME_TYPE_BATCH_DELTA payload carries the same records as a batch,
+// delta coded. The header matches FRAME_TYPE_BATCH; each record starts with
+//   head u8: bit 7 KEY, bit 6 STEADY, bits 5-3 changed channels (co, ch4,
+//            airQuality), bits 2-0 sample flags
+// KEY records carry seq, timeMs, co, ch4 and airQuality as unsigned varints
+// and reset the previous interval to 0. Other records carry, unless STEADY
+// (seq + 1 and the same interval as before), the seq step as a varint and
+// the change of interval as a zig-zag varint, then a zig-zag varint delta
+// for every changed channel. Varints are LEB128, 7 bits per byte, low first.
+// The first record and every BATCH_KEYFRAME_INTERVAL-th are KEY records.
+#define BATCH_KEYFRAME_INTERVAL 32
+#define DELTA_HEAD_KEY 0x80
+#define DELTA_HEAD_STEADY 0x40
+#define DELTA_HEAD_CHANNEL_SHIFT 3
+#define DELTA_HEAD_FLAGS 0x07
+// Worst case of either record kind: head 1, seq (or seq step) 3, timeMs
+// (or zig-zag interval change) 5, three channels 3 each; a zig-zag delta of
+// two u16 values is below 2^17 and still fits three varint bytes
+#define DELTA_RECORD_MAX_SIZE 18
+
+// Addressed bus frames (BUS_MODE). Only the polled node transmits, so the
+// line is collision-free without any arbitration.
+//   FRAME_TYPE_POLL payload: node u8, flags u8, ackSeq u16[, time u32]
+//     BUS_POLL_ACK set: the gateway stored every record up to ackSeq
+//     BUS_POLL_TIME set: time follows, the gateway's Unix time for the
+//     node's clock (nodes have no host link to get "time" from)
+//   FRAME_TYPE_NODE payload: node u8, inner type u8, inner payload
+//     The reply to a poll is a FRAME_TYPE_BATCH, or a FRAME_TYPE_BATCH_DELTA
+//     once "batch ... delta" is set, with no records when idle. The inner
+//     payload holds as many records as fit after the node header.
+#define BUS_POLL_PAYLOAD_SIZE 4
+#define BUS_POLL_ACK 0x01
+#define BUS_POLL_TIME 0x02
+#define BUS_POLL_TIME_SIZE 8  // Payload size with the time
+#define BUS_NODE_HEADER_SIZE 2
+
+struct BusPoll {
+  uint8_t node;
+  uint8_t flags;
+  uint16_t ackSeq;
+  uint32_t time;  // With BUS_POLL_TIME, else 0
+};
+
+class BatchBuffer;
+
+uint16_t crc16Update(uint16_t crc, uint8_t data);
+
+// Convert a value in 0.1 ppm units to its 16-bit wire representation (saturating)
+uint16_t toWireUnits(int32_t deciPpm, uint8_t scale);
+
+// Serialize a sample into out[SAMPLE_PAYLOAD_SIZE], returns bytes written
+uint8_t encodeSamplePayload(uint8_t* out, const SampleRecord& sample);
+
+// Serialize batch records [first, first + count), at most BATCH_MAX_RECORDS.
+// Returns bytes written.
+uint8_t encodeBatchPayload(uint8_t* out, uint32_t nowMs, const BatchBuffer& batch, uint8_t first, uint8_t count);
+
+// Delta-code batch records [first, first + *count) into at most capacity
+// bytes. *count is updated to the number of records that fit.
+// Returns bytes written.
+uint8_t encodeDeltaBatchPayload(uint8_t* out, uint8_t capacity, uint32_t nowMs, const BatchBuffer& batch,
+                                uint8_t first, uint8_t* count);
+
+// Wrap a payload into a frame; out must hold len + FRAME_OVERHEAD bytes.
+// Returns the total frame size.
+uint8_t encodeFrame(uint8_t* out, uint8_t type, const uint8_t* payload, uint8_t len);
+
+// Parse a FRAME_TYPE_POLL payload, false if it is too short
+bool decodePollPayload(const uint8_t* payload, uint8_t len, BusPoll& poll);
+
+// Incremental decoder for frames sent to the device.
+//
+// Bytes are fed one at a time. Only payloads of up to FRAME_READER_MAX_PAYLOAD
+// bytes are kept; longer frames (replies from other nodes on a shared bus)
+// are counted through and dropped without being stored.
+#define FRAME_READER_MAX_PAYLOAD 16
+
+class FrameReader {
+public:
+  FrameReader();
+
+  // Forget a partial frame, e.g. after a gap on the line
+  void reset();
+
+  // Feed one received byte, returns true when a stored frame with a valid CRC is complete
+  bool feed(uint8_t data);
+
+  uint8_t type() const { return frameType; }
+  const uint8_t* payload() const { return buffer; }
+  uint8_t length() const { return frameLength; }
+
+  uint16_t crcErrors() const { return errors; }
+
+private:
+  enum State : uint8_t { WAIT_SYNC, TYPE, LENGTH, PAYLOAD, CRC_LOW, CRC_HIGH };
+
+  State state;
+  uint8_t frameType;
+  uint8_t frameLength;
+  uint8_t received;
+  uint16_t crc;
+  uint8_t crcLow;
+  uint16_t errors;
+  uint8_t buffer[FRAME_READER_MAX_PAYLOAD];
+};
+
+#endif
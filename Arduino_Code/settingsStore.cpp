@@ -0,0 +1,29 @@
+#include <avr/eeprom.h>
+#include <stddef.h>
+
+#include "serialProtocol.h"
+#include "settingsStore.h"
+
+static uint16_t settingsCrc(const DeviceSettings& settings) {
+  const uint8_t* bytes = (const uint8_t*)&settings;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < offsetof(DeviceSettings, crc); i++) {
+    crc = crc16Update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+bool settingsLoad(DeviceSettings& settings) {
+  eeprom_read_block(&settings, (const void*)SETTINGS_EEPROM_BASE, sizeof(settings));
+  return settings.version == SETTINGS_VERSION && settings.crc == settingsCrc(settings);
+}
+
+void settingsSave(DeviceSettings& settings) {
+  settings.version = SETTINGS_VERSION;
+  settings.crc = settingsCrc(settings);
+  eeprom_update_block(&settings, (void*)SETTINGS_EEPROM_BASE, sizeof(settings));
+}
+
+void settingsClear() {
+  eeprom_update_byte((uint8_t*)SETTINGS_EEPROM_BASE, 0xFF);
+}
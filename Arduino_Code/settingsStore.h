@@ -0,0 +1,41 @@
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+
+#include <stdint.h>
+
+#include "calibrationStore.h"
+
+// Runtime settings kept in EEPROM.
+//
+// One CRC-checked record after the calibration slots. Settings only change
+// when the server pushes a new configuration, and eeprom_update_block() skips
+// the bytes that did not change, so no wear levelling is needed. A missing or
+// corrupt record leaves the compiled defaults in place.
+#define SETTINGS_EEPROM_BASE (CALIBRATION_EEPROM_BASE + CALIBRATION_SLOTS * CALIBRATION_SLOT_SIZE)
+#define SETTINGS_VERSION 1
+
+struct DeviceSettings {
+  uint8_t version;
+  uint32_t samplePeriod;    // ms between readSensors() ticks
+  uint32_t transmitPeriod;  // ms between interval transmissions
+  uint32_t displayPeriod;   // ms between OLED refreshes
+  uint16_t deadbands[3];    // Report-on-change deadbands in wire units
+  uint32_t heartbeatMs;
+  uint8_t batchSize;
+  uint8_t batchEncoding;
+  uint8_t protocol;
+  uint8_t reportOnChange;
+  uint8_t displayPower;
+  uint16_t crc;
+};
+
+// Stored settings, false when the EEPROM holds none
+bool settingsLoad(DeviceSettings& settings);
+
+// Write the settings; version and crc are filled in
+void settingsSave(DeviceSettings& settings);
+
+// Invalidate the stored record so the next boot uses the defaults
+void settingsClear();
+
+#endif
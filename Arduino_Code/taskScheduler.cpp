@@ -0,0 +1,85 @@
+#include <Arduino.h>
+
+#include "taskScheduler.h"
+
+static Task* taskTable = NULL;
+static uint8_t taskCount = 0;
+static uint8_t running __attribute__((section(".noinit")));
+
+void schedulerBegin(Task* tasks, uint8_t count, uint32_t now) {
+  taskTable = tasks;
+  taskCount = count;
+  running = SCHEDULER_IDLE;
+  for (uint8_t i = 0; i < taskCount; i++) {
+    taskTable[i].nextRun = now;
+  }
+  schedulerResetStats();
+}
+
+void schedulerRun(uint32_t now) {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    Task& task = taskTable[i];
+    if (!task.enabled) continue;
+
+    if (task.period != 0) {
+      int32_t lateness = (int32_t)(now - task.nextRun);
+      if (lateness < 0) continue;
+
+      if ((uint32_t)lateness > task.maxLateness) task.maxLateness = lateness;
+      if ((uint32_t)lateness > task.deadline) task.overruns++;
+
+      task.nextRun += task.period;
+      if ((int32_t)(now - task.nextRun) >= 0) {
+        // A whole period behind, resynchronise instead of catching up
+        task.nextRun = now + task.period;
+      }
+    }
+
+    uint32_t start = micros();
+    running = i;
+    task.run();
+    running = SCHEDULER_IDLE;
+    uint32_t duration = micros() - start;
+
+    task.runs++;
+    if (duration > task.maxDuration) task.maxDuration = duration;
+
+    // Tasks may take a while, keep later tasks' lateness honest
+    now = millis();
+  }
+}
+
+void schedulerSetPeriod(Task& task, uint32_t period, uint32_t now) {
+  task.period = period;
+  task.nextRun = now + period;
+}
+
+void schedulerRunNow(Task& task, uint32_t now) {
+  task.nextRun = now;
+}
+
+void schedulerSetEnabled(Task& task, bool enabled, uint32_t now) {
+  if (enabled && !task.enabled) task.nextRun = now + task.period;
+  task.enabled = enabled;
+}
+
+void schedulerResetStats() {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    taskTable[i].runs = 0;
+    taskTable[i].overruns = 0;
+    taskTable[i].maxLateness = 0;
+    taskTable[i].maxDuration = 0;
+  }
+}
+
+Task* schedulerTasks() {
+  return taskTable;
+}
+
+uint8_t schedulerTaskCount() {
+  return taskCount;
+}
+
+uint8_t schedulerRunningTask() {
+  return running;
+}
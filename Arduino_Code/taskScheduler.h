@@ -0,0 +1,61 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// Cooperative scheduler driven from loop().
+//
+// Tasks live in a static table. A task with period 0 runs on every pass, any
+// other task runs when its next release time is reached; the release time
+// advances by whole periods so timing never drifts with loop speed. A task
+// that starts more than `deadline` ms late counts an overrun, and if it fell
+// a whole period behind the missed releases are skipped rather than burst.
+typedef void (*TaskFunction)();
+
+struct Task {
+  PGM_P name;
+  TaskFunction run;
+  uint32_t period;    // ms, 0 = every pass
+  uint32_t deadline;  // Allowed start lateness in ms
+  bool enabled;
+
+  // Bookkeeping, maintained by the scheduler
+  uint32_t nextRun;
+  uint32_t runs;
+  uint16_t overruns;
+  uint32_t maxLateness;  // ms
+  uint32_t maxDuration;  // us
+};
+
+// Declare a table entry; the bookkeeping fields start at zero
+#define TASK(name, function, period, deadline) \
+  { name, function, period, deadline, true, 0, 0, 0, 0, 0 }
+
+void schedulerBegin(Task* tasks, uint8_t count, uint32_t now);
+
+// Run every task that is due, in table order
+void schedulerRun(uint32_t now);
+
+// Change a task's period, the next release is one new period from now
+void schedulerSetPeriod(Task& task, uint32_t period, uint32_t now);
+
+// Release a periodic task now; a task later in the table still runs this pass
+void schedulerRunNow(Task& task, uint32_t now);
+
+// Enable or disable a task, an enabled periodic task next runs one period from now
+void schedulerSetEnabled(Task& task, bool enabled, uint32_t now);
+
+// Reset the runtime statistics of all tasks
+void schedulerResetStats();
+
+Task* schedulerTasks();
+uint8_t schedulerTaskCount();
+
+// Index of the task running now, SCHEDULER_IDLE between tasks. Kept over a
+// reset, so after a watchdog reset it names the task that hung until
+// schedulerBegin() runs.
+#define SCHEDULER_IDLE 0xFF
+uint8_t schedulerRunningTask();
+
+#endif
@@ -0,0 +1,77 @@
+#include "txQueue.h"
+
+#include <string.h>
+
+static_assert(TX_QUEUE_SIZE == 256, "the ring indices wrap as uint8_t");
+
+TxQueue::TxQueue(HardwareSerial& port, int8_t ctsPin)
+    : port(port), ctsPin(ctsPin), head(0), tail(0), maxPending(0), stallCount(0) {}
+
+void TxQueue::begin() {
+  if (ctsPin >= 0) pinMode(ctsPin, INPUT_PULLUP);
+}
+
+bool TxQueue::clearToSend() const {
+  return ctsPin < 0 || digitalRead(ctsPin) == LOW;
+}
+
+size_t TxQueue::write(uint8_t data) {
+  if ((uint8_t)(head + 1) == tail) {
+    stallCount++;
+    // Ring full: wait for the UART to take the oldest byte
+    while ((uint8_t)(head + 1) == tail) {
+      while (!clearToSend()) {}
+      port.write(buffer[tail++]);
+    }
+  }
+  buffer[head++] = data;
+  if ((uint8_t)(head - tail) > maxPending) maxPending = head - tail;
+  return 1;
+}
+
+size_t TxQueue::write(const uint8_t* data, size_t size) {
+  size_t left = size;
+  while (left > 0) {
+    // Copy as much as fits before the wrap or the free space ends
+    uint8_t space = TX_QUEUE_SIZE - 1 - (uint8_t)(head - tail);
+    if (space == 0) {
+      write(*data++);  // Waits for the UART
+      left--;
+      continue;
+    }
+    size_t chunk = TX_QUEUE_SIZE - head;
+    if (chunk > space) chunk = space;
+    if (chunk > left) chunk = left;
+    memcpy(buffer + head, data, chunk);
+    head += chunk;
+    data += chunk;
+    left -= chunk;
+  }
+  if ((uint8_t)(head - tail) > maxPending) maxPending = head - tail;
+  return size;
+}
+
+void TxQueue::pump() {
+  if (head == tail || !clearToSend()) return;
+  int room = port.availableForWrite();
+  while (room-- > 0 && tail != head) {
+    port.write(buffer[tail++]);
+  }
+}
+
+bool TxQueue::ready() {
+  return head != tail && clearToSend() && port.availableForWrite() > 0;
+}
+
+void TxQueue::drain() {
+  while (tail != head) {
+    while (!clearToSend()) {}
+    port.write(buffer[tail++]);
+  }
+  port.flush();
+}
+
+void TxQueue::resetStats() {
+  maxPending = head - tail;
+  stallCount = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef TX_QUEUE_H
+#define TX_QUEUE_H
+
+#include <Arduino.h>
+
+// Background transmit queue in front of a hardware serial port.
+//
+// HardwareSerial only buffers 64 bytes; a longer JSON line or batch frame
+// blocks in write() until the UART has shifted enough out, which at 9600
+// baud is about 1 ms per byte of excess. TxQueue is a Print that copies into
+// a larger RAM ring instead and pump() hands bytes to the port only while it
+// has room, so a report costs a memcpy-sized write and the sampling tasks
+// keep running while it drains. Only when the ring itself is full does a
+// write wait for the port, so nothing is ever dropped.
+//
+// With TX_CTS_PIN set the queue also honours hardware flow control: bytes
+// are only handed to the UART while the receiver holds CTS low.
+#define TX_QUEUE_SIZE 256  // Bytes, one slot stays free
+
+class TxQueue : public Print {
+public:
+  TxQueue(HardwareSerial& port, int8_t ctsPin);
+
+  void begin();
+
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t* data, size_t size) override;
+  using Print::write;
+
+  // Move queued bytes into the UART buffer without blocking
+  void pump();
+
+  // Queued bytes exist and the UART can take some now
+  bool ready();
+
+  // Block until everything queued has left the UART, e.g. before a baud change
+  void drain();
+
+  uint16_t pending() const { return (uint8_t)(head - tail); }
+  uint16_t space() const { return TX_QUEUE_SIZE - 1 - pending(); }  // Bytes a write takes without waiting
+  uint16_t highWater() const { return maxPending; }
+
+  // Writes that had to wait because the ring was full
+  uint16_t stalls() const { return stallCount; }
+
+  void resetStats();
+
+private:
+  bool clearToSend() const;
+
+  HardwareSerial& port;
+  int8_t ctsPin;
+  uint8_t buffer[TX_QUEUE_SIZE];
+  uint8_t head;  // Next byte written
+  uint8_t tail;  // Next byte sent
+  uint8_t maxPending;
+  uint16_t stallCount;
+};
+
+#endif
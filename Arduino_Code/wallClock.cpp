@@ -0,0 +1,137 @@
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "config.h"
+#include "wallClock.h"
+
+#define DS3231_ADDRESS 0x68
+#define DS3231_TIME 0x00    // Seconds to year, BCD
+#define DS3231_STATUS 0x0F
+#define DS3231_OSF 0x80     // Oscillator stopped, the time is not valid
+#define DS3231_CENTURY 0x80 // In the month register
+
+static uint32_t seconds = 0;
+static uint32_t lastMs = 0;
+static ClockSource source = CLOCK_NONE;
+
+static void setTime(uint32_t unixTime, ClockSource from) {
+  seconds = unixTime;
+  lastMs = millis();
+  source = from;
+}
+
+#if RTC_DS3231
+// Days since 1970-01-01 of a date from 2000 on (Howard Hinnant's days_from_civil)
+static uint32_t daysFromCivil(uint16_t year, uint8_t month, uint8_t day) {
+  if (month <= 2) year--;
+  uint16_t yearOfEra = year % 400;
+  uint16_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  uint32_t dayOfEra = (uint32_t)yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return (uint32_t)(year / 400) * 146097 + dayOfEra - 719468;
+}
+
+static uint8_t fromBcd(uint8_t value) {
+  return (value >> 4) * 10 + (value & 0x0F);
+}
+
+static uint8_t toBcd(uint8_t value) {
+  return ((value / 10) << 4) | (value % 10);
+}
+
+static bool readRegisters(uint8_t first, uint8_t* out, uint8_t count) {
+  Wire.beginTransmission(DS3231_ADDRESS);
+  Wire.write(first);
+  if (Wire.endTransmission() != 0) return false;
+  if (Wire.requestFrom((uint8_t)DS3231_ADDRESS, count) != count) return false;
+  for (uint8_t i = 0; i < count; i++) out[i] = Wire.read();
+  return true;
+}
+
+static bool readRtc() {
+  uint8_t status;
+  uint8_t time[7];
+  if (!readRegisters(DS3231_STATUS, &status, 1) || (status & DS3231_OSF)) return false;
+  if (!readRegisters(DS3231_TIME, time, sizeof(time))) return false;
+
+  // 24-hour mode is set whenever the time is written
+  uint16_t year = 2000 + fromBcd(time[6]) + (time[5] & DS3231_CENTURY ? 100 : 0);
+  uint32_t days = daysFromCivil(year, fromBcd(time[5] & 0x1F), fromBcd(time[4]));
+  uint32_t secondOfDay = fromBcd(time[2] & 0x3F) * 3600UL + fromBcd(time[1]) * 60 + fromBcd(time[0]);
+  setTime(days * 86400UL + secondOfDay, CLOCK_RTC);
+  return true;
+}
+
+static void writeRtc(uint32_t unixTime) {
+  // Civil date from days since 1970 (Howard Hinnant's civil_from_days)
+  uint32_t days = unixTime / 86400UL;
+  uint32_t secondOfDay = unixTime - days * 86400UL;
+  uint32_t z = days + 719468;
+  uint32_t era = z / 146097;
+  uint32_t dayOfEra = z - era * 146097;
+  uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  uint16_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  uint8_t mp = (5 * dayOfYear + 2) / 153;
+  uint8_t day = dayOfYear - (153 * mp + 2) / 5 + 1;
+  uint8_t month = mp < 10 ? mp + 3 : mp - 9;
+  uint16_t year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+  if (year < 2000 || year > 2199) return;
+
+  Wire.beginTransmission(DS3231_ADDRESS);
+  Wire.write((uint8_t)DS3231_TIME);
+  Wire.write(toBcd(secondOfDay % 60));
+  Wire.write(toBcd(secondOfDay / 60 % 60));
+  Wire.write(toBcd(secondOfDay / 3600));  // Bit 6 clear: 24-hour mode
+  Wire.write(toBcd((days + 4) % 7 + 1));  // 1970-01-01 was a Thursday, 1 = Sunday
+  Wire.write(toBcd(day));
+  Wire.write(toBcd(month) | (year >= 2100 ? DS3231_CENTURY : 0));
+  Wire.write(toBcd(year % 100));
+  Wire.endTransmission();
+
+  // Clear the oscillator-stop flag, the time is valid now
+  Wire.beginTransmission(DS3231_ADDRESS);
+  Wire.write((uint8_t)DS3231_STATUS);
+  Wire.write((uint8_t)0);
+  Wire.endTransmission();
+}
+#endif
+
+bool wallClockBegin() {
+#if RTC_DS3231
+  return readRtc();
+#else
+  return false;
+#endif
+}
+
+void wallClockSet(uint32_t unixTime) {
+  setTime(unixTime, CLOCK_HOST);
+#if RTC_DS3231
+  writeRtc(unixTime);
+#endif
+}
+
+void wallClockSync() {
+#if RTC_DS3231
+  // A server-set time is kept if the RTC stopped since
+  readRtc();
+#endif
+}
+
+uint32_t wallClockNow() {
+  if (source == CLOCK_NONE) return 0;
+  uint32_t elapsed = millis() - lastMs;
+  if (elapsed >= 1000) {
+    uint32_t whole = elapsed / 1000;
+    seconds += whole;
+    lastMs += whole * 1000;
+  }
+  return seconds;
+}
+
+ClockSource wallClockSource() {
+  return source;
+}
+
+void wallClockResume(uint32_t unixTime, ClockSource from) {
+  setTime(unixTime, from);
+}
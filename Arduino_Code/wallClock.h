@@ -0,0 +1,33 @@
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#include <stdint.h>
+
+// Wall-clock time for sample timestamps, Unix seconds (UTC).
+//
+// The clock runs on millis() between syncs. It is set by the server's
+// "time <unix>" command or, with RTC_DS3231, read from a DS3231 on the I2C
+// bus at boot and every RTC_SYNC_INTERVAL; the board's ceramic resonator
+// alone drifts by minutes a day. A "time" command also sets the RTC, so a
+// board with one keeps correct time across power cycles without the server.
+// Until either source has been seen the time reads 0.
+enum ClockSource : uint8_t { CLOCK_NONE, CLOCK_HOST, CLOCK_RTC };
+
+// Probe the RTC and take its time, false without a running one
+bool wallClockBegin();
+
+// Set the time from the server, and the RTC if there is one
+void wallClockSet(uint32_t unixTime);
+
+// Re-read the RTC, a no-op without one
+void wallClockSync();
+
+// Current time, 0 while unknown
+uint32_t wallClockNow();
+
+ClockSource wallClockSource();
+
+// Continue the time from before a warm restart
+void wallClockResume(uint32_t unixTime, ClockSource from);
+
+#endif
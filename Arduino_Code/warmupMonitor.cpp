@@ -0,0 +1,54 @@
+#include "warmupMonitor.h"
+
+#define WARMUP_DRIFT_SHIFT 1  // Smoothing of the per-tick drift, alpha = 1/2
+
+WarmupMonitor::WarmupMonitor()
+    : state(WARMING), startTime(0), primed(false), stableReadings(0), stabilityPercent(0) {}
+
+void WarmupMonitor::begin(uint32_t now) {
+  state = WARMING;
+  startTime = now;
+  primed = false;
+  stableReadings = 0;
+  stabilityPercent = 0;
+}
+
+void WarmupMonitor::finish() {
+  state = LIVE;
+  stabilityPercent = 100;
+}
+
+void WarmupMonitor::update(const uint16_t* values, uint8_t count, uint32_t now) {
+  if (count > WARMUP_MAX_CHANNELS) count = WARMUP_MAX_CHANNELS;
+
+  if (!primed) {
+    for (uint8_t i = 0; i < count; i++) {
+      previous[i] = values[i];
+      drift[i] = WARMUP_STABLE_DRIFT * 4;  // Assume unstable until measured
+    }
+    primed = true;
+    return;
+  }
+
+  uint16_t worst = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    uint16_t delta = values[i] > previous[i] ? values[i] - previous[i] : previous[i] - values[i];
+    previous[i] = values[i];
+    drift[i] = drift[i] - (drift[i] >> WARMUP_DRIFT_SHIFT) + (delta >> WARMUP_DRIFT_SHIFT);
+    if (drift[i] > worst) worst = drift[i];
+  }
+
+  if (state == LIVE) return;
+
+  stabilityPercent = worst <= WARMUP_STABLE_DRIFT ? 100 : (uint32_t)WARMUP_STABLE_DRIFT * 100 / worst;
+  if (worst <= WARMUP_STABLE_DRIFT) {
+    if (stableReadings < 255) stableReadings++;
+  } else {
+    stableReadings = 0;
+  }
+
+  uint32_t elapsed = now - startTime;
+  if ((stableReadings >= WARMUP_STABLE_READINGS && elapsed >= WARMUP_MIN_MS) || elapsed >= WARMUP_MAX_MS) {
+    state = LIVE;
+  }
+}
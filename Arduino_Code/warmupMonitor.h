@@ -0,0 +1,48 @@
+#ifndef WARMUP_MONITOR_H
+#define WARMUP_MONITOR_H
+
+#include <stdint.h>
+
+// Sensor warm-up tracking, replaces the fixed delay after power-up.
+//
+// The MQ heaters take a while to settle; rather than waiting a fixed time,
+// the monitor watches how much each filtered reading moves between sensor
+// ticks. Once every channel has stayed within WARMUP_STABLE_DRIFT for
+// WARMUP_STABLE_READINGS ticks in a row (and WARMUP_MIN_MS has passed) the
+// device goes live. WARMUP_MAX_MS bounds the wait on a noisy site.
+#define WARMUP_MIN_MS 10000UL
+#define WARMUP_MAX_MS 120000UL
+#define WARMUP_STABLE_DRIFT 32   // Counts << FILTER_FRAC_BITS per tick (2 counts)
+#define WARMUP_STABLE_READINGS 5
+#define WARMUP_MAX_CHANNELS 4
+
+class WarmupMonitor {
+public:
+  WarmupMonitor();
+
+  void begin(uint32_t now);
+
+  // Skip straight to live, e.g. when the heaters are known to be hot
+  void finish();
+
+  // Feed one filtered value per channel once per sensor tick
+  void update(const uint16_t* values, uint8_t count, uint32_t now);
+
+  bool warming() const { return state == WARMING; }
+
+  // 0-100, reaches 100 when the readings are within the stable drift
+  uint8_t stability() const { return stabilityPercent; }
+
+private:
+  enum State : uint8_t { WARMING, LIVE };
+
+  State state;
+  uint32_t startTime;
+  bool primed;
+  uint16_t previous[WARMUP_MAX_CHANNELS];
+  uint16_t drift[WARMUP_MAX_CHANNELS];  // Smoothed |delta| per tick
+  uint8_t stableReadings;
+  uint8_t stabilityPercent;
+};
+
+#endif
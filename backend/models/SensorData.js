@@ -10,6 +10,8 @@ const sensorDataSchema = new mongoose.Schema(
     co: Number,
     methane: Number, // Added to match Arduino data
     airQuality: Number, // Added to match Arduino data
+    node: Number, // RS-485 bus node ID, unset for a board on USB
+    seq: Number, // Device sample sequence number, wraps at 65536
     o3: Number,
     so2: Number,
     no2: Number,
@@ -8,11 +8,14 @@ import emailRoutes from "./routes/emailRoutes.js";
 import predictionRoutes from "./routes/predictionRoutes.js"; // Add this
 import mongoose from "mongoose";
 import { SerialPort } from "serialport";
-import { ReadlineParser } from "@serialport/parser-readline";
 import SensorData from "./models/SensorData.js";
 import { checkAndSendAlerts } from "./controllers/emailController.js";
 import axios from "axios";
 import { calculateAQI } from "./utils/aqiCalculator.js";
+import { ArduinoStreamDecoder, FRAME_TYPES, LOG_UNIX_EPOCH, LogBlockAssembler, decodeBatchPayload, decodeDeltaBatchPayload, decodeJsonBatch, decodeSamplePayload, decodePmPayload, decodeStatsPayload, decodeSummaryPayload } from "./utils/frameDecoder.js";
+import { BusGateway } from "./utils/busGateway.js";
+import { buildConfigCommands } from "./utils/deviceConfig.js";
+import { negotiateBaud } from "./utils/baudNegotiator.js";
 
 dotenv.config();
 
@@ -29,25 +32,218 @@ app.use("/api/predictions", predictionRoutes); // Add this route
 
 app.get("/", (req, res) => res.send("API is running..."));
 
+// Fetch current weather/air quality data from OpenWeatherMap, null if unavailable
+const fetchApiData = async () => {
+    const apiKey = process.env.OPENWEATHERMAP_API_KEY;
+    if (!apiKey) return null;
+
+    try {
+        const [airPollution, weather] = await Promise.all([
+            axios.get(`https://api.openweathermap.org/data/2.5/air_pollution?lat=22.3569&lon=91.7832&appid=${apiKey}`),
+            axios.get(`https://api.openweathermap.org/data/2.5/weather?q=${process.env.CITY_NAME || "Chittagong,BD"}&appid=${apiKey}&units=metric`),
+        ]);
+
+        // Extract API pollution data
+        return { components: airPollution.data.list[0].components, weather: weather.data };
+    } catch (apiError) {
+        console.error("Failed to fetch API data:", apiError.message);
+        return null;
+    }
+};
+
+// Build a SensorData document from an Arduino reading and optional API data
+const buildSensorEntry = (sensorData, apiData) => {
+    const entry = {
+        // Arduino sensor values
+        co: parseFloat(sensorData.co) || 0,
+        methane: parseFloat(sensorData.methane) || 0,
+        airQuality: parseFloat(sensorData.airQuality) || 0,
+        aqi: 0,
+        temperature: 0,
+        humidity: 0,
+        pm25: 0,
+        pm10: 0,
+        o3: 0,
+        so2: 0,
+        no2: 0,
+        nh3: 0,
+    };
+
+    // Batched readings carry the time they were taken on the device
+    if (sensorData.timestamp) entry.createdAt = sensorData.timestamp;
+    // Readings collected over the RS-485 bus carry the node that took them
+    if (sensorData.node !== undefined) entry.node = sensorData.node;
+    if (sensorData.seq !== undefined) entry.seq = sensorData.seq;
+
+    if (apiData) {
+        const { components, weather } = apiData;
+
+        // Weather API values
+        entry.temperature = weather.main.temp || 0;
+        entry.humidity = weather.main.humidity || 0;
+
+        // Air pollution API values
+        entry.pm25 = components.pm2_5 || 0;
+        entry.pm10 = components.pm10 || 0;
+        entry.o3 = components.o3 || 0;
+        entry.so2 = components.so2 || 0;
+        entry.no2 = components.no2 || 0;
+        entry.nh3 = components.nh3 || 0;
+
+        // Calculate AQI based on the components
+        entry.aqi = calculateAQI({
+            pm25: components.pm2_5,
+            pm10: components.pm10,
+            o3: components.o3,
+            co: components.co / 1000,  // Convert from μg/m³ to ppm (approximate conversion)
+            so2: components.so2,
+            no2: components.no2,
+            nh3: components.nh3,
+        });
+    }
+
+    // A PM sensor on the board replaces the city-wide API values
+    if (sensorData.pm25 !== undefined) {
+        entry.pm25 = parseFloat(sensorData.pm25) || 0;
+        entry.pm10 = parseFloat(sensorData.pm10) || 0;
+    }
+
+    return entry;
+};
+
+// Save Arduino readings, merged with OpenWeatherMap data when an API key is configured.
+// A batch is written with a single insertMany.
+const saveArduinoReadings = async (readings) => {
+    // Current weather would be wrong for readings backfilled from the SD log
+    const apiData = readings.every((reading) => reading.backfilled) ? null : await fetchApiData();
+    const entries = readings.map((reading) => buildSensorEntry(reading, apiData));
+    const source = apiData ? "Arduino + API" : "Arduino-only";
+
+    if (entries.length === 1) {
+        const newEntry = new SensorData(entries[0]);
+        await newEntry.save();
+        console.log(`Saved ${source} data to DB:`, newEntry);
+    } else {
+        await SensorData.insertMany(entries);
+        console.log(`Saved batch of ${entries.length} ${source} readings to DB`);
+    }
+    checkAndSendAlerts();
+};
+
+// Recently stored sequence numbers per node, to drop readings sent twice
+// (a batch resent after a lost ack) and to notice lost ones. A seq only
+// counts as a repeat if its time is close too, the counter restarts at boot.
+const RECENT_SEQ_LIMIT = 256;
+const DUPLICATE_WINDOW_MS = 60 * 1000;
+const recentSeqs = new Map();  // "node:seq" -> timestamp ms, in insertion order
+const lastSeqs = new Map();    // node -> last seq stored
+
+const isDuplicate = (reading) => {
+    if (reading.seq === undefined) return false;
+    const key = `${reading.node ?? ""}:${reading.seq}`;
+    const time = reading.timestamp ? reading.timestamp.getTime() : Date.now();
+    const previous = recentSeqs.get(key);
+    if (previous !== undefined && Math.abs(previous - time) < DUPLICATE_WINDOW_MS) return true;
+
+    recentSeqs.delete(key);
+    recentSeqs.set(key, time);
+    if (recentSeqs.size > RECENT_SEQ_LIMIT) recentSeqs.delete(recentSeqs.keys().next().value);
+
+    const node = reading.node ?? "";
+    const last = lastSeqs.get(node);
+    const missed = last === undefined ? 0 : (reading.seq - last - 1) & 0xffff;
+    if (missed > 0 && missed < 0x8000) {
+        console.log(`Missed ${missed} sample(s) before seq ${reading.seq}${reading.node !== undefined ? ` from node ${reading.node}` : ""}`);
+    }
+    lastSeqs.set(node, reading.seq);
+    return false;
+};
+
+// Store Arduino readings; readings taken while the sensors warm up are skipped
+const storeReadings = async (readings) => {
+    console.log("Received from Arduino:", readings.length === 1 ? readings[0] : `${readings.length} batched readings`);
+
+    // Validate Arduino data
+    if (readings.some((reading) => typeof reading !== 'object')) {
+        throw new Error("Invalid data format from Arduino");
+    }
+
+    const unique = readings.filter((reading) => !isDuplicate(reading));
+    if (unique.length < readings.length) {
+        console.log(`Skipping ${readings.length - unique.length} reading(s) already stored`);
+    }
+    const live = unique.filter((reading) => !reading.warming);
+    if (live.length < unique.length) {
+        console.log(`Skipping ${unique.length - live.length} reading(s) taken during sensor warm-up`);
+    }
+    if (live.length > 0) {
+        await saveArduinoReadings(live);
+    }
+};
+
+// Serial link settings. BUS_NODES (e.g. "1,2,3") switches to gateway mode:
+// the port is an RS-485 adapter and the listed nodes are polled in turn.
+const ARDUINO_PORT = process.env.ARDUINO_PORT || "COM3";
+const BUS_NODES = (process.env.BUS_NODES || "")
+    .split(",")
+    .map((node) => parseInt(node, 10))
+    .filter((node) => node >= 1 && node <= 247);
+const ARDUINO_BAUD = parseInt(process.env.ARDUINO_BAUD, 10) || (BUS_NODES.length > 0 ? 115200 : 9600);
+// Over USB the link starts at ARDUINO_BAUD and is then negotiated up to
+// ARDUINO_TARGET_BAUD (set it to ARDUINO_BAUD to keep the link fixed)
+const ARDUINO_TARGET_BAUD = parseInt(process.env.ARDUINO_TARGET_BAUD, 10) || (BUS_NODES.length > 0 ? ARDUINO_BAUD : 115200);
+
 // Initialize arduinoPortInstance first
 let arduinoPortInstance = null;
+let latestSummary = null;  // Rolling statistics last sent by the board
+let latestPm = null;       // Last FRAME_TYPE_PM from the board's particulate sensor
+const PM_STALE_MS = 10000;  // Same as PM_STALE_MS in config.h
+
+// "log read" stream in progress: the board's log clock when it started and
+// when that was, to turn log times back into dates
+let logBackfill = null;
+const logAssembler = new LogBlockAssembler(
+    (block) => {
+        if (!logBackfill) return;
+        const { clock, receivedAt, from, to } = logBackfill;
+        const readings = block.records
+            .filter((record) => record.time >= from && record.time <= to)
+            .map(({ time, ...values }) => ({
+                ...values,
+                timestamp: new Date(time >= LOG_UNIX_EPOCH ? time * 1000 : receivedAt - (clock - time) * 1000),
+                backfilled: true,
+            }));
+        logBackfill.readings += readings.length;
+        if (readings.length > 0) {
+            storeReadings(readings).catch((error) => console.error("Log backfill Save Error:", error.message));
+        }
+    },
+    (error) => console.error("Log backfill:", error.message),
+);
+
+// Set the board's clock, samples then carry the time they were taken.
+// Repeated since the board's resonator drifts by minutes a day without an RTC.
+const TIME_SYNC_INTERVAL = 60 * 60 * 1000;
+const syncDeviceTime = () => {
+    if (!arduinoPortInstance || !arduinoPortInstance.isOpen) return;
+    arduinoPortInstance.write(`time ${Math.floor(Date.now() / 1000)}\n`);
+};
 
 // Connect to Arduino port
 (async () => {
     try {
-        // Try to connect directly to COM3 since we know that's our Arduino
-        const arduinoPort = "COM3";
+        const arduinoPort = ARDUINO_PORT;
 
         console.log(`Attempting to connect to port: ${arduinoPort}`);
 
-        // Make sure no other program is using COM3 before trying to open it
+        // Make sure no other program is using the port before trying to open it
         const ports = await SerialPort.list();
         // console.log("Available ports:", ports);
 
         // Create the SerialPort instance
         arduinoPortInstance = new SerialPort({
             path: arduinoPort,
-            baudRate: 9600,
+            baudRate: ARDUINO_BAUD,
             autoOpen: false, // Don't open immediately
         });
 
@@ -63,126 +259,148 @@ let arduinoPortInstance = null;
 
             console.log("Serial port opened successfully");
 
-            // Set up parser and data handling once connected
-            const parser = arduinoPortInstance.pipe(new ReadlineParser({ delimiter: "\r\n" }));
-
-            // In server.js, inside the parser.on("data") handler
-            parser.on("data", async (rawData) => {
-                try {
-                    // Your existing code to parse Arduino data
-                    const trimmedData = rawData.trim();
-                    if (!trimmedData || trimmedData === "") {
-                        console.log("Empty data received from Arduino, skipping");
-                        return;
+            // Set up parser and data handling once connected.
+            // The decoder accepts both JSON lines and binary sample frames.
+            const parser = arduinoPortInstance.pipe(new ArduinoStreamDecoder());
+
+            if (BUS_NODES.length > 0) {
+                const gateway = new BusGateway(arduinoPortInstance, parser, BUS_NODES);
+                console.log(`Polling bus nodes ${BUS_NODES.join(", ")}`);
+
+                gateway.on("message", async ({ node, type, payload }) => {
+                    try {
+                        let readings;
+                        if (type === FRAME_TYPES.BATCH) {
+                            readings = decodeBatchPayload(payload);
+                        } else if (type === FRAME_TYPES.BATCH_DELTA) {
+                            readings = decodeDeltaBatchPayload(payload);
+                        } else {
+                            console.log(`Ignoring frame type 0x${type.toString(16)} from node ${node}`);
+                            gateway.release(node);
+                            return;
+                        }
+                        readings = readings.map((reading) => ({ ...reading, node }));
+                        if (readings.length === 0) {
+                            gateway.release(node);
+                            return;
+                        }
+                        await storeReadings(readings);
+                        gateway.acknowledge(node, readings[readings.length - 1].seq);
+                    } catch (error) {
+                        console.error(`Bus node ${node} Parse/Save Error:`, error.message);
+                        gateway.release(node);
                     }
+                });
+                gateway.on("timeout", (node) => {
+                    console.log(`Bus node ${node} did not answer`);
+                });
+
+                arduinoPortInstance.on("close", () => gateway.stop());
+                arduinoPortInstance.on("open", () => gateway.start());
+                gateway.start();
+            }
 
-                    const sensorData = JSON.parse(trimmedData);
-                    console.log("Received from Arduino:", sensorData);
-
-                    // Validate Arduino data
-                    if (typeof sensorData !== 'object') {
-                        throw new Error("Invalid data format from Arduino");
+            if (BUS_NODES.length === 0) {
+                // Renegotiated on every (re)open, opening the port resets the board to ARDUINO_BAUD
+                let negotiating = false;
+                const negotiateLink = async () => {
+                    if (negotiating) return;
+                    negotiating = true;
+                    try {
+                        const baud = await negotiateBaud(arduinoPortInstance, parser, ARDUINO_TARGET_BAUD, { bootBaud: ARDUINO_BAUD });
+                        console.log(`Serial link running at ${baud} baud`);
+                        syncDeviceTime();
+                    } catch (error) {
+                        console.error("Baud negotiation failed:", error.message);
+                    } finally {
+                        negotiating = false;
                     }
+                };
+                arduinoPortInstance.on("open", negotiateLink);
+                negotiateLink();
+                setInterval(syncDeviceTime, TIME_SYNC_INTERVAL);
+            }
 
-                    // Fetch current weather/air quality data from OpenWeatherMap
-                    const apiKey = process.env.OPENWEATHERMAP_API_KEY;
-                    if (apiKey) {
-                        try {
-                            const [airPollution, weather] = await Promise.all([
-                                axios.get(`https://api.openweathermap.org/data/2.5/air_pollution?lat=22.3569&lon=91.7832&appid=${apiKey}`),
-                                axios.get(`https://api.openweathermap.org/data/2.5/weather?q=${process.env.CITY_NAME || "Chittagong,BD"}&appid=${apiKey}&units=metric`),
-                            ]);
-
-                            // Extract API pollution data
-                            const components = airPollution.data.list[0].components;
-
-                            // Create new sensor data entry with both Arduino and API data
-                            const newEntry = new SensorData({
-                                // Arduino sensor values
-                                co: parseFloat(sensorData.co) || 0,
-                                methane: parseFloat(sensorData.methane) || 0,
-                                airQuality: parseFloat(sensorData.airQuality) || 0,
-
-                                // Weather API values
-                                temperature: weather.data.main.temp || 0,
-                                humidity: weather.data.main.humidity || 0,
-
-                                // Air pollution API values
-                                pm25: components.pm2_5 || 0,
-                                pm10: components.pm10 || 0,
-                                o3: components.o3 || 0,
-                                so2: components.so2 || 0,
-                                no2: components.no2 || 0,
-                                nh3: components.nh3 || 0,
-
-                                // Calculate AQI here if needed or use the API's AQI
-                                // aqi: airPollution.data.list[0].main.aqi || 0,
-
-                                // Calculate AQI based on the components
-                                aqi: calculateAQI({
-                                    pm25: components.pm2_5,
-                                    pm10: components.pm10,
-                                    o3: components.o3,
-                                    co: components.co / 1000,  // Convert from μg/m³ to ppm (approximate conversion)
-                                    so2: components.so2,
-                                    no2: components.no2,
-                                    nh3: components.nh3,
-                                }),
-
-                            });
-
-                            await newEntry.save();
-                            console.log("Saved combined Arduino + API data to DB:", newEntry);
-                            checkAndSendAlerts();
-                        } catch (apiError) {
-                            console.error("Failed to fetch API data:", apiError.message);
-
-                            // Fall back to saving only Arduino data
-                            const newEntry = new SensorData({
-                                co: parseFloat(sensorData.co) || 0,
-                                methane: parseFloat(sensorData.methane) || 0,
-                                airQuality: parseFloat(sensorData.airQuality) || 0,
-                                aqi: 0, // Calculate if possible
-                                temperature: 0,
-                                humidity: 0,
-                                pm25: 0,
-                                pm10: 0,
-                                o3: 0,
-                                so2: 0,
-                                no2: 0,
-                                nh3: 0,
-                            });
-
-                            await newEntry.save();
-                            console.log("Saved Arduino-only data to DB (API fetch failed):", newEntry);
-                            checkAndSendAlerts();
+            parser.on("data", async (message) => {
+                // Bus replies are handled by the gateway
+                if (BUS_NODES.length > 0) return;
+
+                try {
+                    let readings;
+                    let isBatch = false;
+                    if (message.kind === "frame") {
+                        if (message.type === FRAME_TYPES.SAMPLE) {
+                            readings = [decodeSamplePayload(message.payload)];
+                            // Binary samples leave PM to its own frames, which arrive at the sensor's rate
+                            if (latestPm && Date.now() - latestPm.receivedAt < PM_STALE_MS) {
+                                readings[0].pm25 = latestPm.pm25;
+                                readings[0].pm10 = latestPm.pm10;
+                            }
+                        } else if (message.type === FRAME_TYPES.BATCH) {
+                            readings = decodeBatchPayload(message.payload);
+                            isBatch = true;
+                        } else if (message.type === FRAME_TYPES.BATCH_DELTA) {
+                            readings = decodeDeltaBatchPayload(message.payload);
+                            isBatch = true;
+                        } else if (message.type === FRAME_TYPES.STATS) {
+                            console.log("Arduino stats:", JSON.stringify(decodeStatsPayload(message.payload)));
+                            return;
+                        } else if (message.type === FRAME_TYPES.PM) {
+                            latestPm = { ...decodePmPayload(message.payload), receivedAt: Date.now() };
+                            return;
+                        } else if (message.type === FRAME_TYPES.SUMMARY) {
+                            latestSummary = { ...decodeSummaryPayload(message.payload), receivedAt: new Date() };
+                            return;
+                        } else if (message.type === FRAME_TYPES.LOG) {
+                            logAssembler.push(message.payload);
+                            return;
+                        } else {
+                            console.log(`Ignoring frame type 0x${message.type.toString(16)} from Arduino`);
+                            return;
                         }
+                    } else if (message.data.summary !== undefined) {
+                        latestSummary = { ...message.data.summary, receivedAt: new Date() };
+                        return;
+                    } else if (message.data.ack === "log" && message.data.from !== undefined) {
+                        const { clock, from, to, blocks } = message.data;
+                        logBackfill = { clock, from, to, receivedAt: Date.now(), readings: 0 };
+                        console.log(`Backfilling ${blocks} log block(s) from the SD card`);
+                        return;
+                    } else if (message.data.ack === "log" && message.data.done !== undefined) {
+                        if (logBackfill) console.log(`Backfilled ${logBackfill.readings} reading(s) from the SD card log`);
+                        logBackfill = null;
+                        return;
+                    } else if (message.data.boot !== undefined) {
+                        // Sent once from setup(), names the task that hung after a watchdog reset
+                        console.log("Arduino restarted:", JSON.stringify(message.data.boot));
+                        return;
+                    } else if (message.data.batch !== undefined) {
+                        readings = decodeJsonBatch(message.data.batch);
+                        isBatch = true;
+                    } else if (message.data.co === undefined) {
+                        // Command replies such as {"ack":"ping"} are not readings
+                        console.log("Arduino reply:", message.data);
+                        return;
                     } else {
-                        // No API key available, save only Arduino data
-                        const newEntry = new SensorData({
-                            co: parseFloat(sensorData.co) || 0,
-                            methane: parseFloat(sensorData.methane) || 0,
-                            airQuality: parseFloat(sensorData.airQuality) || 0,
-                            aqi: 0, // Calculate if possible
-                            temperature: 0,
-                            humidity: 0,
-                            pm25: 0,
-                            pm10: 0,
-                            o3: 0,
-                            so2: 0,
-                            no2: 0,
-                            nh3: 0,
-                        });
-
-                        await newEntry.save();
-                        console.log("Saved Arduino-only data to DB (no API key):", newEntry);
-                        checkAndSendAlerts();
+                        const { time, ...reading } = message.data;
+                        if (time > 0) reading.timestamp = new Date(time * 1000);
+                        readings = [reading];
+                    }
+                    await storeReadings(readings);
+
+                    // Release the batch on the device once it is stored
+                    if (isBatch && readings.length > 0) {
+                        arduinoPortInstance.write(`ack ${readings[readings.length - 1].seq}\n`);
                     }
                 } catch (error) {
-                    console.error("Arduino Parse/Save Error:", error.message, "Raw data:", rawData);
+                    console.error("Arduino Parse/Save Error:", error.message, "Message:", message);
                 }
             });
 
+            parser.on("warning", (warning) => {
+                console.error("Arduino Parse Error:", warning.message);
+            });
+
             arduinoPortInstance.on("error", (err) => {
                 console.error("Serial Port Error:", err.message);
             });
@@ -202,6 +420,67 @@ let arduinoPortInstance = null;
     }
 })();
 
+// Latest 1-minute, 15-minute and hourly statistics computed on the board
+app.get("/api/device/summary", (req, res) => {
+    if (!latestSummary) {
+        return res.status(404).json({ error: "No summary received from the Arduino yet" });
+    }
+    res.json(latestSummary);
+});
+
+// Fill a gap in the database from the board's SD card log (SD_LOG), e.g.
+// POST /api/device/log/backfill {"since":"2026-01-01T12:00:00Z"}
+// Without "since" everything after the newest stored reading is requested.
+app.post("/api/device/log/backfill", async (req, res) => {
+    if (BUS_NODES.length > 0) {
+        return res.status(409).json({ error: "Bus nodes only answer polls and cannot stream their log" });
+    }
+    if (!arduinoPortInstance || !arduinoPortInstance.isOpen) {
+        return res.status(503).json({ error: "Arduino not connected" });
+    }
+
+    let since = req.body.since ? new Date(req.body.since) : null;
+    if (!since) {
+        const newest = await SensorData.findOne().sort({ createdAt: -1 }).select("createdAt");
+        since = newest ? newest.createdAt : new Date(0);
+    }
+    if (isNaN(since.getTime())) {
+        return res.status(400).json({ error: "since must be a date" });
+    }
+
+    // The board counts back from its own log clock, readings arrive as FRAME_TYPE_LOG frames
+    const seconds = Math.max(0, Math.ceil((Date.now() - since.getTime()) / 1000));
+    const command = `log last ${seconds}`;
+    arduinoPortInstance.write(`${command}\n`);
+    res.json({ sent: command });
+});
+
+// Push runtime settings to the board, e.g.
+// POST /api/device/config {"settings":{"sample":1000,"deadband":{"co":3}},"save":true}
+// The board answers each command with a JSON line, logged as "Arduino reply".
+// Commands are spaced out so the replies never back up the 64-byte RX buffer.
+const CONFIG_COMMAND_GAP_MS = 50;
+app.post("/api/device/config", async (req, res) => {
+    if (BUS_NODES.length > 0) {
+        return res.status(409).json({ error: "Bus nodes only answer polls and cannot be configured over the bus" });
+    }
+    if (!arduinoPortInstance || !arduinoPortInstance.isOpen) {
+        return res.status(503).json({ error: "Arduino not connected" });
+    }
+
+    let commands;
+    try {
+        commands = buildConfigCommands(req.body.settings, req.body.save === true);
+    } catch (error) {
+        return res.status(400).json({ error: error.message });
+    }
+    for (const command of commands) {
+        arduinoPortInstance.write(`${command}\n`);
+        await new Promise((resolve) => setTimeout(resolve, CONFIG_COMMAND_GAP_MS));
+    }
+    res.json({ sent: commands });
+});
+
 // Set up alert check interval (every 15 minutes)
 const ALERT_CHECK_INTERVAL = 2 * 60 * 1000; // 2 minutes in milliseconds
 console.log(`Setting up alert check interval: ${ALERT_CHECK_INTERVAL / 60000} minutes`);
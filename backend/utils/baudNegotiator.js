@@ -0,0 +1,62 @@
+// Link-rate handshake with the firmware's "baud <rate>" command.
+// The board boots at bootBaud. The negotiator checks it answers there, asks
+// it to switch, follows it and confirms with a ping at the new rate; the
+// board falls back to bootBaud by itself if that confirmation never arrives,
+// so a failed handshake leaves both ends at bootBaud.
+const BOARD_FALLBACK_MS = 2000;  // BAUD_CONFIRM_MS in the firmware
+
+const updateBaud = (port, baudRate) =>
+    new Promise((resolve, reject) => port.update({ baudRate }, (err) => (err ? reject(err) : resolve())));
+
+const delay = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// Resolve true once the board acknowledges `command`, false after timeoutMs
+const waitForAck = (decoder, command, timeoutMs) =>
+    new Promise((resolve) => {
+        const onData = (message) => {
+            if (message.kind === "json" && message.data.ack === command) finish(true);
+        };
+        const finish = (acked) => {
+            clearTimeout(timer);
+            decoder.off("data", onData);
+            resolve(acked);
+        };
+        const timer = setTimeout(() => finish(false), timeoutMs);
+        decoder.on("data", onData);
+    });
+
+// Ping until the board answers; the leading newline ends any partial line
+const ping = async (port, decoder, attempts, replyTimeoutMs) => {
+    for (let i = 0; i < attempts; i++) {
+        const acked = waitForAck(decoder, "ping", replyTimeoutMs);
+        port.write("\nping\n");
+        if (await acked) return true;
+    }
+    return false;
+};
+
+// Returns the baud rate the link ends up at
+export const negotiateBaud = async (port, decoder, targetBaud, { bootBaud = 9600, replyTimeoutMs = 500, bootAttempts = 6 } = {}) => {
+    await updateBaud(port, bootBaud);
+    if (targetBaud === bootBaud) return bootBaud;
+
+    // Opening the port usually resets the board, give the bootloader time
+    if (!(await ping(port, decoder, bootAttempts, replyTimeoutMs))) {
+        // No reset: the board may still be at the rate of an earlier session
+        await updateBaud(port, targetBaud);
+        if (await ping(port, decoder, 2, replyTimeoutMs)) return targetBaud;
+        await updateBaud(port, bootBaud);
+        return bootBaud;
+    }
+
+    const switched = waitForAck(decoder, "baud", replyTimeoutMs);
+    port.write(`baud ${targetBaud}\n`);
+    if (!(await switched)) return bootBaud;
+
+    await updateBaud(port, targetBaud);
+    if (await ping(port, decoder, 2, replyTimeoutMs)) return targetBaud;
+
+    await updateBaud(port, bootBaud);
+    await delay(BOARD_FALLBACK_MS);
+    return bootBaud;
+};
@@ -0,0 +1,103 @@
+// Gateway for nodes sharing one RS-485 line (firmware built with BUS_MODE)
+// Nodes never transmit on their own: the gateway polls them one at a time
+// and waits for the reply (or a timeout) before polling the next, so the
+// line is collision-free and each node is heard once per round.
+//
+// Every reply is emitted as "message" with { node, type, payload }. The
+// handler must answer with acknowledge(node, seq) once the records are
+// stored, or release(node) if they were not; the node is skipped until then
+// so a slow save never causes the same records to be sent twice.
+//
+// Nodes have no host link of their own, so their clocks are set from the
+// polls: a node's first poll carries the time, and so does one every
+// timeSyncIntervalMs after it answered one, as "time" does over USB.
+import { EventEmitter } from "events";
+import { FRAME_TYPES, decodeNodePayload, encodePollFrame } from "./frameDecoder.js";
+
+export class BusGateway extends EventEmitter {
+  constructor(port, decoder, nodes, { replyTimeoutMs = 100, roundIntervalMs = 1000, timeSyncIntervalMs = 60 * 60 * 1000 } = {}) {
+    super();
+    this.port = port;
+    this.decoder = decoder;
+    this.nodes = nodes;
+    this.replyTimeoutMs = replyTimeoutMs;
+    this.roundIntervalMs = roundIntervalMs;
+    this.timeSyncIntervalMs = timeSyncIntervalMs;
+
+    this.acks = new Map();       // node -> seq to acknowledge with the next poll
+    this.inFlight = new Set();   // nodes whose last reply is still being stored
+    this.timeouts = new Map();   // node -> polls without a reply
+    this.timeSynced = new Map(); // node -> Date.now() of the last answered poll with the time
+    this.index = 0;
+    this.roundStart = 0;
+    this.waitingFor = null;
+    this.timeSent = false;       // The outstanding poll carried the time
+    this.timer = null;
+
+    this.decoder.on("data", (message) => this.onMessage(message));
+  }
+
+  start() {
+    this.stop();
+    this.index = 0;
+    this.timeSynced.clear();  // Nodes may have been reset with the port
+    this.pollNext();
+  }
+
+  stop() {
+    clearTimeout(this.timer);
+    this.timer = null;
+    this.waitingFor = null;
+  }
+
+  acknowledge(node, seq) {
+    this.acks.set(node, seq);
+    this.inFlight.delete(node);
+  }
+
+  release(node) {
+    this.inFlight.delete(node);
+  }
+
+  pollNext() {
+    if (this.index === 0) this.roundStart = Date.now();
+
+    // Skip nodes whose previous reply has not been stored yet
+    while (this.index < this.nodes.length && this.inFlight.has(this.nodes[this.index])) {
+      this.index++;
+    }
+    if (this.index >= this.nodes.length) {
+      this.index = 0;
+      const wait = Math.max(0, this.roundStart + this.roundIntervalMs - Date.now());
+      this.timer = setTimeout(() => this.pollNext(), wait);
+      return;
+    }
+
+    const node = this.nodes[this.index++];
+    const now = Date.now();
+    this.waitingFor = node;
+    this.timeSent = !this.timeSynced.has(node) || now - this.timeSynced.get(node) >= this.timeSyncIntervalMs;
+    this.port.write(encodePollFrame(node, this.acks.get(node), this.timeSent ? Math.floor(now / 1000) : undefined));
+    this.timer = setTimeout(() => {
+      this.timeouts.set(node, (this.timeouts.get(node) || 0) + 1);
+      this.emit("timeout", node);
+      this.waitingFor = null;
+      this.pollNext();
+    }, this.replyTimeoutMs);
+  }
+
+  onMessage(message) {
+    if (message.kind !== "frame" || message.type !== FRAME_TYPES.NODE) return;
+
+    const reply = decodeNodePayload(message.payload);
+    if (reply.node !== this.waitingFor) return;
+
+    clearTimeout(this.timer);
+    this.waitingFor = null;
+    if (this.timeSent) this.timeSynced.set(reply.node, Date.now());
+    this.acks.delete(reply.node);
+    this.inFlight.add(reply.node);
+    this.emit("message", reply);
+    this.pollNext();
+  }
+}
@@ -0,0 +1,55 @@
+// Translate a configuration pushed through the API into the text commands
+// understood by the firmware ("config", "mode", "batch", "report", "display").
+// Every field is optional; unknown or out-of-range values are rejected before
+// anything is written to the board.
+const PERIOD_KEYS = ["sample", "transmit", "display", "heartbeat"];
+const DEADBAND_CHANNELS = ["co", "ch4", "aq"];
+const MIN_PERIOD_MS = 100;
+const MAX_PERIOD_MS = 3600000;
+
+const isInteger = (value, min, max) => Number.isInteger(value) && value >= min && value <= max;
+
+export const buildConfigCommands = (settings = {}, save = false) => {
+    const commands = [];
+
+    for (const key of PERIOD_KEYS) {
+        if (settings[key] === undefined) continue;
+        if (!isInteger(settings[key], MIN_PERIOD_MS, MAX_PERIOD_MS)) {
+            throw new Error(`${key} must be an integer between ${MIN_PERIOD_MS} and ${MAX_PERIOD_MS} ms`);
+        }
+        commands.push(`config ${key} ${settings[key]}`);
+    }
+
+    for (const [channel, units] of Object.entries(settings.deadband || {})) {
+        if (!DEADBAND_CHANNELS.includes(channel) || !isInteger(units, 0, 65535)) {
+            throw new Error(`deadband.${channel} must be one of ${DEADBAND_CHANNELS.join(", ")} with 0-65535 wire units`);
+        }
+        commands.push(`config deadband ${channel} ${units}`);
+    }
+
+    if (settings.batch !== undefined || settings.encoding !== undefined) {
+        if (!isInteger(settings.batch, 0, 32)) throw new Error("batch must be an integer between 0 and 32");
+        if (settings.encoding !== undefined && !["plain", "delta"].includes(settings.encoding)) {
+            throw new Error("encoding must be plain or delta");
+        }
+        commands.push(settings.encoding ? `batch ${settings.batch} ${settings.encoding}` : `batch ${settings.batch}`);
+    }
+
+    if (settings.protocol !== undefined) {
+        if (!["json", "bin"].includes(settings.protocol)) throw new Error("protocol must be json or bin");
+        commands.push(`mode ${settings.protocol}`);
+    }
+
+    if (settings.report !== undefined) {
+        if (typeof settings.report !== "boolean") throw new Error("report must be true or false");
+        commands.push(`report ${settings.report ? "on" : "off"}`);
+    }
+
+    if (settings.oled !== undefined) {
+        if (!["on", "off", "auto"].includes(settings.oled)) throw new Error("oled must be on, off or auto");
+        commands.push(`display ${settings.oled}`);
+    }
+
+    if (save) commands.push("config save");
+    return commands;
+};
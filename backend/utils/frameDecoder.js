@@ -0,0 +1,509 @@
+// Decoder for the Arduino serial link
+// The firmware sends either JSON lines or CRC-checked binary frames (see
+// Arduino_Code/serialProtocol.h). This transform accepts both on the same
+// stream and emits one object per message:
+//   { kind: "json", data }  for a parsed JSON line
+//   { kind: "frame", type, payload }  for a binary frame with a valid CRC
+import { Transform } from "stream";
+
+export const FRAME_SYNC = 0xa5;
+export const FRAME_HEADER_SIZE = 3;
+export const FRAME_OVERHEAD = 5;
+
+export const FRAME_TYPES = {
+  SAMPLE: 0x01,
+  BATCH: 0x02,
+  STATS: 0x03,
+  POLL: 0x04,
+  NODE: 0x05,
+  BATCH_DELTA: 0x06,
+  SUMMARY: 0x07,
+  PM: 0x08,
+  LOG: 0x09,
+};
+
+// FRAME_TYPE_POLL flags
+export const BUS_POLL_ACK = 0x01;
+export const BUS_POLL_TIME = 0x02;
+
+// Wire scaling, must match WIRE_SCALE_* in serialProtocol.h
+const WIRE_SCALE_CO = 10;
+const WIRE_SCALE_CH4 = 1;
+const WIRE_SCALE_AQ = 1;
+const WIRE_SCALE_PM = 1;
+
+// SampleRecord flags
+export const SAMPLE_FLAG_WARMING = 0x01;
+export const SAMPLE_FLAG_HEATER_LOW = 0x02;  // MQ-7 heater in its measuring phase
+
+// BATCH_MAX_RECORDS in serialProtocol.h, a JSON batch carries as many records
+const BATCH_MAX_RECORDS = Math.floor((250 - 5) / 13);
+
+// Longest JSON line the firmware sends: a full JSON batch with every field at
+// its widest, about 870 bytes. The next longest are the "stats" reply (at
+// most about 715 bytes) and the summary line (about 540); "tasks" answers
+// with one line per task, under 160 bytes each, so it stays short whatever
+// is built in. Anything longer without a newline is noise.
+const MAX_LINE_LENGTH =
+  '{"batch":{"now":4294967295,"records":['.length +
+  BATCH_MAX_RECORDS * ',[65535,4294967295,6553.5,65535.0,65535.0,255]'.length +
+  "]}}\r\n".length;
+
+// CRC-16/CCITT-FALSE, same as crc16Update() in the firmware
+export function crc16(buffer, start = 0, end = buffer.length) {
+  let crc = 0xffff;
+  for (let i = start; i < end; i++) {
+    crc ^= buffer[i] << 8;
+    for (let bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? ((crc << 1) ^ 0x1021) & 0xffff : (crc << 1) & 0xffff;
+    }
+  }
+  return crc;
+}
+
+// Wrap a payload into a frame, the inverse of what ArduinoStreamDecoder accepts
+export function encodeFrame(type, payload) {
+  const frame = Buffer.alloc(payload.length + FRAME_OVERHEAD);
+  frame[0] = FRAME_SYNC;
+  frame[1] = type;
+  frame[2] = payload.length;
+  payload.copy(frame, FRAME_HEADER_SIZE);
+  frame.writeUInt16LE(crc16(frame, 1, FRAME_HEADER_SIZE + payload.length), FRAME_HEADER_SIZE + payload.length);
+  return frame;
+}
+
+// Poll a bus node; ackSeq (optional) releases the records stored from its
+// last reply, unixTime (optional) sets its clock
+export function encodePollFrame(node, ackSeq, unixTime) {
+  const payload = Buffer.alloc(unixTime === undefined ? 4 : 8);
+  payload[0] = node;
+  payload[1] = (ackSeq === undefined ? 0 : BUS_POLL_ACK) | (unixTime === undefined ? 0 : BUS_POLL_TIME);
+  payload.writeUInt16LE(ackSeq ?? 0, 2);
+  if (unixTime !== undefined) payload.writeUInt32LE(unixTime, 4);
+  return encodeFrame(FRAME_TYPES.POLL, payload);
+}
+
+// Unwrap a FRAME_TYPE_NODE payload into the sending node and the inner frame
+export function decodeNodePayload(payload) {
+  return { node: payload[0], type: payload[1], payload: payload.subarray(2) };
+}
+
+// Convert a FRAME_TYPE_SAMPLE payload into the same shape as the JSON output
+export function decodeSamplePayload(payload) {
+  // Boards with a set clock stamp the sample, unix seconds (0 = not set)
+  const time = payload.length >= 20 ? payload.readUInt32LE(16) : 0;
+  return {
+    seq: payload.readUInt16LE(0),
+    raw: {
+      mq7: payload.readUInt16LE(2),
+      mq135: payload.readUInt16LE(4),
+      mq4: payload.readUInt16LE(6),
+    },
+    co: payload.readUInt16LE(8) / WIRE_SCALE_CO,
+    methane: payload.readUInt16LE(10) / WIRE_SCALE_CH4,
+    airQuality: payload.readUInt16LE(12) / WIRE_SCALE_AQ,
+    warming: (payload[14] & SAMPLE_FLAG_WARMING) !== 0,
+    heaterLow: (payload[14] & SAMPLE_FLAG_HEATER_LOW) !== 0,
+    stability: payload[15],
+    ...(time > 0 && { timestamp: new Date(time * 1000) }),
+  };
+}
+
+// Convert one batch record into a reading; receivedAt is when the batch
+// arrived, device times are relative to its millis() clock (`now`)
+const batchRecordToReading = (record, now, receivedAt) => ({
+  seq: record.seq,
+  co: record.co,
+  methane: record.methane,
+  airQuality: record.airQuality,
+  warming: (record.flags & SAMPLE_FLAG_WARMING) !== 0,
+  heaterLow: (record.flags & SAMPLE_FLAG_HEATER_LOW) !== 0,
+  timestamp: new Date(receivedAt - ((now - record.timeMs) >>> 0)),  // millis() wraps after 49 days
+});
+
+// Decode a FRAME_TYPE_BATCH payload into readings with timestamps
+export function decodeBatchPayload(payload, receivedAt = Date.now()) {
+  const now = payload.readUInt32LE(0);
+  const count = payload[4];
+  const readings = [];
+  for (let i = 0, offset = 5; i < count; i++, offset += 13) {
+    readings.push(batchRecordToReading({
+      seq: payload.readUInt16LE(offset),
+      timeMs: payload.readUInt32LE(offset + 2),
+      co: payload.readUInt16LE(offset + 6) / WIRE_SCALE_CO,
+      methane: payload.readUInt16LE(offset + 8) / WIRE_SCALE_CH4,
+      airQuality: payload.readUInt16LE(offset + 10) / WIRE_SCALE_AQ,
+      flags: payload[offset + 12],
+    }, now, receivedAt));
+  }
+  return readings;
+}
+
+// FRAME_TYPE_BATCH_DELTA record head, see serialProtocol.h
+const DELTA_HEAD_KEY = 0x80;
+const DELTA_HEAD_STEADY = 0x40;
+const DELTA_HEAD_CHANNEL_SHIFT = 3;
+const DELTA_HEAD_FLAGS = 0x07;
+const DELTA_CHANNELS = ["co", "ch4", "airQuality"];
+
+const unzigzag = (value) => (value % 2 === 1 ? -(value + 1) / 2 : value / 2);
+
+// Streaming decoder for FRAME_TYPE_BATCH_DELTA payloads. Bytes can be pushed
+// in chunks of any size; each record is passed to onRecord as a reading as
+// soon as its last byte arrives, so a batch never has to be held whole.
+export class DeltaBatchDecoder {
+  constructor(onRecord, receivedAt = Date.now()) {
+    this.onRecord = onRecord;
+    this.receivedAt = receivedAt;
+    this.header = [];
+    this.now = 0;
+    this.remaining = 0;
+    this.fields = [];       // Fields still to read for the current record
+    this.varint = 0;
+    this.shift = 0;
+    this.record = null;
+    this.previous = null;
+    this.interval = 0;
+  }
+
+  // True once every record announced in the header has been decoded
+  get done() {
+    return this.header.length === 5 && this.remaining === 0;
+  }
+
+  push(bytes) {
+    for (const byte of bytes) this.pushByte(byte);
+  }
+
+  pushByte(byte) {
+    if (this.header.length < 5) {
+      this.header.push(byte);
+      if (this.header.length === 5) {
+        const header = Buffer.from(this.header);
+        this.now = header.readUInt32LE(0);
+        this.remaining = header[4];
+      }
+      return;
+    }
+    if (this.remaining === 0) return;
+
+    if (this.record === null) {
+      this.startRecord(byte);
+    } else {
+      this.varint += (byte & 0x7f) * 2 ** this.shift;
+      this.shift += 7;
+      if (byte & 0x80) return;
+      this.applyField(this.fields.shift(), this.varint);
+      this.varint = 0;
+      this.shift = 0;
+    }
+    if (this.fields.length === 0) this.finishRecord();
+  }
+
+  startRecord(head) {
+    this.record = { head, flags: head & DELTA_HEAD_FLAGS };
+    if (head & DELTA_HEAD_KEY) {
+      this.fields = ["seq", "timeMs", "co", "ch4", "airQuality"];
+      return;
+    }
+    if (this.previous === null) throw new Error("Delta batch does not start with a key record");
+    this.fields = head & DELTA_HEAD_STEADY ? [] : ["step", "intervalChange"];
+    DELTA_CHANNELS.forEach((channel, i) => {
+      if (head & (1 << (DELTA_HEAD_CHANNEL_SHIFT + i))) this.fields.push(`${channel}Delta`);
+    });
+  }
+
+  applyField(field, value) {
+    if (field === "intervalChange" || field.endsWith("Delta")) value = unzigzag(value);
+    this.record[field] = value;
+  }
+
+  finishRecord() {
+    const record = this.record;
+    const previous = this.previous;
+    let reading;
+    if (record.head & DELTA_HEAD_KEY) {
+      reading = { seq: record.seq, timeMs: record.timeMs, co: record.co, ch4: record.ch4, airQuality: record.airQuality };
+      this.interval = 0;
+    } else {
+      if (!(record.head & DELTA_HEAD_STEADY)) {
+        this.interval += record.intervalChange;
+        reading = { seq: (previous.seq + record.step) & 0xffff };
+      } else {
+        reading = { seq: (previous.seq + 1) & 0xffff };
+      }
+      reading.timeMs = (previous.timeMs + this.interval) >>> 0;
+      for (const channel of DELTA_CHANNELS) {
+        reading[channel] = previous[channel] + (record[`${channel}Delta`] ?? 0);
+      }
+    }
+    this.previous = reading;
+    this.record = null;
+    this.remaining--;
+
+    this.onRecord(batchRecordToReading({
+      seq: reading.seq,
+      timeMs: reading.timeMs,
+      co: reading.co / WIRE_SCALE_CO,
+      methane: reading.ch4 / WIRE_SCALE_CH4,
+      airQuality: reading.airQuality / WIRE_SCALE_AQ,
+      flags: record.flags,
+    }, this.now, this.receivedAt));
+  }
+}
+
+// Decode a whole FRAME_TYPE_BATCH_DELTA payload into readings with timestamps
+export function decodeDeltaBatchPayload(payload, receivedAt = Date.now()) {
+  const readings = [];
+  const decoder = new DeltaBatchDecoder((reading) => readings.push(reading), receivedAt);
+  decoder.push(payload);
+  if (!decoder.done) throw new Error("Truncated delta batch");
+  return readings;
+}
+
+// Decode the JSON form of a batch: {"batch":{"now":ms,"records":[[seq,timeMs,co,methane,airQuality,flags],...]}}
+export function decodeJsonBatch(batch, receivedAt = Date.now()) {
+  return batch.records.map(([seq, timeMs, co, methane, airQuality, flags]) =>
+    batchRecordToReading({ seq, timeMs, co, methane, airQuality, flags }, batch.now, receivedAt));
+}
+
+// Profiled sections in FRAME_TYPE_STATS order, see profiler.h
+const STATS_SECTIONS = ["readSensors", "updateDisplay", "sendDataToPC", "receiveFromServer"];
+
+// Decode a FRAME_TYPE_STATS payload into the same shape as the "stats" JSON reply
+export function decodeStatsPayload(payload) {
+  let offset = 0;
+  const sectionCount = payload[offset++];
+  const sections = [];
+  for (let i = 0; i < sectionCount; i++, offset += 16) {
+    sections.push({
+      name: STATS_SECTIONS[i] ?? `section${i}`,
+      count: payload.readUInt32LE(offset),
+      min: payload.readUInt32LE(offset + 4),
+      max: payload.readUInt32LE(offset + 8),
+      mean: payload.readUInt32LE(offset + 12),
+    });
+  }
+  const bucketCount = payload[offset++];
+  const loopUs = [];
+  for (let i = 0; i < bucketCount; i++, offset += 2) {
+    loopUs.push(payload.readUInt16LE(offset));
+  }
+  return {
+    sections,
+    loopUs,
+    rxOverflows: payload.readUInt16LE(offset),
+    rxFull: payload.readUInt16LE(offset + 2),
+    adcOverruns: payload.readUInt16LE(offset + 4),
+    freeRam: payload.readUInt16LE(offset + 6),
+    minFreeRam: payload.readUInt16LE(offset + 8),
+  };
+}
+
+// Decode a FRAME_TYPE_PM payload, concentrations in ug/m3 and particle
+// counts per 0.1 L above 0.3, 0.5, 1, 2.5, 5 and 10 um
+export function decodePmPayload(payload) {
+  const counts = [];
+  for (let offset = 6; offset + 2 <= payload.length; offset += 2) {
+    counts.push(payload.readUInt16LE(offset));
+  }
+  return {
+    pm1: payload.readUInt16LE(0),
+    pm25: payload.readUInt16LE(2),
+    pm10: payload.readUInt16LE(4),
+    counts,
+  };
+}
+
+// Decode a FRAME_TYPE_SUMMARY payload into the shape of the JSON summary:
+// { now, windows: [{ seconds, readings, co: [min, max, mean, stddev], methane, airQuality }] }
+const SUMMARY_CHANNELS = [
+  ["co", WIRE_SCALE_CO],
+  ["methane", WIRE_SCALE_CH4],
+  ["airQuality", WIRE_SCALE_AQ],
+];
+
+export function decodeSummaryPayload(payload) {
+  const now = payload.readUInt32LE(0);
+  const windowCount = payload[4];
+  const channelCount = payload[5];
+  const windows = [];
+  let offset = 6;
+  for (let w = 0; w < windowCount; w++) {
+    const window = { seconds: payload.readUInt16LE(offset), readings: payload.readUInt16LE(offset + 2) };
+    offset += 4;
+    for (let c = 0; c < channelCount; c++, offset += 8) {
+      const [name, scale] = SUMMARY_CHANNELS[c] ?? [`channel${c}`, 1];
+      window[name] = [0, 2, 4, 6].map((field) => payload.readUInt16LE(offset + field) / scale);
+    }
+    windows.push(window);
+  }
+  return { now, windows };
+}
+
+// SD card log data block, see Arduino_Code/sdLog.h for the layout
+const LOG_HEADER_SIZE = 22;
+const LOG_BLOCK_MAGIC = 0x4c42;
+export const LOG_UNIX_EPOCH = 1500000000;  // 2017, far past any uptime in seconds
+const LOG_CHANNELS = [
+  ["co", WIRE_SCALE_CO],
+  ["methane", WIRE_SCALE_CH4],
+  ["airQuality", WIRE_SCALE_AQ],
+  ["pm25", WIRE_SCALE_PM],
+  ["pm10", WIRE_SCALE_PM],
+];
+
+// Decode one data block into { seq, startTime, endTime, records: [{ time, co, methane, airQuality }] },
+// times in seconds of the device's log clock; from LOG_UNIX_EPOCH on they are
+// Unix seconds, the log clock follows the board's wall clock once it is set. pm25 and pm10 are present on
+// boards that log them, except while the sensor was not sending.
+export function decodeLogBlock(block) {
+  if (block.length < LOG_HEADER_SIZE || block.readUInt16LE(0) !== LOG_BLOCK_MAGIC) {
+    throw new Error("Not a log block");
+  }
+  const used = block.readUInt16LE(16);
+  const end = LOG_HEADER_SIZE + used;
+  if (block.length < end) throw new Error("Truncated log block");
+  const crc = crc16(Buffer.concat([block.subarray(0, 20), block.subarray(LOG_HEADER_SIZE, end)]));
+  if (crc !== block.readUInt16LE(20)) throw new Error("Log block CRC mismatch");
+
+  const channels = block[18];
+  const count = block[19];
+  let offset = LOG_HEADER_SIZE;
+  const readVarint = () => {
+    let value = 0;
+    for (let shift = 0; ; shift += 7) {
+      const byte = block[offset++];
+      value += (byte & 0x7f) * 2 ** shift;
+      if (!(byte & 0x80)) return value;
+    }
+  };
+
+  const records = [];
+  const previous = new Array(channels).fill(0);
+  let time = block.readUInt32LE(8);
+  for (let i = 0; i < count && offset < end; i++) {
+    time += readVarint();
+    const record = { time };
+    for (let c = 0; c < channels; c++) {
+      previous[c] += unzigzag(readVarint());
+      const [name, scale] = LOG_CHANNELS[c] ?? [`channel${c}`, 1];
+      record[name] = previous[c] / scale;
+    }
+    // PM stays 0 while the sensor is stale
+    if (record.pm25 === 0 && record.pm10 === 0) {
+      delete record.pm25;
+      delete record.pm10;
+    }
+    records.push(record);
+  }
+  return {
+    seq: block.readUInt32LE(4),
+    startTime: block.readUInt32LE(8),
+    endTime: block.readUInt32LE(12),
+    records,
+  };
+}
+
+// Reassembles the FRAME_TYPE_LOG chunks of a "log read" stream into data
+// blocks and passes each decoded block to onBlock. A block with a missing
+// chunk is dropped and reported to onError.
+export class LogBlockAssembler {
+  constructor(onBlock, onError = () => {}) {
+    this.onBlock = onBlock;
+    this.onError = onError;
+    this.block = null;
+    this.seq = 0;
+    this.length = 0;
+  }
+
+  push(payload) {
+    const seq = payload.readUInt32LE(0);
+    const offset = payload.readUInt16LE(4);
+    const data = payload.subarray(6);
+
+    if (offset === 0) {
+      if (this.block) this.onError(new Error(`Log block ${this.seq} is incomplete`));
+      this.block = Buffer.alloc(512);
+      this.seq = seq;
+      this.length = 0;
+    } else if (!this.block || seq !== this.seq || offset !== this.length) {
+      this.onError(new Error(`Unexpected chunk ${seq}:${offset} in the log stream`));
+      this.block = null;
+      return;
+    }
+    data.copy(this.block, offset);
+    this.length = offset + data.length;
+
+    if (this.length < LOG_HEADER_SIZE || this.length < LOG_HEADER_SIZE + this.block.readUInt16LE(16)) return;
+    const block = this.block.subarray(0, this.length);
+    this.block = null;
+    try {
+      this.onBlock(decodeLogBlock(block));
+    } catch (error) {
+      this.onError(error);
+    }
+  }
+}
+
+export class ArduinoStreamDecoder extends Transform {
+  constructor(options = {}) {
+    super({ ...options, readableObjectMode: true });
+    this.buffer = Buffer.alloc(0);
+    this.crcErrors = 0;
+  }
+
+  _transform(chunk, encoding, callback) {
+    this.buffer = this.buffer.length ? Buffer.concat([this.buffer, chunk]) : chunk;
+    let offset = 0;
+
+    while (offset < this.buffer.length) {
+      const byte = this.buffer[offset];
+
+      if (byte === FRAME_SYNC) {
+        if (this.buffer.length - offset < FRAME_HEADER_SIZE) break;
+        const len = this.buffer[offset + 2];
+        const frameSize = len + FRAME_OVERHEAD;
+        if (this.buffer.length - offset < frameSize) break;
+
+        const crcEnd = offset + FRAME_HEADER_SIZE + len;
+        if (crc16(this.buffer, offset + 1, crcEnd) !== this.buffer.readUInt16LE(crcEnd)) {
+          // Not a real frame (or a corrupted one), resync on the next byte
+          this.crcErrors++;
+          offset++;
+          continue;
+        }
+
+        this.push({
+          kind: "frame",
+          type: this.buffer[offset + 1],
+          payload: Buffer.from(this.buffer.subarray(offset + FRAME_HEADER_SIZE, crcEnd)),
+        });
+        offset += frameSize;
+        continue;
+      }
+
+      if (byte === 0x7b) { // '{' starts a JSON line
+        const newline = this.buffer.indexOf(0x0a, offset);
+        if (newline < 0) {
+          if (this.buffer.length - offset > MAX_LINE_LENGTH) offset = this.buffer.length;
+          break;
+        }
+        const line = this.buffer.toString("utf8", offset, newline).trim();
+        offset = newline + 1;
+        try {
+          this.push({ kind: "json", data: JSON.parse(line) });
+        } catch (error) {
+          this.emit("warning", new Error(`Bad JSON line from Arduino: ${line}`));
+        }
+        continue;
+      }
+
+      // Line noise or stray line endings between messages
+      offset++;
+    }
+
+    this.buffer = this.buffer.subarray(offset);
+    callback();
+  }
+}